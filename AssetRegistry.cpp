@@ -0,0 +1,203 @@
+#include "AssetRegistry.hpp"
+#include "GLState.hpp"
+#include "Hash.hpp"
+#include "MappedFile.hpp"
+#include "TextureStreamer.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    AssetRegistry& AssetRegistry::Get() {
+        // never destroyed, so global models can still release into it at exit
+        static AssetRegistry* registry = new AssetRegistry();
+        return *registry;
+    }
+
+    AssetRegistry::AssetRegistry() : contentDedupe(false) {
+    }
+
+    uint32_t AssetRegistry::InternPath(const std::string& path) {
+        std::unordered_map<std::string, uint32_t>::iterator found = pathIds.find(path);
+        if (found != pathIds.end()) {
+            return found->second;
+        }
+        uint32_t pathId = paths.size();
+        paths.push_back(path);
+        pathIds[path] = pathId;
+        return pathId;
+    }
+
+    const std::string& AssetRegistry::GetPath(uint32_t pathId) const {
+        return paths.at(pathId);
+    }
+
+    void AssetRegistry::SetContentDedupe(bool enabled) {
+        contentDedupe = enabled;
+    }
+
+    uint64_t AssetRegistry::GetContentHash(uint32_t pathId) {
+        std::unordered_map<uint32_t, uint64_t>::iterator found = contentHashes.find(pathId);
+        if (found != contentHashes.end()) {
+            return found->second;
+        }
+        // 0 means unknown - missing files never match each other
+        uint64_t hash = 0;
+        gps::MappedFile file;
+        if (file.Open(paths[pathId])) {
+            hash = gps::HashBytes(file.GetData(), file.GetSize());
+            hash = gps::HashBytes(&hash, sizeof(hash), file.GetSize());
+            if (hash == 0) {
+                hash = 1;
+            }
+        }
+        contentHashes[pathId] = hash;
+        return hash;
+    }
+
+    template <typename T, typename Tag>
+    AssetHandle<Tag> AssetRegistry::Acquire(AssetPool<T, Tag>& pool, uint32_t pathId) {
+        AssetHandle<Tag> handle = pool.Find(pathId);
+        if (!handle.IsValid() && contentDedupe) {
+            uint64_t contentHash = GetContentHash(pathId);
+            if (contentHash != 0) {
+                handle = pool.FindContent(contentHash);
+                if (handle.IsValid()) {
+                    std::cout << "Same content : " << paths[pathId] << std::endl;
+                    pool.Alias(handle, pathId);
+                }
+            }
+        }
+        if (handle.IsValid()) {
+            pool.AddRef(handle);
+        }
+        return handle;
+    }
+
+    TextureHandle AssetRegistry::AcquireTexture(const std::string& path) {
+        return Acquire(textures, InternPath(path));
+    }
+
+    bool AssetRegistry::HasTexture(const std::string& path) {
+        uint32_t pathId = InternPath(path);
+        if (textures.Find(pathId).IsValid()) {
+            return true;
+        }
+        return contentDedupe && GetContentHash(pathId) != 0 &&
+               textures.FindContent(GetContentHash(pathId)).IsValid();
+    }
+
+    TextureHandle AssetRegistry::AddTexture(const std::string& path, GLuint textureId) {
+        uint32_t pathId = InternPath(path);
+        uint64_t contentHash = contentDedupe ? GetContentHash(pathId) : 0;
+        return textures.Add(pathId, contentHash, std::move(textureId));
+    }
+
+    GLuint AssetRegistry::GetTexture(TextureHandle handle) {
+        GLuint* textureId = textures.Get(handle);
+        return textureId ? *textureId : 0;
+    }
+
+    void AssetRegistry::ReleaseTexture(TextureHandle handle) {
+        GLuint textureId = 0;
+        if (textures.Release(handle, textureId)) {
+            gps::TextureStreamer::GetShared().Cancel(textureId);
+            gps::GLState::Get().ForgetTexture(textureId);
+            translucentTextures.erase(textureId);
+            glDeleteTextures(1, &textureId);
+        }
+    }
+
+    void AssetRegistry::SetTextureTranslucent(GLuint textureId) {
+        translucentTextures.insert(textureId);
+    }
+
+    bool AssetRegistry::IsTextureTranslucent(GLuint textureId) const {
+        return translucentTextures.count(textureId) != 0;
+    }
+
+    std::string AssetRegistry::CubemapKey(const std::vector<std::string>& faces) const {
+        std::string key;
+        for (size_t i = 0; i < faces.size(); i++) {
+            key += faces[i];
+            key += '\n';
+        }
+        return key;
+    }
+
+    uint64_t AssetRegistry::CubemapContentHash(const std::vector<std::string>& faces) {
+        uint64_t hash = gps::HASH_SEED;
+        for (size_t i = 0; i < faces.size(); i++) {
+            uint64_t faceHash = GetContentHash(InternPath(faces[i]));
+            if (faceHash == 0) {
+                return 0;
+            }
+            hash = gps::HashBytes(&faceHash, sizeof(faceHash), hash);
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    CubemapHandle AssetRegistry::AcquireCubemap(const std::vector<std::string>& faces) {
+        uint32_t keyId = InternPath(CubemapKey(faces));
+        CubemapHandle handle = cubemaps.Find(keyId);
+        if (!handle.IsValid() && contentDedupe) {
+            uint64_t contentHash = CubemapContentHash(faces);
+            if (contentHash != 0) {
+                handle = cubemaps.FindContent(contentHash);
+                cubemaps.Alias(handle, keyId);
+                if (handle.IsValid()) {
+                    std::cout << "Same content : " << faces[0] << std::endl;
+                }
+            }
+        }
+        if (handle.IsValid()) {
+            cubemaps.AddRef(handle);
+        }
+        return handle;
+    }
+
+    CubemapHandle AssetRegistry::AddCubemap(const std::vector<std::string>& faces, GLuint textureId) {
+        uint64_t contentHash = contentDedupe ? CubemapContentHash(faces) : 0;
+        return cubemaps.Add(InternPath(CubemapKey(faces)), contentHash, std::move(textureId));
+    }
+
+    GLuint AssetRegistry::GetCubemap(CubemapHandle handle) {
+        GLuint* textureId = cubemaps.Get(handle);
+        return textureId ? *textureId : 0;
+    }
+
+    void AssetRegistry::ReleaseCubemap(CubemapHandle handle) {
+        GLuint textureId = 0;
+        if (cubemaps.Release(handle, textureId)) {
+            gps::TextureStreamer::GetShared().Cancel(textureId);
+            gps::GLState::Get().ForgetTexture(textureId);
+            glDeleteTextures(1, &textureId);
+        }
+    }
+
+    // Matched by path only - an identical .obj in another folder resolves other textures
+    MeshHandle AssetRegistry::AcquireMeshes(const std::string& path) {
+        MeshHandle handle = meshes.Find(InternPath(path));
+        meshes.AddRef(handle);
+        return handle;
+    }
+
+    MeshHandle AssetRegistry::AddMeshes(const std::string& path, MeshSet&& meshSet) {
+        return meshes.Add(InternPath(path), 0, std::move(meshSet));
+    }
+
+    MeshSet* AssetRegistry::GetMeshes(MeshHandle handle) {
+        return meshes.Get(handle);
+    }
+
+    void AssetRegistry::ReleaseMeshes(MeshHandle handle) {
+        // the meshes delete their buffers when meshSet goes out of scope
+        MeshSet meshSet;
+        if (!meshes.Release(handle, meshSet)) {
+            return;
+        }
+        for (size_t i = 0; i < meshSet.textures.size(); i++) {
+            ReleaseTexture(meshSet.textures[i]);
+        }
+    }
+}
@@ -0,0 +1,223 @@
+#ifndef AssetRegistry_hpp
+#define AssetRegistry_hpp
+
+#include "Mesh.hpp"
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    // Index of a slot plus the generation it was handed out in, so a handle
+    // to a released and reused slot is recognised as stale
+    template <typename Tag>
+    struct AssetHandle {
+        uint32_t index;
+        uint32_t generation;
+
+        AssetHandle() : index(UINT32_MAX), generation(0) {}
+        AssetHandle(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+
+        bool IsValid() const { return index != UINT32_MAX; }
+        bool operator==(const AssetHandle& other) const { return index == other.index && generation == other.generation; }
+        bool operator!=(const AssetHandle& other) const { return !(*this == other); }
+    };
+
+    struct TextureTag {};
+    struct CubemapTag {};
+    struct MeshTag {};
+
+    typedef AssetHandle<TextureTag> TextureHandle;
+    typedef AssetHandle<CubemapTag> CubemapHandle;
+    typedef AssetHandle<MeshTag> MeshHandle;
+
+    // Meshes of one model file and the textures they hold on to
+    struct MeshSet {
+        std::vector<Mesh> meshes;
+        std::vector<TextureHandle> textures;
+        // every shape has been uploaded, nothing is added to meshes any more
+        bool complete = false;
+    };
+
+    // Reference counted slots of one asset type, looked up by interned path or content hash
+    template <typename T, typename Tag>
+    class AssetPool {
+    public:
+        typedef AssetHandle<Tag> Handle;
+
+        Handle Find(uint32_t pathId) const {
+            typename std::unordered_map<uint32_t, uint32_t>::const_iterator found = byPath.find(pathId);
+            if (found == byPath.end()) {
+                return Handle();
+            }
+            return Handle(found->second, slots[found->second].generation);
+        }
+
+        Handle FindContent(uint64_t contentHash) const {
+            typename std::unordered_map<uint64_t, uint32_t>::const_iterator found = byContent.find(contentHash);
+            if (found == byContent.end()) {
+                return Handle();
+            }
+            return Handle(found->second, slots[found->second].generation);
+        }
+
+        // Adds the asset with one reference
+        Handle Add(uint32_t pathId, uint64_t contentHash, T&& asset) {
+            uint32_t index;
+            if (!freeSlots.empty()) {
+                index = freeSlots.back();
+                freeSlots.pop_back();
+            } else {
+                index = slots.size();
+                slots.push_back(Slot());
+            }
+            Slot& slot = slots[index];
+            slot.asset = std::move(asset);
+            slot.refCount = 1;
+            slot.alive = true;
+            slot.contentHash = contentHash;
+            slot.pathIds.assign(1, pathId);
+            byPath[pathId] = index;
+            if (contentHash != 0) {
+                byContent[contentHash] = index;
+            }
+            return Handle(index, slot.generation);
+        }
+
+        // Another path resolving to the same asset, e.g. a byte-identical file
+        void Alias(Handle handle, uint32_t pathId) {
+            if (IsAlive(handle)) {
+                byPath[pathId] = handle.index;
+                slots[handle.index].pathIds.push_back(pathId);
+            }
+        }
+
+        bool AddRef(Handle handle) {
+            if (!IsAlive(handle)) {
+                return false;
+            }
+            slots[handle.index].refCount++;
+            return true;
+        }
+
+        // Returns true and moves the asset out when the last reference is dropped
+        bool Release(Handle handle, T& released) {
+            if (!IsAlive(handle)) {
+                return false;
+            }
+            Slot& slot = slots[handle.index];
+            if (--slot.refCount > 0) {
+                return false;
+            }
+            released = std::move(slot.asset);
+            slot.asset = T();
+            slot.alive = false;
+            slot.generation++;
+            for (size_t i = 0; i < slot.pathIds.size(); i++) {
+                byPath.erase(slot.pathIds[i]);
+            }
+            if (slot.contentHash != 0) {
+                byContent.erase(slot.contentHash);
+            }
+            freeSlots.push_back(handle.index);
+            return true;
+        }
+
+        T* Get(Handle handle) {
+            return IsAlive(handle) ? &slots[handle.index].asset : NULL;
+        }
+
+        bool IsAlive(Handle handle) const {
+            return handle.IsValid() && handle.index < slots.size() &&
+                   slots[handle.index].alive && slots[handle.index].generation == handle.generation;
+        }
+
+    private:
+        struct Slot {
+            T asset;
+            uint32_t generation;
+            uint32_t refCount;
+            bool alive;
+            uint64_t contentHash;
+            std::vector<uint32_t> pathIds;
+
+            Slot() : asset(), generation(0), refCount(0), alive(false), contentHash(0) {}
+        };
+
+        // deque keeps references to existing slots valid while new ones are added
+        std::deque<Slot> slots;
+        std::vector<uint32_t> freeSlots;
+        std::unordered_map<uint32_t, uint32_t> byPath;
+        std::unordered_map<uint64_t, uint32_t> byContent;
+    };
+
+    // Process wide owner of textures, cubemaps and model meshes, so every file is loaded once.
+    // All calls must come from the thread owning the GL context.
+    class AssetRegistry
+    {
+    public:
+        static AssetRegistry& Get();
+
+        // Same string -> same id, for the lifetime of the process
+        uint32_t InternPath(const std::string& path);
+        const std::string& GetPath(uint32_t pathId) const;
+
+        // Also match textures and cubemaps with different paths but identical bytes
+        void SetContentDedupe(bool enabled);
+
+        // Acquire* adds a reference to an already loaded asset, or returns an invalid handle
+        TextureHandle AcquireTexture(const std::string& path);
+        bool HasTexture(const std::string& path);
+        TextureHandle AddTexture(const std::string& path, GLuint textureId);
+        GLuint GetTexture(TextureHandle handle);
+        void ReleaseTexture(TextureHandle handle);
+        // Set by the loaders once the pixels are known to have alpha below 1, by texture object
+        void SetTextureTranslucent(GLuint textureId);
+        bool IsTextureTranslucent(GLuint textureId) const;
+
+        // Cubemaps are keyed by their face files
+        CubemapHandle AcquireCubemap(const std::vector<std::string>& faces);
+        CubemapHandle AddCubemap(const std::vector<std::string>& faces, GLuint textureId);
+        GLuint GetCubemap(CubemapHandle handle);
+        void ReleaseCubemap(CubemapHandle handle);
+
+        MeshHandle AcquireMeshes(const std::string& path);
+        MeshHandle AddMeshes(const std::string& path, MeshSet&& meshSet);
+        MeshSet* GetMeshes(MeshHandle handle);
+        void ReleaseMeshes(MeshHandle handle);
+
+    private:
+        AssetRegistry();
+
+        std::vector<std::string> paths;
+        std::unordered_map<std::string, uint32_t> pathIds;
+        // content hashes of interned paths, computed once
+        std::unordered_map<uint32_t, uint64_t> contentHashes;
+        bool contentDedupe;
+        std::unordered_set<GLuint> translucentTextures;
+
+        AssetPool<GLuint, TextureTag> textures;
+        AssetPool<GLuint, CubemapTag> cubemaps;
+        AssetPool<MeshSet, MeshTag> meshes;
+
+        uint64_t GetContentHash(uint32_t pathId);
+
+        template <typename T, typename Tag>
+        AssetHandle<Tag> Acquire(AssetPool<T, Tag>& pool, uint32_t pathId);
+
+        std::string CubemapKey(const std::vector<std::string>& faces) const;
+        uint64_t CubemapContentHash(const std::vector<std::string>& faces);
+
+        AssetRegistry(const AssetRegistry&);
+        AssetRegistry& operator=(const AssetRegistry&);
+    };
+}
+
+#endif /* AssetRegistry_hpp */
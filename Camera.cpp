@@ -23,6 +23,14 @@ namespace gps {
         return glm::lookAt(cameraPosition, cameraPosition + cameraFrontDirection, cameraUpDirection);
     }
 
+    glm::vec3 Camera::getPosition() const {
+        return cameraPosition;
+    }
+
+    glm::vec3 Camera::getFrontDirection() const {
+        return cameraFrontDirection;
+    }
+
     //update the camera internal parameters following a camera move event
     void Camera::move(MOVE_DIRECTION direction, float speed) {
         switch (direction) {
@@ -20,6 +20,10 @@ namespace gps {
         //return the view matrix, using the glm::lookAt() function
         glm::mat4 getViewMatrix();
 
+        //return the camera position and the direction it looks in
+        glm::vec3 getPosition() const;
+        glm::vec3 getFrontDirection() const;
+
         //update the camera internal parameters following a camera move event
         void move(MOVE_DIRECTION direction, float speed);
 
@@ -0,0 +1,441 @@
+#include "CompressedTexture.hpp"
+#include "Hash.hpp"
+#include "Image.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    static const char TEXTURE_CACHE_MAGIC[8] = {'G', 'P', 'S', 'B', 'C', 'N', '\0', '\0'};
+
+    enum {
+        FLAG_FLIP = 1,
+        FLAG_MIPMAPS = 2,
+        FLAG_SRGB = 4
+    };
+
+    struct CompressedTexture::Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t format;
+        uint32_t flags;
+        uint32_t levelCount;
+        uint64_t sourceHash;
+    };
+
+    struct CompressedTexture::LevelEntry {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    static size_t BlockSize(BlockFormat format) {
+        return format == BLOCK_BC1 ? 8 : 16;
+    }
+
+    static size_t LevelSize(BlockFormat format, int width, int height) {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+    }
+
+    // sRGB <-> linear, so mips do not get darker than the base level
+    static float SrgbToLinear(unsigned char value) {
+        float c = value / 255.0f;
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static unsigned char LinearToSrgb(float c) {
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return (unsigned char)std::min(255.0f, std::max(0.0f, c * 255.0f + 0.5f));
+    }
+
+    static std::array<float, 256> MakeSrgbTable() {
+        std::array<float, 256> table;
+        for (int i = 0; i < 256; i++) {
+            table[i] = SrgbToLinear((unsigned char)i);
+        }
+        return table;
+    }
+
+    // 2x2 box filter, the last row/column is repeated for odd sizes
+    static void Downsample(std::vector<unsigned char>& pixels, int& width, int& height, bool srgb) {
+        // textures are decoded on pool workers, the static's initialization is thread safe
+        static const std::array<float, 256> toLinear = MakeSrgbTable();
+
+        int newWidth = std::max(1, width / 2);
+        int newHeight = std::max(1, height / 2);
+        std::vector<unsigned char> result((size_t)newWidth * newHeight * 4);
+        for (int y = 0; y < newHeight; y++) {
+            int y0 = std::min(2 * y, height - 1);
+            int y1 = std::min(2 * y + 1, height - 1);
+            for (int x = 0; x < newWidth; x++) {
+                int x0 = std::min(2 * x, width - 1);
+                int x1 = std::min(2 * x + 1, width - 1);
+                const unsigned char* p[4] = {
+                    &pixels[((size_t)y0 * width + x0) * 4], &pixels[((size_t)y0 * width + x1) * 4],
+                    &pixels[((size_t)y1 * width + x0) * 4], &pixels[((size_t)y1 * width + x1) * 4]
+                };
+                unsigned char* out = &result[((size_t)y * newWidth + x) * 4];
+                for (int c = 0; c < 4; c++) {
+                    if (srgb && c < 3) {
+                        float sum = toLinear[p[0][c]] + toLinear[p[1][c]] + toLinear[p[2][c]] + toLinear[p[3][c]];
+                        out[c] = LinearToSrgb(sum * 0.25f);
+                    } else {
+                        out[c] = (unsigned char)((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+                    }
+                }
+            }
+        }
+        pixels.swap(result);
+        width = newWidth;
+        height = newHeight;
+    }
+
+    static uint16_t To565(const int* rgb) {
+        return (uint16_t)((((rgb[0] * 31 + 127) / 255) << 11) | (((rgb[1] * 63 + 127) / 255) << 5) | ((rgb[2] * 31 + 127) / 255));
+    }
+
+    static void From565(uint16_t color, int* rgb) {
+        int r = (color >> 11) & 31;
+        int g = (color >> 5) & 63;
+        int b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // Bounding box endpoints inset by 1/16, on the diagonal the colors are spread along
+    void CompressedTexture::EncodeBC1Block(const unsigned char* rgba, unsigned char* block) {
+        int lo[3] = {255, 255, 255};
+        int hi[3] = {0, 0, 0};
+        int mean[3] = {0, 0, 0};
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                lo[c] = std::min(lo[c], (int)rgba[i * 4 + c]);
+                hi[c] = std::max(hi[c], (int)rgba[i * 4 + c]);
+                mean[c] += rgba[i * 4 + c];
+            }
+        }
+
+        // channels that fall while the widest one rises take the other diagonal
+        int reference = 0;
+        for (int c = 1; c < 3; c++) {
+            if (hi[c] - lo[c] > hi[reference] - lo[reference]) {
+                reference = c;
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            if (c == reference) {
+                continue;
+            }
+            int covariance = 0;
+            for (int i = 0; i < 16; i++) {
+                covariance += (rgba[i * 4 + c] * 16 - mean[c]) * (rgba[i * 4 + reference] * 16 - mean[reference]);
+            }
+            if (covariance < 0) {
+                std::swap(lo[c], hi[c]);
+            }
+        }
+
+        int end0[3], end1[3];
+        for (int c = 0; c < 3; c++) {
+            int inset = (hi[c] - lo[c]) / 16;
+            end0[c] = hi[c] - inset;
+            end1[c] = lo[c] + inset;
+        }
+        uint16_t color0 = To565(end0);
+        uint16_t color1 = To565(end1);
+        // color0 > color1 selects the four color mode
+        if (color0 < color1) {
+            std::swap(color0, color1);
+        }
+
+        uint32_t indices = 0;
+        if (color0 != color1) {
+            int palette[4][3];
+            From565(color0, palette[0]);
+            From565(color1, palette[1]);
+            for (int c = 0; c < 3; c++) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                int bestDistance = 1 << 30;
+                for (int p = 0; p < 4; p++) {
+                    int distance = 0;
+                    for (int c = 0; c < 3; c++) {
+                        int d = rgba[i * 4 + c] - palette[p][c];
+                        distance += d * d;
+                    }
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= (uint32_t)best << (2 * i);
+            }
+        }
+
+        block[0] = color0 & 0xff;
+        block[1] = color0 >> 8;
+        block[2] = color1 & 0xff;
+        block[3] = color1 >> 8;
+        for (int i = 0; i < 4; i++) {
+            block[4 + i] = (indices >> (8 * i)) & 0xff;
+        }
+    }
+
+    // Eight step alpha ramp between the block minimum and maximum, then the BC1 color block
+    void CompressedTexture::EncodeBC3Block(const unsigned char* rgba, unsigned char* block) {
+        int alpha0 = 0;
+        int alpha1 = 255;
+        for (int i = 0; i < 16; i++) {
+            alpha0 = std::max(alpha0, (int)rgba[i * 4 + 3]);
+            alpha1 = std::min(alpha1, (int)rgba[i * 4 + 3]);
+        }
+
+        uint64_t indices = 0;
+        if (alpha0 != alpha1) {
+            int palette[8];
+            palette[0] = alpha0;
+            palette[1] = alpha1;
+            for (int k = 1; k < 7; k++) {
+                palette[1 + k] = ((7 - k) * alpha0 + k * alpha1 + 3) / 7;
+            }
+            for (int i = 0; i < 16; i++) {
+                int best = 0;
+                int bestDistance = 256;
+                for (int p = 0; p < 8; p++) {
+                    int distance = std::abs(rgba[i * 4 + 3] - palette[p]);
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = p;
+                    }
+                }
+                indices |= (uint64_t)best << (3 * i);
+            }
+        }
+
+        block[0] = (unsigned char)alpha0;
+        block[1] = (unsigned char)alpha1;
+        for (int i = 0; i < 6; i++) {
+            block[2 + i] = (indices >> (8 * i)) & 0xff;
+        }
+        EncodeBC1Block(rgba, block + 8);
+    }
+
+    CompressedTexture::CompressedTexture() : data(NULL), format(BLOCK_BC1) {
+    }
+
+    bool CompressedTexture::Load(const std::string& fileName, bool flipVertically, bool mipmaps, bool srgb) {
+        Free();
+        uint64_t sourceHash;
+        {
+            MappedFile source;
+            if (!source.Open(fileName)) {
+                return false;
+            }
+            sourceHash = HashBytes(source.GetData(), source.GetSize());
+        }
+
+        uint32_t flags = (flipVertically ? FLAG_FLIP : 0) | (mipmaps ? FLAG_MIPMAPS : 0) | (srgb ? FLAG_SRGB : 0);
+        std::string cacheFileName = fileName + ".bcn";
+        if (OpenCache(cacheFileName, sourceHash, flags)) {
+            return true;
+        }
+        if (!Encode(fileName, flags)) {
+            return false;
+        }
+        if (!WriteCache(cacheFileName, sourceHash, flags)) {
+            fprintf(stderr, "WARNING: could not write texture cache %s\n", cacheFileName.c_str());
+        }
+        return true;
+    }
+
+    bool CompressedTexture::OpenCache(const std::string& cacheFileName, uint64_t sourceHash, uint32_t flags) {
+        if (!file.Open(cacheFileName)) {
+            return false;
+        }
+
+        const char* fileData = file.GetData();
+        size_t size = file.GetSize();
+        const Header* header = reinterpret_cast<const Header*>(fileData);
+        if (size < sizeof(Header) ||
+            memcmp(header->magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC)) != 0 ||
+            header->version != TEXTURE_CACHE_VERSION || header->sourceHash != sourceHash ||
+            header->flags != flags || (header->format != BLOCK_BC1 && header->format != BLOCK_BC3) ||
+            header->levelCount == 0 || sizeof(Header) + (uint64_t)header->levelCount * sizeof(LevelEntry) > size) {
+            Free();
+            return false;
+        }
+
+        format = (BlockFormat)header->format;
+        data = reinterpret_cast<const unsigned char*>(fileData);
+        const LevelEntry* entries = reinterpret_cast<const LevelEntry*>(fileData + sizeof(Header));
+        for (uint32_t l = 0; l < header->levelCount; l++) {
+            // reject truncated files before anything points into them
+            if (entries[l].offset + entries[l].size > size ||
+                entries[l].size != LevelSize(format, entries[l].width, entries[l].height)) {
+                Free();
+                return false;
+            }
+            CompressedLevel level;
+            level.width = entries[l].width;
+            level.height = entries[l].height;
+            level.data = data + entries[l].offset;
+            level.size = entries[l].size;
+            levels.push_back(level);
+        }
+        return true;
+    }
+
+    bool CompressedTexture::Encode(const std::string& fileName, uint32_t flags) {
+        Image image;
+        if (!image.Load(fileName, 4, (flags & FLAG_FLIP) != 0)) {
+            return false;
+        }
+        int width = image.GetWidth();
+        int height = image.GetHeight();
+        int fileChannels = image.GetFileChannels();
+        std::vector<unsigned char> pixels(image.GetPixels(), image.GetPixels() + (size_t)width * height * 4);
+        image.Free();
+
+        // JPEGs and opaque PNGs only need BC1
+        format = BLOCK_BC1;
+        if (fileChannels != 3) {
+            for (size_t i = 3; i < pixels.size(); i += 4) {
+                if (pixels[i] != 255) {
+                    format = BLOCK_BC3;
+                    break;
+                }
+            }
+        }
+
+        std::vector<size_t> offsets;
+        unsigned char source[64];
+        while (true) {
+            CompressedLevel level;
+            level.width = width;
+            level.height = height;
+            level.data = NULL;
+            level.size = LevelSize(format, width, height);
+            levels.push_back(level);
+            offsets.push_back(encoded.size());
+
+            size_t blockSize = BlockSize(format);
+            encoded.resize(encoded.size() + level.size);
+            unsigned char* out = &encoded[offsets.back()];
+            for (int by = 0; by < height; by += 4) {
+                for (int bx = 0; bx < width; bx += 4) {
+                    // blocks past the edge repeat the last row/column
+                    for (int y = 0; y < 4; y++) {
+                        for (int x = 0; x < 4; x++) {
+                            size_t pixel = (size_t)std::min(by + y, height - 1) * width + std::min(bx + x, width - 1);
+                            memcpy(&source[(y * 4 + x) * 4], &pixels[pixel * 4], 4);
+                        }
+                    }
+                    if (format == BLOCK_BC1) {
+                        EncodeBC1Block(source, out);
+                    } else {
+                        EncodeBC3Block(source, out);
+                    }
+                    out += blockSize;
+                }
+            }
+
+            if (!(flags & FLAG_MIPMAPS) || (width == 1 && height == 1)) {
+                break;
+            }
+            Downsample(pixels, width, height, (flags & FLAG_SRGB) != 0);
+        }
+
+        data = &encoded[0];
+        for (size_t l = 0; l < levels.size(); l++) {
+            levels[l].data = data + offsets[l];
+        }
+        return true;
+    }
+
+    bool CompressedTexture::WriteCache(const std::string& cacheFileName, uint64_t sourceHash, uint32_t flags) const {
+        Header header;
+        memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC));
+        header.version = TEXTURE_CACHE_VERSION;
+        header.format = format;
+        header.flags = flags;
+        header.levelCount = levels.size();
+        header.sourceHash = sourceHash;
+
+        // level data follows the header and the level table, each level 16 byte aligned
+        std::vector<LevelEntry> entries(levels.size());
+        size_t offset = sizeof(Header) + levels.size() * sizeof(LevelEntry);
+        for (size_t l = 0; l < levels.size(); l++) {
+            offset = (offset + 15) & ~(size_t)15;
+            entries[l].width = levels[l].width;
+            entries[l].height = levels[l].height;
+            entries[l].offset = offset;
+            entries[l].size = levels[l].size;
+            offset += levels[l].size;
+        }
+
+        std::vector<char> buffer(offset, 0);
+        memcpy(&buffer[0], &header, sizeof(Header));
+        memcpy(&buffer[sizeof(Header)], &entries[0], entries.size() * sizeof(LevelEntry));
+        for (size_t l = 0; l < levels.size(); l++) {
+            memcpy(&buffer[entries[l].offset], levels[l].data, levels[l].size);
+        }
+
+        // a reader never sees a half written cache
+        std::string tempFileName = cacheFileName + ".tmp";
+        FILE* out = fopen(tempFileName.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+        bool written = fwrite(&buffer[0], 1, buffer.size(), out) == buffer.size();
+        written = fclose(out) == 0 && written;
+        if (!written || rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+            remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void CompressedTexture::Free() {
+        file.Close();
+        encoded.clear();
+        levels.clear();
+        data = NULL;
+        format = BLOCK_BC1;
+    }
+
+    bool CompressedTexture::IsLoaded() const {
+        return data != NULL;
+    }
+
+    BlockFormat CompressedTexture::GetFormat() const {
+        return format;
+    }
+
+    size_t CompressedTexture::GetLevelCount() const {
+        return levels.size();
+    }
+
+    CompressedLevel CompressedTexture::GetLevel(size_t level) const {
+        return levels[level];
+    }
+
+    GLenum CompressedTexture::GetInternalFormat(bool srgb) const {
+        if (format == BLOCK_BC1) {
+            return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        }
+        return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+
+    bool CompressedTexture::IsSupported() {
+        return GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+    }
+}
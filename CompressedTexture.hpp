@@ -0,0 +1,77 @@
+#ifndef CompressedTexture_hpp
+#define CompressedTexture_hpp
+
+#include "MappedFile.hpp"
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Bump whenever the encoder output changes, so stale caches get rebuilt
+    const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+    enum BlockFormat {
+        // 4 bpp, opaque
+        BLOCK_BC1 = 1,
+        // 8 bpp, BC1 color plus interpolated alpha
+        BLOCK_BC3 = 3
+    };
+
+    struct CompressedLevel {
+        int width;
+        int height;
+        const unsigned char* data;
+        size_t size;
+    };
+
+    // Block compressed mip chain of an image file, cached next to it as <file>.bcn.
+    // Loading and encoding touch no GL state, so they can run on any thread.
+    class CompressedTexture
+    {
+    public:
+        CompressedTexture();
+
+        // Maps the cache if it was made from the current file with the same options,
+        // otherwise decodes and encodes the image and writes the cache.
+        // srgb makes the mip filter average in linear space.
+        bool Load(const std::string& fileName, bool flipVertically, bool mipmaps, bool srgb);
+        void Free();
+
+        bool IsLoaded() const;
+        BlockFormat GetFormat() const;
+        size_t GetLevelCount() const;
+        CompressedLevel GetLevel(size_t level) const;
+        // S3TC internal format matching the block format
+        GLenum GetInternalFormat(bool srgb) const;
+
+        // Needs the GL context - the S3TC formats are an extension in GL 4.1
+        static bool IsSupported();
+
+        // Encode one 4x4 block of RGBA pixels, rows top to bottom
+        static void EncodeBC1Block(const unsigned char* rgba, unsigned char* block);
+        static void EncodeBC3Block(const unsigned char* rgba, unsigned char* block);
+
+    private:
+        struct Header;
+        struct LevelEntry;
+
+        MappedFile file;
+        std::vector<unsigned char> encoded;
+        const unsigned char* data;
+        BlockFormat format;
+        std::vector<CompressedLevel> levels;
+
+        bool OpenCache(const std::string& cacheFileName, uint64_t sourceHash, uint32_t flags);
+        bool Encode(const std::string& fileName, uint32_t flags);
+        bool WriteCache(const std::string& cacheFileName, uint64_t sourceHash, uint32_t flags) const;
+
+        CompressedTexture(const CompressedTexture&);
+        CompressedTexture& operator=(const CompressedTexture&);
+    };
+}
+
+#endif /* CompressedTexture_hpp */
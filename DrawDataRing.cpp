@@ -0,0 +1,181 @@
+#include "DrawDataRing.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace gps {
+
+    static_assert(sizeof(DrawData) == 128, "DrawData is fetched as 8 texels");
+
+    DrawDataRing::DrawDataRing() : buffer(0), texture(0), drawIdBuffer(0), persistent(false), persistentData(NULL), segment(0),
+                                   capacity(0), used(0), flushed(0), staticCapacity(0), staticUsed(0), frame(0),
+                                   reportedFull(false) {
+        for (int i = 0; i < RING_SEGMENTS; i++) {
+            fences[i] = NULL;
+        }
+    }
+
+    DrawDataRing::~DrawDataRing() {
+        if (!buffer) {
+            return;
+        }
+        for (int i = 0; i < RING_SEGMENTS; i++) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+            }
+        }
+        if (persistent) {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+            glUnmapBuffer(GL_TEXTURE_BUFFER);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+        GLState::Get().ForgetTexture(texture);
+        glDeleteTextures(1, &texture);
+        glDeleteBuffers(1, &buffer);
+        glDeleteBuffers(1, &drawIdBuffer);
+    }
+
+    DrawDataRing& DrawDataRing::GetShared() {
+        // never destroyed - the GL context is gone by the time statics are torn down
+        static DrawDataRing* ring = new DrawDataRing();
+        return *ring;
+    }
+
+    void DrawDataRing::Init(GLuint drawsPerFrame, GLuint staticDraws) {
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        capacity = std::min(drawsPerFrame, (GLuint)maxTexels / (TEXELS_PER_DRAW * RING_SEGMENTS));
+        staticCapacity = std::min(staticDraws, (GLuint)maxTexels / TEXELS_PER_DRAW - capacity * RING_SEGMENTS);
+        GLuint slots = capacity * RING_SEGMENTS + staticCapacity;
+        GLsizeiptr size = (GLsizeiptr)slots * sizeof(DrawData);
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+
+        // mapped once for the whole run where buffer storage is available, GL 4.1 uploads once per frame
+        persistent = GLEW_ARB_buffer_storage;
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, flags);
+            persistentData = static_cast<DrawData*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags));
+            persistent = persistentData != NULL;
+            if (!persistent) {
+                // immutable storage cannot be respecified
+                glDeleteBuffers(1, &buffer);
+                glGenBuffers(1, &buffer);
+                glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+            }
+        }
+        if (!persistent) {
+            glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+            staging.resize(capacity);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenTextures(1, &texture);
+        GLState::Get().BindTexture(DRAW_DATA_UNIT, GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+
+        std::vector<GLuint> drawIds(slots);
+        for (GLuint i = 0; i < drawIds.size(); i++) {
+            drawIds[i] = i;
+        }
+        glGenBuffers(1, &drawIdBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, drawIdBuffer);
+        glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void DrawDataRing::BeginFrame() {
+        if (fences[segment]) {
+            while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fences[segment]);
+            fences[segment] = NULL;
+        }
+        used = 0;
+        flushed = 0;
+        frame++;
+        GLState::Get().BindTexture(DRAW_DATA_UNIT, GL_TEXTURE_BUFFER, texture);
+    }
+
+    uint64_t DrawDataRing::GetFrame() const {
+        return frame;
+    }
+
+    GLuint DrawDataRing::Push(const glm::mat4& model, const glm::mat3& normalMatrix, const glm::vec4& material) {
+        if (used == capacity) {
+            if (!reportedFull) {
+                fprintf(stderr, "WARNING: more than %u draws in a frame, the rest are skipped\n", capacity);
+                reportedFull = true;
+            }
+            return FULL;
+        }
+
+        GLuint index = segment * capacity + used;
+        DrawData& data = persistent ? persistentData[index] : staging[used];
+        used++;
+        data.model = model;
+        for (int i = 0; i < 3; i++) {
+            data.normalMatrix[i] = glm::vec4(normalMatrix[i], 0.0f);
+        }
+        data.material = material;
+        return index;
+    }
+
+    void DrawDataRing::Flush() {
+        if (persistent || used == flushed) {
+            return;
+        }
+        // the segment is fenced, the GPU is not reading it - one upload for the slots since the last flush
+        GLuint first = segment * capacity + flushed;
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(DrawData), (used - flushed) * sizeof(DrawData), &staging[flushed]);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        flushed = used;
+    }
+
+    void DrawDataRing::EndFrame() {
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RING_SEGMENTS;
+    }
+
+    GLuint DrawDataRing::Reserve(GLuint count) {
+        if (count > staticCapacity - staticUsed) {
+            fprintf(stderr, "WARNING: no %u static draw slots left of %u\n", count, staticCapacity);
+            return FULL;
+        }
+        GLuint first = capacity * RING_SEGMENTS + staticUsed;
+        staticUsed += count;
+        return first;
+    }
+
+    void DrawDataRing::Write(GLuint first, GLuint count, const glm::mat4& model, const glm::mat3& normalMatrix,
+                             const glm::vec4* materials) {
+        // the ring's staging copy only covers a segment, these go up on their own in one upload
+        std::vector<DrawData> written(persistent ? 0 : count);
+        DrawData* data = persistent ? persistentData + first : written.data();
+        for (GLuint i = 0; i < count; i++) {
+            data[i].model = model;
+            for (int c = 0; c < 3; c++) {
+                data[i].normalMatrix[c] = glm::vec4(normalMatrix[c], 0.0f);
+            }
+            data[i].material = materials[i];
+        }
+        if (!persistent) {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, first * sizeof(DrawData), count * sizeof(DrawData), written.data());
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+    }
+
+    GLuint DrawDataRing::GetCapacity() const {
+        return capacity;
+    }
+
+    GLuint DrawDataRing::GetDrawIdBuffer() const {
+        return drawIdBuffer;
+    }
+}
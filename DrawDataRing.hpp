@@ -0,0 +1,98 @@
+#ifndef DrawDataRing_hpp
+#define DrawDataRing_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // generic attribute holding the draw's slot - set with glVertexAttribI1ui while no array feeds it,
+    // or read per instance from the draw id buffer so the base instance of a draw selects the slot
+    const GLuint DRAW_INDEX_ATTRIBUTE = 3;
+    // unit the ring's buffer texture stays bound to, the shaders' drawData sampler points here
+    const GLuint DRAW_DATA_UNIT = 15;
+
+    // One slot of the ring, read by the shaders as 8 RGBA32F texels
+    struct DrawData {
+        glm::mat4 model;
+        // columns of the world space normal matrix, w unused - the shaders apply the view
+        glm::vec4 normalMatrix[3];
+        // diffuse array, diffuse layer, specular array, specular layer - see MaterialTable
+        glm::vec4 material;
+    };
+
+    // Per-draw transforms in a buffer texture that is written by the CPU while the GPU still reads
+    // earlier frames. Each frame fills its own segment, which is fenced at the end of the frame and
+    // only reused RING_SEGMENTS frames later, so the CPU never runs further ahead than that.
+    // Without persistent mapping the slots gather in a CPU copy of the segment, uploaded at once by Flush.
+    // Past the segments are static slots, for draws whose data stays the same over many frames.
+    // All calls must come from the GL thread.
+    class DrawDataRing
+    {
+    public:
+        static const int RING_SEGMENTS = 3;
+        static const GLuint TEXELS_PER_DRAW = sizeof(DrawData) / (4 * sizeof(float));
+        // returned by Push when the frame's segment has no free slot
+        static const GLuint FULL = 0xFFFFFFFFu;
+
+        DrawDataRing();
+        ~DrawDataRing();
+
+        // Needs the GL context. Clamped to what one buffer texture can address, the segments first.
+        void Init(GLuint drawsPerFrame, GLuint staticDraws);
+
+        // Waits for the GPU to release this frame's segment and binds the ring to DRAW_DATA_UNIT
+        void BeginFrame();
+        // Writes one draw and returns the index the shader fetches it with
+        GLuint Push(const glm::mat4& model, const glm::mat3& normalMatrix, const glm::vec4& material);
+        // Uploads the slots pushed this frame where the buffer is not mapped - call after the last Push,
+        // before the draws reading them are issued
+        void Flush();
+        // Fences the segment - call after the frame's last draw
+        void EndFrame();
+
+        // Sets aside count static slots and returns the first, FULL when too few are left. They are
+        // never given back.
+        GLuint Reserve(GLuint count);
+        // Writes count static slots from first on, all with the same transform and each with its material.
+        // Straight to the buffer - frames still in flight may see the new data.
+        void Write(GLuint first, GLuint count, const glm::mat4& model, const glm::mat3& normalMatrix,
+                   const glm::vec4* materials);
+
+        GLuint GetCapacity() const;
+        // Counts BeginFrame calls, data written for one frame is stale once it changes
+        uint64_t GetFrame() const;
+
+        // Holds 0, 1, 2, ... for every slot of the ring and the static ones, as GL_UNSIGNED_INT
+        GLuint GetDrawIdBuffer() const;
+
+        static DrawDataRing& GetShared();
+
+    private:
+        GLuint buffer;
+        GLuint texture;
+        GLuint drawIdBuffer;
+        bool persistent;
+        DrawData* persistentData;
+        // this frame's slots until Flush, where the buffer is not mapped
+        std::vector<DrawData> staging;
+        GLsync fences[RING_SEGMENTS];
+        int segment;
+        GLuint capacity;
+        GLuint used;
+        // slots of this frame already uploaded
+        GLuint flushed;
+        GLuint staticCapacity;
+        GLuint staticUsed;
+        uint64_t frame;
+        bool reportedFull;
+
+        DrawDataRing(const DrawDataRing&);
+        DrawDataRing& operator=(const DrawDataRing&);
+    };
+}
+
+#endif /* DrawDataRing_hpp */
@@ -0,0 +1,41 @@
+#include "FrameData.hpp"
+
+#include <cstddef>
+
+namespace gps {
+
+    static_assert(offsetof(FrameUniforms, projection) == 64, "std140 FrameData layout");
+    static_assert(offsetof(FrameUniforms, lightDir) == 128, "std140 FrameData layout");
+    static_assert(offsetof(FrameUniforms, lightColor) == 144, "std140 FrameData layout");
+    static_assert(offsetof(FrameUniforms, fogDensity) == 160, "std140 FrameData layout");
+    static_assert(sizeof(FrameUniforms) == 176, "std140 FrameData layout");
+
+    FrameData::FrameData() : buffer(0) {
+    }
+
+    FrameData::~FrameData() {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    void FrameData::Init() {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, buffer);
+    }
+
+    // glBufferData orphans the previous contents, so this never waits for last frame's draws
+    void FrameData::Update(const FrameUniforms& uniforms) {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &uniforms, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void FrameData::Attach(const gps::Shader& shader) {
+        GLuint blockIndex = shader.GetUniformBlockIndex(FRAME_DATA_BLOCK);
+        if (blockIndex != GL_INVALID_INDEX) {
+            glUniformBlockBinding(shader.shaderProgram, blockIndex, FRAME_DATA_BINDING);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef FrameData_hpp
+#define FrameData_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Hash.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    constexpr uint64_t FRAME_DATA_BLOCK = HashName("FrameData");
+    // uniform buffer binding point shared by every program reading the block
+    const GLuint FRAME_DATA_BINDING = 0;
+
+    // std140 layout of the FrameData block in the shaders - vec3s are padded to vec4
+    struct FrameUniforms {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec4 lightDir;
+        glm::vec4 lightColor;
+        float fogDensity;
+        float padding[3];
+    };
+
+    // Camera, light and fog values every shader sees, written once per frame
+    class FrameData
+    {
+    public:
+        FrameData();
+        ~FrameData();
+
+        // Needs the GL context
+        void Init();
+        // Replaces the whole block with one buffer upload
+        void Update(const FrameUniforms& uniforms);
+
+        // Points the program's FrameData block at the shared binding, no-op when it has none
+        static void Attach(const gps::Shader& shader);
+
+    private:
+        GLuint buffer;
+
+        FrameData(const FrameData&);
+        FrameData& operator=(const FrameData&);
+    };
+}
+
+#endif /* FrameData_hpp */
@@ -0,0 +1,124 @@
+#include "Frustum.hpp"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_FRUSTUM_SSE 1
+#endif
+
+namespace gps {
+
+    void BoundsList::Clear() {
+        minX.clear(); minY.clear(); minZ.clear();
+        maxX.clear(); maxY.clear(); maxZ.clear();
+        centreX.clear(); centreY.clear(); centreZ.clear(); radius.clear();
+        count = 0;
+    }
+
+    void BoundsList::Add(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& centre, float radius) {
+        // grows 4 at a time - an inverted box and a negative radius are outside every plane
+        if (count == minX.size()) {
+            size_t padded = count + 4;
+            minX.resize(padded, 1.0f); minY.resize(padded, 1.0f); minZ.resize(padded, 1.0f);
+            maxX.resize(padded, -1.0f); maxY.resize(padded, -1.0f); maxZ.resize(padded, -1.0f);
+            centreX.resize(padded, 0.0f); centreY.resize(padded, 0.0f); centreZ.resize(padded, 0.0f);
+            this->radius.resize(padded, -INFINITY);
+        }
+        minX[count] = boundsMin.x; minY[count] = boundsMin.y; minZ[count] = boundsMin.z;
+        maxX[count] = boundsMax.x; maxY[count] = boundsMax.y; maxZ[count] = boundsMax.z;
+        centreX[count] = centre.x; centreY[count] = centre.y; centreZ[count] = centre.z;
+        this->radius[count] = radius;
+        count++;
+    }
+
+    // Gribb and Hartmann - each plane is the sum or difference of the matrix's last row and another row
+    void Frustum::Extract(const glm::mat4& matrix) {
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(matrix[0][r], matrix[1][r], matrix[2][r], matrix[3][r]);
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            planes[axis * 2] = rows[3] + rows[axis];
+            planes[axis * 2 + 1] = rows[3] - rows[axis];
+        }
+        // normalized so that sphere radii compare against distances
+        for (int p = 0; p < 6; p++) {
+            float length = std::sqrt(planes[p].x * planes[p].x + planes[p].y * planes[p].y + planes[p].z * planes[p].z);
+            if (length > 0.0f) {
+                planes[p] = planes[p] / length;
+            }
+        }
+    }
+
+    const glm::vec4& Frustum::GetPlane(int index) const {
+        return planes[index];
+    }
+
+    bool Frustum::IsVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = planes[p];
+            // the corner farthest along the plane normal
+            float distance = plane.x * (plane.x > 0.0f ? boundsMax.x : boundsMin.x) +
+                             plane.y * (plane.y > 0.0f ? boundsMax.y : boundsMin.y) +
+                             plane.z * (plane.z > 0.0f ? boundsMax.z : boundsMin.z) + plane.w;
+            if (distance < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t Frustum::Cull(const BoundsList& bounds, uint8_t* visible) const {
+        size_t visibleCount = 0;
+#ifdef GPS_FRUSTUM_SSE
+        // the farthest box corner along a plane takes max on the positive axes - chosen once per plane,
+        // not per box
+        const float* cornerX[6];
+        const float* cornerY[6];
+        const float* cornerZ[6];
+        for (int p = 0; p < 6; p++) {
+            cornerX[p] = planes[p].x > 0.0f ? bounds.maxX.data() : bounds.minX.data();
+            cornerY[p] = planes[p].y > 0.0f ? bounds.maxY.data() : bounds.minY.data();
+            cornerZ[p] = planes[p].z > 0.0f ? bounds.maxZ.data() : bounds.minZ.data();
+        }
+        for (size_t i = 0; i < bounds.count; i += 4) {
+            __m128 cx = _mm_loadu_ps(&bounds.centreX[i]);
+            __m128 cy = _mm_loadu_ps(&bounds.centreY[i]);
+            __m128 cz = _mm_loadu_ps(&bounds.centreZ[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+            __m128 inside = _mm_cmpeq_ps(cx, cx);
+            for (int p = 0; p < 6; p++) {
+                __m128 a = _mm_set1_ps(planes[p].x);
+                __m128 b = _mm_set1_ps(planes[p].y);
+                __m128 c = _mm_set1_ps(planes[p].z);
+                __m128 d = _mm_set1_ps(planes[p].w);
+
+                __m128 sphere = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, cx), _mm_mul_ps(b, cy)), _mm_add_ps(_mm_mul_ps(c, cz), d));
+                __m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(cornerX[p] + i)),
+                                                   _mm_mul_ps(b, _mm_loadu_ps(cornerY[p] + i))),
+                                        _mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(cornerZ[p] + i)), d));
+                inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(sphere, negativeRadius),
+                                                       _mm_cmpge_ps(box, _mm_setzero_ps())));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (size_t lane = 0; lane < 4 && i + lane < bounds.count; lane++) {
+                visible[i + lane] = (mask >> lane) & 1;
+                visibleCount += visible[i + lane];
+            }
+        }
+#else
+        for (size_t i = 0; i < bounds.count; i++) {
+            bool inside = IsVisible(glm::vec3(bounds.minX[i], bounds.minY[i], bounds.minZ[i]),
+                                    glm::vec3(bounds.maxX[i], bounds.maxY[i], bounds.maxZ[i]));
+            for (int p = 0; p < 6 && inside; p++) {
+                inside = planes[p].x * bounds.centreX[i] + planes[p].y * bounds.centreY[i] +
+                         planes[p].z * bounds.centreZ[i] + planes[p].w >= -bounds.radius[i];
+            }
+            visible[i] = inside;
+            visibleCount += inside;
+        }
+#endif
+        return visibleCount;
+    }
+}
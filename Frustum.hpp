@@ -0,0 +1,46 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Bounds of many meshes, one array per component so they can be tested 4 at a time.
+    // The arrays are padded to a multiple of 4 with empty boxes that never pass.
+    struct BoundsList {
+        std::vector<float> minX, minY, minZ;
+        std::vector<float> maxX, maxY, maxZ;
+        std::vector<float> centreX, centreY, centreZ, radius;
+        size_t count = 0;
+
+        void Clear();
+        void Add(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& centre, float radius);
+    };
+
+    // The six planes of a view volume, pointing inwards and normalized
+    class Frustum
+    {
+    public:
+        // Planes of the clip space volume of matrix - projection * view gives world space planes,
+        // projection * view * model the planes in that model's object space
+        void Extract(const glm::mat4& matrix);
+
+        // Sets visible[i] to 1 for the bounds that may be inside, 0 for those fully outside a plane.
+        // Both the sphere and the box have to pass. Returns how many are visible.
+        size_t Cull(const BoundsList& bounds, uint8_t* visible) const;
+
+        bool IsVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+
+        // left, right, bottom, top, near, far
+        const glm::vec4& GetPlane(int index) const;
+
+    private:
+        glm::vec4 planes[6];
+    };
+}
+
+#endif /* Frustum_hpp */
@@ -0,0 +1,202 @@
+#include "GLState.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    // no GL name or enum takes this value, so the first call of each kind is always issued
+    static const GLuint UNKNOWN = ~0u;
+
+    static const char* const CALL_NAMES[STATE_CALL_COUNT] = {
+        "program", "vertex array", "active texture", "texture", "depth func", "polygon mode", "blend", "depth mask"
+    };
+
+    size_t StateCounters::TotalIssued() const {
+        size_t total = 0;
+        for (int i = 0; i < STATE_CALL_COUNT; i++) {
+            total += issued[i];
+        }
+        return total;
+    }
+
+    size_t StateCounters::TotalSkipped() const {
+        size_t total = 0;
+        for (int i = 0; i < STATE_CALL_COUNT; i++) {
+            total += skipped[i];
+        }
+        return total;
+    }
+
+    GLState::GLState() {
+        memset(&frame, 0, sizeof(frame));
+        memset(&lastFrame, 0, sizeof(lastFrame));
+        Invalidate();
+    }
+
+    bool GLState::Change(StateCall call, GLuint& current, GLuint value) {
+        if (current == value) {
+            frame.skipped[call]++;
+            return false;
+        }
+        current = value;
+        frame.issued[call]++;
+        return true;
+    }
+
+    int GLState::TargetIndex(GLenum target) {
+        switch (target) {
+            case GL_TEXTURE_2D:
+                return TARGET_2D;
+            case GL_TEXTURE_CUBE_MAP:
+                return TARGET_CUBE_MAP;
+            case GL_TEXTURE_2D_ARRAY:
+                return TARGET_2D_ARRAY;
+            case GL_TEXTURE_BUFFER:
+                return TARGET_BUFFER;
+            default:
+                return -1;
+        }
+    }
+
+    void GLState::UseProgram(GLuint program) {
+        if (Change(STATE_PROGRAM, this->program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    void GLState::BindVertexArray(GLuint vertexArray) {
+        if (Change(STATE_VERTEX_ARRAY, this->vertexArray, vertexArray)) {
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    void GLState::ActiveTexture(GLuint unit) {
+        if (Change(STATE_ACTIVE_TEXTURE, this->activeUnit, unit)) {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+    }
+
+    void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+        int index = TargetIndex(target);
+        if (unit >= MAX_TEXTURE_UNITS || index < 0) {
+            // not shadowed, always reaches GL
+            ActiveTexture(unit);
+            frame.issued[STATE_TEXTURE]++;
+            glBindTexture(target, texture);
+            return;
+        }
+        // the unit only has to be selected when the binding actually changes
+        if (textures[unit][index] == texture) {
+            frame.skipped[STATE_TEXTURE]++;
+            return;
+        }
+        ActiveTexture(unit);
+        Change(STATE_TEXTURE, textures[unit][index], texture);
+        glBindTexture(target, texture);
+    }
+
+    void GLState::BindTexture(GLenum target, GLuint texture) {
+        if (activeUnit == UNKNOWN) {
+            ActiveTexture(0);
+        }
+        BindTexture(activeUnit, target, texture);
+    }
+
+    // Units that are already empty are not counted, they were never asked for
+    void GLState::UnbindTextures(GLuint firstUnit, GLenum target) {
+        int index = TargetIndex(target);
+        if (index < 0) {
+            return;
+        }
+        for (GLuint unit = firstUnit; unit < MAX_TEXTURE_UNITS; unit++) {
+            if (textures[unit][index] != 0) {
+                BindTexture(unit, target, 0);
+            }
+        }
+    }
+
+    void GLState::DepthFunc(GLenum func) {
+        if (Change(STATE_DEPTH_FUNC, this->depthFunc, func)) {
+            glDepthFunc(func);
+        }
+    }
+
+    void GLState::PolygonMode(GLenum mode) {
+        if (Change(STATE_POLYGON_MODE, this->polygonMode, mode)) {
+            glPolygonMode(GL_FRONT_AND_BACK, mode);
+        }
+    }
+
+    void GLState::Blend(bool enabled) {
+        if (Change(STATE_BLEND, this->blend, enabled)) {
+            if (enabled) {
+                glEnable(GL_BLEND);
+            } else {
+                glDisable(GL_BLEND);
+            }
+        }
+    }
+
+    void GLState::DepthMask(bool write) {
+        if (Change(STATE_DEPTH_MASK, this->depthMask, write)) {
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+        }
+    }
+
+    // Deleting a bound object reverts its bindings to 0
+    void GLState::ForgetVertexArray(GLuint vertexArray) {
+        if (this->vertexArray == vertexArray) {
+            this->vertexArray = 0;
+        }
+    }
+
+    void GLState::ForgetTexture(GLuint texture) {
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            for (int target = 0; target < TARGET_COUNT; target++) {
+                if (textures[unit][target] == texture) {
+                    textures[unit][target] = 0;
+                }
+            }
+        }
+    }
+
+    void GLState::Invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+            for (int target = 0; target < TARGET_COUNT; target++) {
+                textures[unit][target] = UNKNOWN;
+            }
+        }
+        depthFunc = UNKNOWN;
+        polygonMode = UNKNOWN;
+        blend = UNKNOWN;
+        depthMask = UNKNOWN;
+    }
+
+    void GLState::EndFrame() {
+        lastFrame = frame;
+        memset(&frame, 0, sizeof(frame));
+    }
+
+    const StateCounters& GLState::GetLastFrame() const {
+        return lastFrame;
+    }
+
+    void GLState::PrintLastFrame(std::ostream& out) const {
+        out << "# state calls  : " << lastFrame.TotalIssued() << " issued, "
+            << lastFrame.TotalSkipped() << " skipped (";
+        for (int i = 0; i < STATE_CALL_COUNT; i++) {
+            out << (i ? ", " : "") << CALL_NAMES[i] << " " << lastFrame.issued[i] << "/"
+                << lastFrame.issued[i] + lastFrame.skipped[i];
+        }
+        out << ")" << std::endl;
+    }
+
+    // Leaked on purpose, like the other GL singletons
+    GLState& GLState::Get() {
+        static GLState* state = new GLState();
+        return *state;
+    }
+}
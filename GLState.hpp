@@ -0,0 +1,100 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <ostream>
+
+namespace gps {
+
+    enum StateCall {
+        STATE_PROGRAM,
+        STATE_VERTEX_ARRAY,
+        STATE_ACTIVE_TEXTURE,
+        STATE_TEXTURE,
+        STATE_DEPTH_FUNC,
+        STATE_POLYGON_MODE,
+        STATE_BLEND,
+        STATE_DEPTH_MASK,
+        STATE_CALL_COUNT
+    };
+
+    struct StateCounters {
+        size_t issued[STATE_CALL_COUNT];
+        size_t skipped[STATE_CALL_COUNT];
+
+        size_t TotalIssued() const;
+        size_t TotalSkipped() const;
+    };
+
+    // Shadows the bindings the renderer changes every draw and drops calls that would not change them.
+    // Only valid while all code changing this state goes through it - use Invalidate after raw GL calls.
+    // GL thread only.
+    class GLState
+    {
+    public:
+        static const GLuint MAX_TEXTURE_UNITS = 32;
+
+        GLState();
+
+        void UseProgram(GLuint program);
+        void BindVertexArray(GLuint vertexArray);
+        void ActiveTexture(GLuint unit);
+        // Selects the unit only when the binding there actually changes
+        void BindTexture(GLuint unit, GLenum target, GLuint texture);
+        // Binds on whichever unit is active - for loaders that only need the texture bound to edit it
+        void BindTexture(GLenum target, GLuint texture);
+        // Empties the target on every unit from firstUnit up, so samplers left pointing there read nothing
+        void UnbindTextures(GLuint firstUnit, GLenum target);
+        void DepthFunc(GLenum func);
+        // Core profiles only accept GL_FRONT_AND_BACK, so that face is implied
+        void PolygonMode(GLenum mode);
+        // glEnable/glDisable(GL_BLEND)
+        void Blend(bool enabled);
+        void DepthMask(bool write);
+
+        // Call before deleting objects, GL resets the bindings of deleted names behind our back
+        void ForgetVertexArray(GLuint vertexArray);
+        void ForgetTexture(GLuint texture);
+        // Everything is unknown again, the next call of each kind is issued
+        void Invalidate();
+
+        // Closes the frame counters, the finished frame stays readable through GetLastFrame
+        void EndFrame();
+        const StateCounters& GetLastFrame() const;
+        void PrintLastFrame(std::ostream& out) const;
+
+        static GLState& Get();
+
+    private:
+        enum TextureTarget {
+            TARGET_2D,
+            TARGET_CUBE_MAP,
+            TARGET_2D_ARRAY,
+            TARGET_BUFFER,
+            TARGET_COUNT
+        };
+
+        GLuint program;
+        GLuint vertexArray;
+        GLuint activeUnit;
+        GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+        GLenum depthFunc;
+        GLenum polygonMode;
+        GLuint blend;
+        GLuint depthMask;
+
+        StateCounters frame;
+        StateCounters lastFrame;
+
+        // true when the call has to reach GL
+        bool Change(StateCall call, GLuint& current, GLuint value);
+        static int TargetIndex(GLenum target);
+
+        GLState(const GLState&);
+        GLState& operator=(const GLState&);
+    };
+}
+
+#endif /* GLState_hpp */
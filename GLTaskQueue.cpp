@@ -0,0 +1,91 @@
+#include "GLTaskQueue.hpp"
+
+#include <chrono>
+
+namespace gps {
+
+    GLTaskQueue::GLTaskQueue() : head(&stub), tail(&stub), outstanding(0) {
+        stub.next.store(NULL, std::memory_order_relaxed);
+    }
+
+    GLTaskQueue::~GLTaskQueue() {
+        while (Node* node = Pop()) {
+            delete node;
+        }
+    }
+
+    GLTaskQueue& GLTaskQueue::GetShared() {
+        // never destroyed, loader threads may still post while statics are torn down
+        static GLTaskQueue* queue = new GLTaskQueue();
+        return *queue;
+    }
+
+    void GLTaskQueue::Push(Node* node) {
+        node->next.store(NULL, std::memory_order_relaxed);
+        Node* previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Returns NULL when empty, or while a producer is between its exchange and its link
+    GLTaskQueue::Node* GLTaskQueue::Pop() {
+        Node* first = tail;
+        Node* next = first->next.load(std::memory_order_acquire);
+        if (first == &stub) {
+            if (!next) {
+                return NULL;
+            }
+            tail = next;
+            first = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail = next;
+            return first;
+        }
+        if (first != head.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        // first is the last node - put the stub behind it so it can be unlinked
+        Push(&stub);
+        next = first->next.load(std::memory_order_acquire);
+        if (next) {
+            tail = next;
+            return first;
+        }
+        return NULL;
+    }
+
+    void GLTaskQueue::Post(std::function<void()> task) {
+        Node* node = new Node();
+        node->task = std::move(task);
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        Push(node);
+    }
+
+    size_t GLTaskQueue::RunPending(double budgetMs) {
+        auto start = std::chrono::steady_clock::now();
+        size_t count = 0;
+        while (Node* node = Pop()) {
+            node->task();
+            delete node;
+            outstanding.fetch_sub(1, std::memory_order_release);
+            count++;
+            if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMs) {
+                break;
+            }
+        }
+        return count;
+    }
+
+    void GLTaskQueue::Retain() {
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void GLTaskQueue::Release() {
+        outstanding.fetch_sub(1, std::memory_order_release);
+    }
+
+    bool GLTaskQueue::IsIdle() const {
+        return outstanding.load(std::memory_order_acquire) == 0;
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef GLTaskQueue_hpp
+#define GLTaskQueue_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace gps {
+
+    // Hands work that needs the GL context from loader threads to the render loop.
+    // Any thread may Post, only the GL thread runs the tasks. Posting never takes a lock.
+    class GLTaskQueue
+    {
+    public:
+        GLTaskQueue();
+        ~GLTaskQueue();
+
+        void Post(std::function<void()> task);
+
+        // Runs posted tasks in order until the time budget is used up, at least one if any is waiting
+        size_t RunPending(double budgetMs);
+
+        // Background work that will still post tasks keeps the queue from reporting idle until released
+        void Retain();
+        void Release();
+
+        // Nothing retained and nothing waiting to run
+        bool IsIdle() const;
+
+        static GLTaskQueue& GetShared();
+
+    private:
+        struct Node {
+            std::atomic<Node*> next;
+            std::function<void()> task;
+        };
+
+        // intrusive MPSC list - producers swap themselves in at the head, the consumer walks from the tail
+        std::atomic<Node*> head;
+        Node* tail;
+        Node stub;
+        std::atomic<int> outstanding;
+
+        void Push(Node* node);
+        Node* Pop();
+
+        GLTaskQueue(const GLTaskQueue&);
+        GLTaskQueue& operator=(const GLTaskQueue&);
+    };
+}
+
+#endif /* GLTaskQueue_hpp */
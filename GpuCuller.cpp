@@ -0,0 +1,206 @@
+#include "GpuCuller.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace gps {
+
+    constexpr uint64_t COMMAND_COUNT_UNIFORM = HashName("commandCount");
+    constexpr uint64_t COMMAND_OFFSET_UNIFORM = HashName("commandOffset");
+    constexpr uint64_t COUNT_OFFSET_UNIFORM = HashName("countOffset");
+    constexpr uint64_t MODEL_VIEW_PROJECTION_UNIFORM = HashName("modelViewProjection");
+    constexpr uint64_t HI_Z_MODEL_VIEW_PROJECTION_UNIFORM = HashName("hiZModelViewProjection");
+    constexpr uint64_t USE_HI_Z_UNIFORM = HashName("useHiZ");
+    constexpr uint64_t HI_Z_UNIFORM = HashName("hiZ");
+    constexpr uint64_t HI_Z_LEVELS_UNIFORM = HashName("hiZLevels");
+    constexpr uint64_t SOURCE_UNIFORM = HashName("source");
+    constexpr uint64_t SOURCE_LEVEL_UNIFORM = HashName("sourceLevel");
+
+    // local sizes of the two compute shaders
+    static const GLuint CULL_GROUP_SIZE = 64;
+    static const GLuint PYRAMID_GROUP_SIZE = 8;
+
+    GpuCuller::GpuCuller() : ready(false), depthTexture(0), resolveFramebuffer(0), hiZTexture(0), width(0), height(0),
+                             levels(0), hiZValid(false), viewProjection(1.0f), hiZViewProjection(1.0f), tested(0) {
+    }
+
+    GpuCuller::~GpuCuller() {
+        DeleteTextures();
+    }
+
+    bool GpuCuller::IsSupported() {
+        return GLEW_VERSION_4_3;
+    }
+
+    bool GpuCuller::HasIndirectCount() {
+        return GLEW_ARB_indirect_parameters;
+    }
+
+    void GpuCuller::Init(const std::string& cullShaderFile, const std::string& pyramidShaderFile) {
+        if (!IsSupported()) {
+            return;
+        }
+        cullProgram.loadComputeShader(cullShaderFile);
+        pyramidProgram.loadComputeShader(pyramidShaderFile);
+        ready = true;
+    }
+
+    bool GpuCuller::IsReady() const {
+        return ready;
+    }
+
+    void GpuCuller::Begin(const glm::mat4& view, const glm::mat4& projection) {
+        viewProjection = projection * view;
+        tested = 0;
+    }
+
+    void GpuCuller::DeleteTextures() {
+        GLState& state = GLState::Get();
+        state.ForgetTexture(depthTexture);
+        state.ForgetTexture(hiZTexture);
+        glDeleteFramebuffers(1, &resolveFramebuffer);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &hiZTexture);
+        resolveFramebuffer = depthTexture = hiZTexture = 0;
+        hiZValid = false;
+    }
+
+    // Depth format of the default framebuffer - a depth blit needs the same on both sides
+    static GLenum DefaultDepthFormat() {
+        GLint depthBits = 0;
+        GLint stencilBits = 0;
+        GLint componentType = GL_UNSIGNED_NORMALIZED;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE,
+                                              &depthBits);
+        glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE,
+                                              &componentType);
+        glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE,
+                                              &stencilBits);
+        if (componentType == GL_FLOAT) {
+            return stencilBits ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+        }
+        if (depthBits == 16) {
+            return GL_DEPTH_COMPONENT16;
+        }
+        if (depthBits == 32) {
+            return GL_DEPTH_COMPONENT32;
+        }
+        return stencilBits ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+    }
+
+    // Immutable storage, so every level is there and texelFetch never sees an incomplete texture
+    bool GpuCuller::CreateTextures(int width, int height) {
+        DeleteTextures();
+        this->width = width;
+        this->height = height;
+        levels = 1;
+        while ((width | height) >> levels) {
+            levels++;
+        }
+
+        GLState& state = GLState::Get();
+        glGenTextures(1, &depthTexture);
+        state.BindTexture(HI_Z_UNIT, GL_TEXTURE_2D, depthTexture);
+        GLenum depthFormat = DefaultDepthFormat();
+        glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &hiZTexture);
+        state.BindTexture(HI_Z_UNIT, GL_TEXTURE_2D, hiZTexture);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // depth only, nothing is drawn into it
+        bool stencil = depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8;
+        glGenFramebuffers(1, &resolveFramebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                               GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        bool complete = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        if (!complete) {
+            fprintf(stderr, "WARNING: cannot resolve the depth buffer, GPU culling is off\n");
+            DeleteTextures();
+            ready = false;
+        }
+        return complete;
+    }
+
+    void GpuCuller::Dispatch(GLuint sourceCommands, GLuint culledCommands, GLuint bounds, GLuint commandGroups,
+                             GLuint drawCounts, GLuint commandOffset, GLuint countOffset, GLuint commandCount,
+                             const glm::mat4& model) {
+        if (!ready || commandCount == 0) {
+            return;
+        }
+        cullProgram.useShaderProgram();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sourceCommands);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, culledCommands);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, bounds);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandGroups);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, drawCounts);
+
+        glm::mat4 modelViewProjection = viewProjection * model;
+        glm::mat4 hiZModelViewProjection = hiZViewProjection * model;
+        glUniform1ui(cullProgram.GetUniformLocation(COMMAND_COUNT_UNIFORM), commandCount);
+        glUniform1ui(cullProgram.GetUniformLocation(COMMAND_OFFSET_UNIFORM), commandOffset);
+        glUniform1ui(cullProgram.GetUniformLocation(COUNT_OFFSET_UNIFORM), countOffset);
+        glUniformMatrix4fv(cullProgram.GetUniformLocation(MODEL_VIEW_PROJECTION_UNIFORM), 1, GL_FALSE,
+                           &modelViewProjection[0][0]);
+        glUniformMatrix4fv(cullProgram.GetUniformLocation(HI_Z_MODEL_VIEW_PROJECTION_UNIFORM), 1, GL_FALSE,
+                           &hiZModelViewProjection[0][0]);
+        glUniform1i(cullProgram.GetUniformLocation(USE_HI_Z_UNIFORM), hiZValid);
+        glUniform1i(cullProgram.GetUniformLocation(HI_Z_LEVELS_UNIFORM), levels);
+        glUniform1i(cullProgram.GetUniformLocation(HI_Z_UNIFORM), HI_Z_UNIT);
+        GLState::Get().BindTexture(HI_Z_UNIT, GL_TEXTURE_2D, hiZValid ? hiZTexture : 0);
+
+        glDispatchCompute((commandCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        // the multi-draws read the commands and counts written here
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+        tested += commandCount;
+    }
+
+    // Level 0 copies the resolved depth, each level above keeps the farthest depth of the texels below it
+    void GpuCuller::EndFrame(int width, int height) {
+        if (!ready || width <= 0 || height <= 0) {
+            return;
+        }
+        if ((width != this->width || height != this->height || !hiZTexture) && !CreateTextures(width, height)) {
+            return;
+        }
+
+        // the default framebuffer is multisampled and cannot be sampled - the blit leaves one depth per pixel,
+        // somewhere between the nearest and farthest of its samples
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+        GLState& state = GLState::Get();
+        pyramidProgram.useShaderProgram();
+        glUniform1i(pyramidProgram.GetUniformLocation(SOURCE_UNIFORM), HI_Z_UNIT);
+        GLint sourceLevel = pyramidProgram.GetUniformLocation(SOURCE_LEVEL_UNIFORM);
+        for (int level = 0; level < levels; level++) {
+            int levelWidth = std::max(1, width >> level);
+            int levelHeight = std::max(1, height >> level);
+            state.BindTexture(HI_Z_UNIT, GL_TEXTURE_2D, level == 0 ? depthTexture : hiZTexture);
+            glUniform1i(sourceLevel, level == 0 ? 0 : level - 1);
+            glBindImageTexture(0, hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((levelWidth + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                              (levelHeight + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        hiZViewProjection = viewProjection;
+        hiZValid = true;
+    }
+
+    size_t GpuCuller::GetTestedCount() const {
+        return tested;
+    }
+}
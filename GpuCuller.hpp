@@ -0,0 +1,87 @@
+#ifndef GpuCuller_hpp
+#define GpuCuller_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // unit the depth pyramid is bound to while the cull pass reads it, past the material arrays
+    const GLuint HI_Z_UNIT = 28;
+
+    // Culls MeshBatch commands on the GPU. A compute pass tests each command's box against the frustum
+    // and against a Hi-Z pyramid - the farthest depth of every 2^level square of last frame's depth buffer -
+    // and packs the survivors of each texture group at the start of the group's range, counting them for
+    // glMultiDrawElementsIndirectCount. Nothing is read back.
+    // The pyramid holds last frame's depth, so boxes are projected with last frame's matrices: a mesh coming
+    // out from behind an occluder shows up one frame late, and moving models should not be tested.
+    // Needs GL 4.3 - off everywhere else. GL thread only.
+    class GpuCuller
+    {
+    public:
+        GpuCuller();
+        ~GpuCuller();
+
+        // Compute shaders, image load/store, buffer clears and storage buffers - core in GL 4.3
+        static bool IsSupported();
+        // glMultiDrawElementsIndirectCount, without it culled commands stay in place with no instance
+        static bool HasIndirectCount();
+
+        // Loads the cull and pyramid programs - needs the context, does nothing where unsupported
+        void Init(const std::string& cullShaderFile, const std::string& pyramidShaderFile);
+        bool IsReady() const;
+
+        // Frustum tests use projection * view
+        void Begin(const glm::mat4& view, const glm::mat4& projection);
+
+        // Culls commandCount commands read from sourceCommands at commandOffset into culledCommands at the
+        // same offset, which must be zero there - survivors go to firstCommand + drawCounts[countOffset + group]
+        // of their group. bounds holds an object space min and max vec4 per command, commandGroups a
+        // (group, firstCommand) pair, both from the first command on.
+        void Dispatch(GLuint sourceCommands, GLuint culledCommands, GLuint bounds, GLuint commandGroups,
+                      GLuint drawCounts, GLuint commandOffset, GLuint countOffset, GLuint commandCount,
+                      const glm::mat4& model);
+
+        // After the frame is drawn - resolves the depth buffer into a texture and reduces it into the pyramid
+        // the next frame tests against
+        void EndFrame(int width, int height);
+
+        // Commands sent through the cull pass this frame
+        size_t GetTestedCount() const;
+
+    private:
+        gps::Shader cullProgram;
+        gps::Shader pyramidProgram;
+        bool ready;
+
+        // depth resolved from the default framebuffer and the pyramid built from it, recreated when the
+        // window size changes
+        GLuint depthTexture;
+        GLuint resolveFramebuffer;
+        GLuint hiZTexture;
+        int width;
+        int height;
+        int levels;
+        // the pyramid holds a frame's depth
+        bool hiZValid;
+
+        glm::mat4 viewProjection;
+        // matrix the pyramid's depth was rendered with
+        glm::mat4 hiZViewProjection;
+        size_t tested;
+
+        // false when the depth cannot be resolved into them, the culler is off then
+        bool CreateTextures(int width, int height);
+        void DeleteTextures();
+
+        GpuCuller(const GpuCuller&);
+        GpuCuller& operator=(const GpuCuller&);
+    };
+}
+
+#endif /* GpuCuller_hpp */
@@ -0,0 +1,37 @@
+#ifndef Hash_hpp
+#define Hash_hpp
+
+#include <cstdint>
+#include <cstring>
+
+namespace gps {
+
+    const uint64_t HASH_SEED = 14695981039346656037ull;
+    const uint64_t HASH_PRIME = 1099511628211ull;
+
+    // FNV-1a style hash that consumes the input 8 bytes at a time
+    inline uint64_t HashBytes(const void* data, size_t size, uint64_t hash = HASH_SEED) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        size_t words = size / 8;
+        for (size_t i = 0; i < words; i++) {
+            uint64_t word;
+            memcpy(&word, bytes + i * 8, 8);
+            hash = (hash ^ word) * HASH_PRIME;
+            hash ^= hash >> 32;
+        }
+        for (size_t i = words * 8; i < size; i++) {
+            hash = (hash ^ bytes[i]) * HASH_PRIME;
+        }
+        return hash;
+    }
+
+    // FNV-1a over a zero terminated name - constexpr, so constant names are hashed at compile time
+    constexpr uint64_t HashName(const char* name, uint64_t hash = HASH_SEED) {
+        for (; *name; name++) {
+            hash = (hash ^ (unsigned char)*name) * HASH_PRIME;
+        }
+        return hash;
+    }
+}
+
+#endif /* Hash_hpp */
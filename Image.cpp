@@ -0,0 +1,103 @@
+#include "Image.hpp"
+
+#include "stb_image.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    Image::Image() : pixels(NULL), width(0), height(0), channels(0), fileChannels(0) {
+    }
+
+    Image::~Image() {
+        Free();
+    }
+
+    Image::Image(Image&& other) : pixels(NULL), width(0), height(0), channels(0), fileChannels(0) {
+        *this = std::move(other);
+    }
+
+    Image& Image::operator=(Image&& other) {
+        if (this != &other) {
+            Free();
+            pixels = other.pixels;
+            width = other.width;
+            height = other.height;
+            channels = other.channels;
+            fileChannels = other.fileChannels;
+            other.pixels = NULL;
+            other.width = other.height = other.channels = other.fileChannels = 0;
+        }
+        return *this;
+    }
+
+    bool Image::Load(const std::string& fileName, int forceChannels, bool flipVertically) {
+        Free();
+        pixels = stbi_load(fileName.c_str(), &width, &height, &fileChannels, forceChannels);
+        if (!pixels) {
+            return false;
+        }
+        channels = forceChannels ? forceChannels : fileChannels;
+
+        // OpenGL expects the first row at the bottom
+        if (flipVertically) {
+            size_t rowSize = (size_t)width * channels;
+            std::vector<unsigned char> row(rowSize);
+            for (int y = 0; y < height / 2; y++) {
+                unsigned char* top = pixels + y * rowSize;
+                unsigned char* bottom = pixels + (height - y - 1) * rowSize;
+                memcpy(row.data(), top, rowSize);
+                memcpy(top, bottom, rowSize);
+                memcpy(bottom, row.data(), rowSize);
+            }
+        }
+        return true;
+    }
+
+    void Image::Free() {
+        if (pixels) {
+            stbi_image_free(pixels);
+        }
+        pixels = NULL;
+        width = height = channels = fileChannels = 0;
+    }
+
+    bool Image::IsLoaded() const {
+        return pixels != NULL;
+    }
+
+    int Image::GetWidth() const {
+        return width;
+    }
+
+    int Image::GetHeight() const {
+        return height;
+    }
+
+    int Image::GetChannels() const {
+        return channels;
+    }
+
+    int Image::GetFileChannels() const {
+        return fileChannels;
+    }
+
+    bool Image::HasTranslucency() const {
+        if (channels != 4 || fileChannels == 3) {
+            return false;
+        }
+        size_t size = (size_t)width * height * 4;
+        for (size_t i = 3; i < size; i += 4) {
+            if (pixels[i] != 255) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const unsigned char* Image::GetPixels() const {
+        return pixels;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef Image_hpp
+#define Image_hpp
+
+#include <string>
+
+namespace gps {
+
+    // Decoded pixels of an image file. Decoding touches no GL state, so it can run on any thread.
+    class Image
+    {
+    public:
+        Image();
+        ~Image();
+        Image(Image&& other);
+        Image& operator=(Image&& other);
+
+        // forceChannels = 0 keeps the channel count of the file
+        bool Load(const std::string& fileName, int forceChannels, bool flipVertically);
+        void Free();
+
+        bool IsLoaded() const;
+        int GetWidth() const;
+        int GetHeight() const;
+        // channels of the pixel data
+        int GetChannels() const;
+        // channels stored in the file, 4 means it has alpha
+        int GetFileChannels() const;
+        const unsigned char* GetPixels() const;
+        // Some pixel has alpha below 255 - needs 4 channel pixel data
+        bool HasTranslucency() const;
+
+    private:
+        unsigned char* pixels;
+        int width;
+        int height;
+        int channels;
+        int fileChannels;
+
+        Image(const Image&);
+        Image& operator=(const Image&);
+    };
+}
+
+#endif /* Image_hpp */
@@ -0,0 +1,63 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gps {
+
+    MappedFile::MappedFile() : data(NULL), size(0) {
+    }
+
+    MappedFile::~MappedFile() {
+        Close();
+    }
+
+    bool MappedFile::Open(const std::string& fileName) {
+        Close();
+
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping stays valid after the descriptor is closed
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+
+        data = static_cast<const char*>(mapping);
+        size = info.st_size;
+        return true;
+    }
+
+    void MappedFile::Close() {
+        if (data) {
+            munmap(const_cast<char*>(data), size);
+        }
+        data = NULL;
+        size = 0;
+    }
+
+    bool MappedFile::IsOpen() const {
+        return data != NULL;
+    }
+
+    const char* MappedFile::GetData() const {
+        return data;
+    }
+
+    size_t MappedFile::GetSize() const {
+        return size;
+    }
+}
@@ -0,0 +1,191 @@
+#include "MaterialTable.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+namespace gps {
+
+    // Level 0 size, internal format and level count - textures only share an array when all match
+    struct MaterialTable::Bucket {
+        GLint width;
+        GLint height;
+        GLint internalFormat;
+        GLint levels;
+        std::vector<GLuint> textures;
+    };
+
+    // Immutable storage only takes sized formats, the placeholders were created unsized
+    static GLint SizedFormat(GLint internalFormat) {
+        switch (internalFormat) {
+            case GL_RGB: return GL_RGB8;
+            case GL_RGBA: return GL_RGBA8;
+            case GL_SRGB: return GL_SRGB8;
+            case GL_SRGB_ALPHA: return GL_SRGB8_ALPHA8;
+            default: return internalFormat;
+        }
+    }
+
+    MaterialTable::MaterialTable() {
+    }
+
+    MaterialTable::~MaterialTable() {
+        deleteArrays();
+    }
+
+    MaterialTable::MaterialTable(MaterialTable&& other) noexcept
+        : arrays(std::move(other.arrays)), materials(std::move(other.materials)) {
+        other.arrays.clear();
+        other.materials.clear();
+    }
+
+    MaterialTable& MaterialTable::operator=(MaterialTable&& other) noexcept {
+        if (this != &other) {
+            deleteArrays();
+            arrays = std::move(other.arrays);
+            materials = std::move(other.materials);
+            other.arrays.clear();
+            other.materials.clear();
+        }
+        return *this;
+    }
+
+    void MaterialTable::deleteArrays() {
+        for (size_t i = 0; i < arrays.size(); i++) {
+            GLState::Get().ForgetTexture(arrays[i]);
+        }
+        if (!arrays.empty()) {
+            glDeleteTextures(arrays.size(), arrays.data());
+        }
+        arrays.clear();
+        materials.clear();
+    }
+
+    bool MaterialTable::IsSupported() {
+        return GLEW_VERSION_4_3 || (GLEW_ARB_copy_image && GLEW_ARB_texture_storage);
+    }
+
+    int MaterialTable::GetMaxArrays() {
+        GLint fragmentUnits = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &fragmentUnits);
+        return std::max(0, std::min(MAX_MATERIAL_ARRAYS, fragmentUnits - MATERIAL_FRAGMENT_SAMPLERS));
+    }
+
+    bool MaterialTable::IsBuilt() const {
+        return !materials.empty();
+    }
+
+    glm::vec4 MaterialTable::GetMaterial(size_t mesh) const {
+        return materials[mesh];
+    }
+
+    void MaterialTable::Bind() const {
+        GLState& state = GLState::Get();
+        for (size_t i = 0; i < arrays.size(); i++) {
+            state.BindTexture(MATERIAL_ARRAY_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i]);
+        }
+    }
+
+    bool MaterialTable::Build(const std::vector<Mesh>& meshes) {
+        deleteArrays();
+        GLState& state = GLState::Get();
+
+        // each texture lands in the bucket matching its level 0, once
+        std::vector<Bucket> buckets;
+        std::map<GLuint, std::pair<int, int> > layers;
+        for (size_t m = 0; m < meshes.size(); m++) {
+            for (size_t t = 0; t < meshes[m].textures.size(); t++) {
+                GLuint texture = meshes[m].textures[t].id;
+                if (layers.count(texture)) {
+                    continue;
+                }
+
+                Bucket key;
+                state.BindTexture(GL_TEXTURE_2D, texture);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &key.width);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &key.height);
+                glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &key.internalFormat);
+                key.internalFormat = SizedFormat(key.internalFormat);
+                key.levels = 1;
+                GLint levelWidth = key.width;
+                while (levelWidth > 0) {
+                    glGetTexLevelParameteriv(GL_TEXTURE_2D, key.levels, GL_TEXTURE_WIDTH, &levelWidth);
+                    key.levels += levelWidth > 0;
+                }
+
+                size_t b = 0;
+                while (b < buckets.size() && (buckets[b].width != key.width || buckets[b].height != key.height ||
+                       buckets[b].internalFormat != key.internalFormat || buckets[b].levels != key.levels)) {
+                    b++;
+                }
+                if (b == buckets.size()) {
+                    buckets.push_back(key);
+                }
+                layers[texture] = std::make_pair((int)b, (int)buckets[b].textures.size());
+                buckets[b].textures.push_back(texture);
+            }
+        }
+
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        int maxArrays = GetMaxArrays();
+        if (buckets.size() > (size_t)maxArrays) {
+            fprintf(stderr, "WARNING: textures need %u arrays, only %d fit, keeping them separate\n",
+                    (unsigned)buckets.size(), maxArrays);
+            return false;
+        }
+        for (size_t b = 0; b < buckets.size(); b++) {
+            if (buckets[b].textures.size() > (size_t)maxLayers) {
+                fprintf(stderr, "WARNING: more than %d textures of one size, keeping them separate\n", maxLayers);
+                return false;
+            }
+        }
+
+        // copied on the GPU level by level, compressed blocks included
+        arrays.resize(buckets.size());
+        glGenTextures(arrays.size(), arrays.data());
+        for (size_t b = 0; b < buckets.size(); b++) {
+            const Bucket& bucket = buckets[b];
+            state.BindTexture(GL_TEXTURE_2D_ARRAY, arrays[b]);
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, bucket.levels, bucket.internalFormat, bucket.width, bucket.height,
+                           bucket.textures.size());
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                            bucket.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+            for (size_t layer = 0; layer < bucket.textures.size(); layer++) {
+                for (GLint level = 0; level < bucket.levels; level++) {
+                    GLint width = std::max(bucket.width >> level, 1);
+                    GLint height = std::max(bucket.height >> level, 1);
+                    glCopyImageSubData(bucket.textures[layer], GL_TEXTURE_2D, level, 0, 0, 0,
+                                       arrays[b], GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1);
+                }
+            }
+        }
+
+        // the shader only samples diffuse and specular maps
+        materials.resize(meshes.size());
+        for (size_t m = 0; m < meshes.size(); m++) {
+            glm::vec4 material(MATERIAL_NO_TEXTURE, 0.0f, MATERIAL_NO_TEXTURE, 0.0f);
+            for (size_t t = 0; t < meshes[m].textures.size(); t++) {
+                const Texture& texture = meshes[m].textures[t];
+                std::pair<int, int> layer = layers[texture.id];
+                if (texture.type == "diffuseTexture") {
+                    material.x = layer.first;
+                    material.y = layer.second;
+                } else if (texture.type == "specularTexture") {
+                    material.z = layer.first;
+                    material.w = layer.second;
+                }
+            }
+            materials[m] = material;
+        }
+
+        std::cout << "# texture arrays: " << layers.size() << " textures in " << arrays.size() << " arrays" << std::endl;
+        return true;
+    }
+}
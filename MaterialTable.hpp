@@ -0,0 +1,70 @@
+#ifndef MaterialTable_hpp
+#define MaterialTable_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // basic.frag declares this many sampler2DArrays, bound to consecutive units from MATERIAL_ARRAY_UNIT.
+    // Map_v1 alone has textures of 8 sizes and formats.
+    const int MAX_MATERIAL_ARRAYS = 12;
+    const GLuint MATERIAL_ARRAY_UNIT = 16;
+    // basic.frag's other samplers, diffuseTexture and specularTexture
+    const int MATERIAL_FRAGMENT_SAMPLERS = 2;
+
+    // Array index meaning the mesh's own 2D texture is bound to the sampler of its type
+    const float MATERIAL_BOUND_TEXTURE = -1.0f;
+    // Array index meaning the mesh has no texture of that type, it samples black
+    const float MATERIAL_NO_TEXTURE = -2.0f;
+
+    // Per-draw material as stored in the DrawDataRing: diffuse array, diffuse layer, specular array, specular layer
+    inline glm::vec4 BoundTextureMaterial() {
+        return glm::vec4(MATERIAL_BOUND_TEXTURE, 0.0f, MATERIAL_BOUND_TEXTURE, 0.0f);
+    }
+
+    // The textures of a set of meshes copied into GL_TEXTURE_2D_ARRAYs, one per size, format and
+    // mip count, plus the layers each mesh samples. The textures themselves are left as they are.
+    class MaterialTable
+    {
+    public:
+        MaterialTable();
+        ~MaterialTable();
+
+        MaterialTable(MaterialTable&& other) noexcept;
+        MaterialTable& operator=(MaterialTable&& other) noexcept;
+
+        // The textures must be fully uploaded. False when they need more than GetMaxArrays()
+        // arrays or too many layers, the table stays empty then.
+        bool Build(const std::vector<Mesh>& meshes);
+        bool IsBuilt() const;
+
+        // Material of the mesh at the same index as in Build
+        glm::vec4 GetMaterial(size_t mesh) const;
+
+        // Binds the arrays to their units
+        void Bind() const;
+
+        // Copying between textures is core in GL 4.3
+        static bool IsSupported();
+        // Arrays the fragment stage has units left for, at most MAX_MATERIAL_ARRAYS
+        static int GetMaxArrays();
+
+    private:
+        struct Bucket;
+
+        std::vector<GLuint> arrays;
+        std::vector<glm::vec4> materials;
+
+        void deleteArrays();
+
+        MaterialTable(const MaterialTable&);
+        MaterialTable& operator=(const MaterialTable&);
+    };
+}
+
+#endif /* MaterialTable_hpp */
@@ -1,60 +1,288 @@
 #include "Mesh.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cmath>
+
 namespace gps {
 
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures)
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, bool keepGeometry)
+	{
+		this->textures.swap(textures);
+		this->assignTextureUnits();
+
+		this->setupMesh(vertices.data(), vertices.size(), indices.data(), indices.size());
+		if (keepGeometry) {
+			this->vertices.swap(vertices);
+			this->indices.swap(indices);
+		}
+	}
+
+	Mesh::Mesh(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Texture> textures,
+			   bool keepGeometry)
+	{
+		this->textures.swap(textures);
+		this->assignTextureUnits();
+
+		this->setupMesh(vertices, vertexCount, indices, indexCount);
+		if (keepGeometry) {
+			this->vertices.assign(vertices, vertices + vertexCount);
+			this->indices.assign(indices, indices + indexCount);
+		}
+	}
+
+	Mesh::Mesh(Mesh&& other) noexcept
+		: textures(std::move(other.textures)), vertices(std::move(other.vertices)), indices(std::move(other.indices)),
+		  textureUnits(std::move(other.textureUnits)), buffers(other.buffers), instances(std::move(other.instances)),
+		  instanceBuffer(other.instanceBuffer), vertexCount(other.vertexCount), indexCount(other.indexCount),
+		  boundsMin(other.boundsMin), boundsMax(other.boundsMax), sphereCentre(other.sphereCentre), sphereRadius(other.sphereRadius)
+	{
+		other.buffers.VAO = other.buffers.VBO = other.buffers.EBO = 0;
+		other.instanceBuffer = 0;
+		other.vertexCount = other.indexCount = 0;
+	}
+
+	Mesh& Mesh::operator=(Mesh&& other) noexcept
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		if (this != &other) {
+			deleteBuffers();
+			textures = std::move(other.textures);
+			vertices = std::move(other.vertices);
+			indices = std::move(other.indices);
+			textureUnits = std::move(other.textureUnits);
+			buffers = other.buffers;
+			instances = std::move(other.instances);
+			instanceBuffer = other.instanceBuffer;
+			vertexCount = other.vertexCount;
+			indexCount = other.indexCount;
+			boundsMin = other.boundsMin;
+			boundsMax = other.boundsMax;
+			sphereCentre = other.sphereCentre;
+			sphereRadius = other.sphereRadius;
+			other.buffers.VAO = other.buffers.VBO = other.buffers.EBO = 0;
+			other.instanceBuffer = 0;
+			other.vertexCount = other.indexCount = 0;
+		}
+		return *this;
+	}
 
-		this->setupMesh();
+	Mesh::~Mesh()
+	{
+		deleteBuffers();
+	}
+
+	// glDelete* ignores the names of moved-from meshes (0)
+	void Mesh::deleteBuffers()
+	{
+		glDeleteBuffers(1, &this->buffers.VBO);
+		glDeleteBuffers(1, &this->buffers.EBO);
+		glDeleteBuffers(1, &this->instanceBuffer);
+		this->instanceBuffer = 0;
+		if (this->buffers.VAO) {
+			GLState::Get().ForgetVertexArray(this->buffers.VAO);
+		}
+		glDeleteVertexArrays(1, &this->buffers.VAO);
+		this->buffers.VAO = this->buffers.VBO = this->buffers.EBO = 0;
 	}
 
-	Buffers Mesh::getBuffers() {
+	static GLuint TextureUnit(const std::string& type)
+	{
+		if (type == "ambientTexture")
+			return AMBIENT_TEXTURE_UNIT;
+		if (type == "diffuseTexture")
+			return DIFFUSE_TEXTURE_UNIT;
+		if (type == "specularTexture")
+			return SPECULAR_TEXTURE_UNIT;
+		return MESH_TEXTURE_UNITS;
+	}
+
+	void Mesh::assignTextureUnits()
+	{
+		this->textureUnits.resize(this->textures.size());
+		for (size_t i = 0; i < this->textures.size(); i++) {
+			this->textureUnits[i] = TextureUnit(this->textures[i].type);
+		}
+	}
+
+	void Mesh::AttachSamplers(const gps::Shader& shader)
+	{
+		shader.useShaderProgram();
+		glUniform1i(shader.GetUniformLocation(HashName("ambientTexture")), AMBIENT_TEXTURE_UNIT);
+		glUniform1i(shader.GetUniformLocation(HashName("diffuseTexture")), DIFFUSE_TEXTURE_UNIT);
+		glUniform1i(shader.GetUniformLocation(HashName("specularTexture")), SPECULAR_TEXTURE_UNIT);
+	}
+
+	Buffers Mesh::getBuffers() const {
 	    return this->buffers;
 	}
 
+	const std::vector<Vertex>& Mesh::GetVertices() const {
+		return this->vertices;
+	}
+
+	const std::vector<GLuint>& Mesh::GetIndices() const {
+		return this->indices;
+	}
+
+	bool Mesh::HasGeometry() const {
+		return !this->indices.empty();
+	}
+
+	void Mesh::ReleaseGeometry() {
+		std::vector<Vertex>().swap(this->vertices);
+		std::vector<GLuint>().swap(this->indices);
+	}
+
+	size_t Mesh::GetVertexCount() const {
+		return this->vertexCount;
+	}
+
+	size_t Mesh::GetIndexCount() const {
+		return this->indexCount;
+	}
+
+	glm::vec3 Mesh::GetBoundsMin() const {
+		return this->boundsMin;
+	}
+
+	glm::vec3 Mesh::GetBoundsMax() const {
+		return this->boundsMax;
+	}
+
+	glm::vec3 Mesh::GetSphereCentre() const {
+		return this->sphereCentre;
+	}
+
+	float Mesh::GetSphereRadius() const {
+		return this->sphereRadius;
+	}
+
+	const std::vector<glm::mat4>& Mesh::GetInstances() const {
+		return this->instances;
+	}
+
+	void Mesh::SetInstances(const glm::mat4* transforms, size_t count)
+	{
+		if (count == 0)
+			return;
+		this->instances.assign(transforms, transforms + count);
+
+		// every corner of the box in every copy
+		glm::vec3 corners[2] = {this->boundsMin, this->boundsMax};
+		glm::vec3 newMin(0.0f);
+		glm::vec3 newMax(0.0f);
+		for (size_t i = 0; i < count; i++) {
+			for (int c = 0; c < 8; c++) {
+				glm::vec3 corner(corners[c & 1].x, corners[(c >> 1) & 1].y, corners[(c >> 2) & 1].z);
+				glm::vec3 placed = glm::vec3(transforms[i] * glm::vec4(corner, 1.0f));
+				newMin = i == 0 && c == 0 ? placed : glm::min(newMin, placed);
+				newMax = i == 0 && c == 0 ? placed : glm::max(newMax, placed);
+			}
+		}
+		this->boundsMin = newMin;
+		this->boundsMax = newMax;
+		// the copies' vertices are not at hand any more, the sphere encloses the box
+		this->sphereCentre = (newMin + newMax) * 0.5f;
+		this->sphereRadius = glm::length(newMax - newMin) * 0.5f;
+
+		if (!this->instanceBuffer)
+			glGenBuffers(1, &this->instanceBuffer);
+		GLState& state = GLState::Get();
+		state.BindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::mat4), transforms, GL_STATIC_DRAW);
+		SetInstanceLayout();
+		state.BindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
 	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)
+	// Bindings are left in place for the next draw, the state tracker drops the ones that repeat
+	void Mesh::Draw(const gps::Shader& shader)
 	{
 		shader.useShaderProgram();
+		BindTextures();
 
-		//set textures
-		for (GLuint i = 0; i < textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		GLState::Get().BindVertexArray(this->buffers.VAO);
+		if (this->instances.empty()) {
+			glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0);
+			return;
 		}
+		glDrawElementsInstanced(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0, this->instances.size());
+		SetIdentityInstance();
+	}
+
+	void Mesh::DrawInstances(const gps::Shader& shader, GLuint vertexArray, GLsizei count) const
+	{
+		shader.useShaderProgram();
+		BindTextures();
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		GLState::Get().BindVertexArray(vertexArray);
+		glDrawElementsInstanced(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0, count);
+		// the current value of an attribute read from an array is undefined after the draw
+		SetIdentityInstance();
+	}
 
-        for(GLuint i = 0; i < this->textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+	// The samplers already point at the units, only the bindings change from mesh to mesh
+	void Mesh::BindTextures() const
+	{
+		GLState& state = GLState::Get();
 
-    }
+		GLuint bound[MESH_TEXTURE_UNITS] = {0, 0, 0};
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			if (this->textureUnits[i] < MESH_TEXTURE_UNITS)
+				bound[this->textureUnits[i]] = this->textures[i].id;
+		}
+		// a sampler this mesh has no texture for must not see the previous mesh's
+		for (GLuint unit = 0; unit < MESH_TEXTURE_UNITS; unit++)
+			state.BindTexture(unit, GL_TEXTURE_2D, bound[unit]);
+	}
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh(){
+	void Mesh::setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount){
+		this->instanceBuffer = 0;
+		this->vertexCount = vertexCount;
+		this->indexCount = indexCount;
+
+		// bounds survive the CPU copy
+		this->boundsMin = this->boundsMax = vertexCount ? vertexData[0].Position : glm::vec3(0.0f);
+		for (size_t i = 1; i < vertexCount; i++) {
+			this->boundsMin = glm::min(this->boundsMin, vertexData[i].Position);
+			this->boundsMax = glm::max(this->boundsMax, vertexData[i].Position);
+		}
+		// tighter than the box's half diagonal, measured to the vertices themselves
+		this->sphereCentre = (this->boundsMin + this->boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++) {
+			glm::vec3 offset = vertexData[i].Position - this->sphereCentre;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		this->sphereRadius = std::sqrt(radiusSquared);
+
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
 		glGenBuffers(1, &this->buffers.VBO);
 		glGenBuffers(1, &this->buffers.EBO);
 
-		glBindVertexArray(this->buffers.VAO);
+		GLState& state = GLState::Get();
+		state.BindVertexArray(this->buffers.VAO);
 		// Load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLuint), indexData, GL_STATIC_DRAW);
 
+		SetVertexLayout();
+
+		// later element buffer binds must not land in this VAO
+		state.BindVertexArray(0);
+	}
+
+	void Mesh::SetVertexLayout()
+	{
 		// Set the vertex attribute pointers
 		// Vertex Positions
 		glEnableVertexAttribArray(0);
@@ -65,7 +293,24 @@ namespace gps {
 		// Vertex Texture Coords
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+	}
 
-		glBindVertexArray(0);
+	void Mesh::SetInstanceLayout()
+	{
+		// a mat4 attribute takes one location per column
+		for (GLuint column = 0; column < 4; column++) {
+			GLuint attribute = INSTANCE_MATRIX_ATTRIBUTE + column;
+			glEnableVertexAttribArray(attribute);
+			glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(attribute, 1);
+		}
+	}
+
+	void Mesh::SetIdentityInstance()
+	{
+		glVertexAttrib4f(INSTANCE_MATRIX_ATTRIBUTE, 1.0f, 0.0f, 0.0f, 0.0f);
+		glVertexAttrib4f(INSTANCE_MATRIX_ATTRIBUTE + 1, 0.0f, 1.0f, 0.0f, 0.0f);
+		glVertexAttrib4f(INSTANCE_MATRIX_ATTRIBUTE + 2, 0.0f, 0.0f, 1.0f, 0.0f);
+		glVertexAttrib4f(INSTANCE_MATRIX_ATTRIBUTE + 3, 0.0f, 0.0f, 0.0f, 1.0f);
 	}
 }
@@ -12,6 +12,15 @@
 
 namespace gps {
 
+// First of the four vec4 attributes holding an instance's matrix columns
+const GLuint INSTANCE_MATRIX_ATTRIBUTE = 4;
+
+// Unit of each texture type - the samplers are pointed there once per program, see AttachSamplers
+const GLuint AMBIENT_TEXTURE_UNIT = 0;
+const GLuint DIFFUSE_TEXTURE_UNIT = 1;
+const GLuint SPECULAR_TEXTURE_UNIT = 2;
+const GLuint MESH_TEXTURE_UNITS = 3;
+
 struct Vertex
 {
     glm::vec3 Position;
@@ -34,6 +43,24 @@ struct Material
         glm::vec3 specular;
     };
 
+// Texture of a mesh that is not loaded yet - path is relative to the model folder
+struct TextureRef
+{
+    std::string type;
+    std::string path;
+};
+
+// CPU side geometry of one shape, before it is uploaded
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<TextureRef> textures;
+    int materialId;
+    // where copies of the geometry are placed, empty when it is drawn once as it is
+    std::vector<glm::mat4> instances;
+};
+
 struct Buffers {
     GLuint VAO;
     GLuint VBO;
@@ -43,23 +70,90 @@ struct Buffers {
 class Mesh
 {
 public:
-    std::vector<Vertex> vertices;
-    std::vector<GLuint> indices;
     std::vector<Texture> textures;
 
-	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	// Takes over the arrays - keepGeometry = false frees them once they are on the GPU
+	Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures, bool keepGeometry = true);
+
+	// Uploads the geometry straight from the given arrays, copying them only when keepGeometry is set
+	Mesh(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Texture> textures,
+		 bool keepGeometry = false);
 
-	Buffers getBuffers();
+	// Owns its GL objects - moved, never copied
+	Mesh(Mesh&& other) noexcept;
+	Mesh& operator=(Mesh&& other) noexcept;
+	~Mesh();
 
-	void Draw(gps::Shader shader);
+	Buffers getBuffers() const;
+
+	void Draw(const gps::Shader& shader);
+
+	// Places copies of the geometry, drawn with one instanced draw - the bounds grow to cover them all
+	void SetInstances(const glm::mat4* transforms, size_t count);
+	// Transforms of the copies, empty for a mesh drawn once
+	const std::vector<glm::mat4>& GetInstances() const;
+
+	// Draws count instances through vertexArray, a copy of this mesh's VAO with instance matrices attached
+	void DrawInstances(const gps::Shader& shader, GLuint vertexArray, GLsizei count) const;
+
+	// Binds the textures to the units of their types, the units of types it has none of to 0
+	void BindTextures() const;
+
+	// Points a program's texture samplers at their units - once after linking, they never change
+	static void AttachSamplers(const gps::Shader& shader);
+
+	// Points attributes 0-2 at the bound GL_ARRAY_BUFFER, laid out as Vertex
+	static void SetVertexLayout();
+
+	// Points the instance matrix attributes at the bound GL_ARRAY_BUFFER, one glm::mat4 per instance
+	static void SetInstanceLayout();
+
+	// Current value of the instance matrix attributes, read by every draw without instance data
+	static void SetIdentityInstance();
+
+	// CPU copy of the geometry, empty for GPU resident meshes
+	const std::vector<Vertex>& GetVertices() const;
+	const std::vector<GLuint>& GetIndices() const;
+	bool HasGeometry() const;
+	// Frees the CPU copy, the mesh keeps drawing from its buffers
+	void ReleaseGeometry();
+
+	size_t GetVertexCount() const;
+	size_t GetIndexCount() const;
+	// Object space bounding box
+	glm::vec3 GetBoundsMin() const;
+	glm::vec3 GetBoundsMax() const;
+	// Object space bounding sphere, around the box centre
+	glm::vec3 GetSphereCentre() const;
+	float GetSphereRadius() const;
 
 private:
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    // unit of each texture, from its type at construction - MESH_TEXTURE_UNITS for a type no shader samples
+    std::vector<GLuint> textureUnits;
+
     /*  Render data  */
     Buffers buffers;
+    std::vector<glm::mat4> instances;
+    // instance matrices, attached to the VAO once there are any
+    GLuint instanceBuffer;
+    GLsizei vertexCount;
+    GLsizei indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    glm::vec3 sphereCentre;
+    float sphereRadius;
 
 	// Initializes all the buffer objects/arrays
-	void setupMesh();
+	void setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount);
+
+	void deleteBuffers();
+
+	void assignTextureUnits();
 
+	Mesh(const Mesh&);
+	Mesh& operator=(const Mesh&);
 };
 
 }
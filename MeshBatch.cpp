@@ -0,0 +1,468 @@
+#include "MeshBatch.hpp"
+#include "DrawDataRing.hpp"
+#include "GLState.hpp"
+
+#include <map>
+
+namespace gps {
+
+    MeshBatch::MeshBatch() : VAO(0), VBO(0), EBO(0), indirectBuffer(0), culledBuffer(0), countBuffer(0), boundsBuffer(0),
+                             groupBuffer(0), frame(0), uploaded(false), staticBuffer(0), staticCulledBuffer(0),
+                             staticSlots(0), staticSlotCount(0), staticPacked(false), staticModel(1.0f),
+                             staticNormalMatrix(1.0f), staticFrame(0) {
+    }
+
+    MeshBatch::~MeshBatch() {
+        deleteBuffers();
+    }
+
+    MeshBatch::MeshBatch(MeshBatch&& other) noexcept
+        : VAO(other.VAO), VBO(other.VBO), EBO(other.EBO), indirectBuffer(other.indirectBuffer),
+          culledBuffer(other.culledBuffer), countBuffer(other.countBuffer), boundsBuffer(other.boundsBuffer),
+          groupBuffer(other.groupBuffer), commands(std::move(other.commands)),
+          commandMeshes(std::move(other.commandMeshes)), groups(std::move(other.groups)), frame(other.frame),
+          frameCommands(std::move(other.frameCommands)), submissions(std::move(other.submissions)),
+          uploaded(other.uploaded), staticBuffer(other.staticBuffer), staticCulledBuffer(other.staticCulledBuffer),
+          staticSlots(other.staticSlots), staticSlotCount(other.staticSlotCount), staticPacked(other.staticPacked),
+          staticModel(other.staticModel), staticNormalMatrix(other.staticNormalMatrix),
+          staticSkippedGroups(std::move(other.staticSkippedGroups)), staticFrame(other.staticFrame) {
+        other.VAO = other.VBO = other.EBO = other.indirectBuffer = 0;
+        other.culledBuffer = other.countBuffer = other.boundsBuffer = other.groupBuffer = 0;
+        other.staticBuffer = other.staticCulledBuffer = 0;
+        other.staticSlotCount = 0;
+        other.uploaded = false;
+    }
+
+    MeshBatch& MeshBatch::operator=(MeshBatch&& other) noexcept {
+        if (this != &other) {
+            deleteBuffers();
+            VAO = other.VAO;
+            VBO = other.VBO;
+            EBO = other.EBO;
+            indirectBuffer = other.indirectBuffer;
+            culledBuffer = other.culledBuffer;
+            countBuffer = other.countBuffer;
+            boundsBuffer = other.boundsBuffer;
+            groupBuffer = other.groupBuffer;
+            commands = std::move(other.commands);
+            commandMeshes = std::move(other.commandMeshes);
+            groups = std::move(other.groups);
+            frame = other.frame;
+            frameCommands = std::move(other.frameCommands);
+            submissions = std::move(other.submissions);
+            uploaded = other.uploaded;
+            staticBuffer = other.staticBuffer;
+            staticCulledBuffer = other.staticCulledBuffer;
+            staticSlots = other.staticSlots;
+            staticSlotCount = other.staticSlotCount;
+            staticPacked = other.staticPacked;
+            staticModel = other.staticModel;
+            staticNormalMatrix = other.staticNormalMatrix;
+            staticSkippedGroups = std::move(other.staticSkippedGroups);
+            staticFrame = other.staticFrame;
+            other.VAO = other.VBO = other.EBO = other.indirectBuffer = 0;
+            other.culledBuffer = other.countBuffer = other.boundsBuffer = other.groupBuffer = 0;
+            other.staticBuffer = other.staticCulledBuffer = 0;
+            other.staticSlotCount = 0;
+            other.uploaded = false;
+        }
+        return *this;
+    }
+
+    // glDelete* ignores the names of moved-from batches (0)
+    void MeshBatch::deleteBuffers() {
+        if (VAO) {
+            GLState::Get().ForgetVertexArray(VAO);
+        }
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &indirectBuffer);
+        glDeleteBuffers(1, &culledBuffer);
+        glDeleteBuffers(1, &countBuffer);
+        glDeleteBuffers(1, &boundsBuffer);
+        glDeleteBuffers(1, &groupBuffer);
+        glDeleteBuffers(1, &staticBuffer);
+        glDeleteBuffers(1, &staticCulledBuffer);
+        VAO = VBO = EBO = indirectBuffer = 0;
+        culledBuffer = countBuffer = boundsBuffer = groupBuffer = 0;
+        // the static commands are written again, the slots are kept for them
+        staticBuffer = staticCulledBuffer = 0;
+        uploaded = false;
+    }
+
+    bool MeshBatch::IsSupported() {
+        return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+    }
+
+    bool MeshBatch::IsBuilt() const {
+        return VAO != 0;
+    }
+
+    void MeshBatch::Build(const std::vector<Mesh>& meshes) {
+        deleteBuffers();
+        commands.clear();
+        commandMeshes.clear();
+        groups.clear();
+        frameCommands.clear();
+        submissions.clear();
+
+        // meshes with the same textures end up next to each other and share one multi-draw
+        std::map<std::vector<GLuint>, std::vector<size_t> > byTextures;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            std::vector<GLuint> key;
+            for (size_t t = 0; t < meshes[i].textures.size(); t++) {
+                key.push_back(meshes[i].textures[t].id);
+            }
+            byTextures[key].push_back(i);
+        }
+
+        size_t vertexTotal = 0;
+        size_t indexTotal = 0;
+        for (size_t i = 0; i < meshes.size(); i++) {
+            vertexTotal += meshes[i].GetVertexCount();
+            indexTotal += meshes[i].GetIndexCount();
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &indirectBuffer);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertexTotal * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, indexTotal * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+        // copied buffer to buffer, the meshes may have no CPU copy left
+        size_t vertexOffset = 0;
+        size_t indexOffset = 0;
+        std::map<std::vector<GLuint>, std::vector<size_t> >::const_iterator it;
+        for (it = byTextures.begin(); it != byTextures.end(); ++it) {
+            Group group;
+            group.mesh = it->second[0];
+            group.firstCommand = commands.size();
+            group.commandCount = it->second.size();
+            groups.push_back(group);
+
+            for (size_t m = 0; m < it->second.size(); m++) {
+                const Mesh& mesh = meshes[it->second[m]];
+                Buffers buffers = mesh.getBuffers();
+
+                glBindBuffer(GL_COPY_READ_BUFFER, buffers.VBO);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, vertexOffset * sizeof(Vertex),
+                                    mesh.GetVertexCount() * sizeof(Vertex));
+                glBindBuffer(GL_COPY_READ_BUFFER, buffers.EBO);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, indexOffset * sizeof(GLuint),
+                                    mesh.GetIndexCount() * sizeof(GLuint));
+
+                // indices stay relative to their mesh, baseVertex moves them into the shared buffer
+                DrawElementsCommand command;
+                command.count = mesh.GetIndexCount();
+                command.instanceCount = 1;
+                command.firstIndex = indexOffset;
+                command.baseVertex = vertexOffset;
+                command.baseInstance = 0;
+                commands.push_back(command);
+                commandMeshes.push_back(it->second[m]);
+
+                vertexOffset += mesh.GetVertexCount();
+                indexOffset += mesh.GetIndexCount();
+            }
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        GLState& state = GLState::Get();
+        state.BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        Mesh::SetVertexLayout();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+
+        // one value per instance, the base instance picks which
+        glBindBuffer(GL_ARRAY_BUFFER, DrawDataRing::GetShared().GetDrawIdBuffer());
+        glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+        glVertexAttribIPointer(DRAW_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+        glVertexAttribDivisor(DRAW_INDEX_ATTRIBUTE, 1);
+        state.BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // last frame's submissions were all drawn, their ranges start over
+    void MeshBatch::beginFrame() {
+        DrawDataRing& ring = DrawDataRing::GetShared();
+        if (frame != ring.GetFrame()) {
+            frame = ring.GetFrame();
+            frameCommands.clear();
+            submissions.clear();
+            uploaded = false;
+        }
+    }
+
+    // a group whose commands all have no instance is not drawn at all, its textures are not even bound
+    void MeshBatch::findSkippedGroups(const DrawElementsCommand* first, std::vector<bool>& skippedGroups) const {
+        skippedGroups.resize(groups.size());
+        for (size_t g = 0; g < groups.size(); g++) {
+            bool groupSkipped = true;
+            for (size_t i = groups[g].firstCommand; i < groups[g].firstCommand + groups[g].commandCount; i++) {
+                groupSkipped = groupSkipped && first[i].instanceCount == 0;
+            }
+            skippedGroups[g] = groupSkipped;
+        }
+    }
+
+    bool MeshBatch::Prepare(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                            const std::vector<bool>& skipped, size_t& submission) {
+        if (commands.empty()) {
+            return false;
+        }
+        beginFrame();
+        DrawDataRing& ring = DrawDataRing::GetShared();
+
+        // packed textures need a slot per mesh for its layers, bound ones share the model's slot
+        bool packed = materials.IsBuilt();
+        GLuint shared = packed ? 0 : ring.Push(model, normalMatrix, BoundTextureMaterial());
+        size_t first = frameCommands.size();
+        frameCommands.insert(frameCommands.end(), commands.begin(), commands.end());
+        for (size_t i = 0; i < commands.size(); i++) {
+            DrawElementsCommand& command = frameCommands[first + i];
+            size_t mesh = commandMeshes[i];
+            // a skipped mesh keeps its command, with no instance it draws nothing
+            command.instanceCount = mesh < skipped.size() && skipped[mesh] ? 0 : 1;
+            GLuint slot = shared;
+            if (packed && command.instanceCount) {
+                slot = ring.Push(model, normalMatrix, materials.GetMaterial(mesh));
+            }
+            if (slot == DrawDataRing::FULL) {
+                frameCommands.resize(first);
+                return false;
+            }
+            command.baseInstance = slot;
+        }
+
+        Submission added;
+        added.firstCommand = first;
+        added.isStatic = false;
+        added.culler = NULL;
+        added.model = model;
+        findSkippedGroups(&frameCommands[first], added.skippedGroups);
+        submission = submissions.size();
+        submissions.push_back(added);
+        uploaded = false;
+        return true;
+    }
+
+    bool MeshBatch::PrepareStatic(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                                  const std::vector<bool>& skipped, size_t& submission) {
+        if (commands.empty()) {
+            return false;
+        }
+        beginFrame();
+        // a second model drawing the batch would overwrite the first one's data
+        if (staticFrame == frame) {
+            return Prepare(materials, model, normalMatrix, skipped, submission);
+        }
+        bool current = staticBuffer && staticPacked == materials.IsBuilt() && staticModel == model &&
+                       staticNormalMatrix == normalMatrix;
+        if (!current && !writeStatic(materials, model, normalMatrix, skipped)) {
+            return Prepare(materials, model, normalMatrix, skipped, submission);
+        }
+        staticFrame = frame;
+
+        Submission added;
+        added.firstCommand = 0;
+        added.isStatic = true;
+        added.culler = NULL;
+        added.model = model;
+        submission = submissions.size();
+        submissions.push_back(added);
+        uploaded = false;
+        return true;
+    }
+
+    // The commands as Prepare would write them, uploaded to staticBuffer where every frame's cull reads them
+    bool MeshBatch::writeStatic(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                                const std::vector<bool>& skipped) {
+        DrawDataRing& ring = DrawDataRing::GetShared();
+        bool packed = materials.IsBuilt();
+        GLuint slotCount = packed ? commands.size() : 1;
+        // slots taken for another count are left behind, the ring does not take them back
+        if (slotCount != staticSlotCount) {
+            staticSlots = ring.Reserve(slotCount);
+            staticSlotCount = staticSlots == DrawDataRing::FULL ? 0 : slotCount;
+            if (!staticSlotCount) {
+                return false;
+            }
+        }
+
+        std::vector<DrawElementsCommand> written(commands);
+        std::vector<glm::vec4> slotMaterials(slotCount, BoundTextureMaterial());
+        for (size_t i = 0; i < written.size(); i++) {
+            size_t mesh = commandMeshes[i];
+            written[i].instanceCount = mesh < skipped.size() && skipped[mesh] ? 0 : 1;
+            written[i].baseInstance = staticSlots + (packed ? i : 0);
+            if (packed) {
+                slotMaterials[i] = materials.GetMaterial(mesh);
+            }
+        }
+        ring.Write(staticSlots, slotCount, model, normalMatrix, slotMaterials.data());
+        findSkippedGroups(written.data(), staticSkippedGroups);
+
+        if (!staticBuffer) {
+            glGenBuffers(1, &staticBuffer);
+            glGenBuffers(1, &staticCulledBuffer);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, staticBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, written.size() * sizeof(DrawElementsCommand), written.data(),
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, staticCulledBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, written.size() * sizeof(DrawElementsCommand), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        staticPacked = packed;
+        staticModel = model;
+        staticNormalMatrix = normalMatrix;
+        return true;
+    }
+
+    void MeshBatch::createCullBuffers(const std::vector<Mesh>& meshes) {
+        std::vector<glm::vec4> bounds;
+        std::vector<GLuint> commandGroups;
+        for (size_t g = 0; g < groups.size(); g++) {
+            for (size_t i = groups[g].firstCommand; i < groups[g].firstCommand + groups[g].commandCount; i++) {
+                const Mesh& mesh = meshes[commandMeshes[i]];
+                bounds.push_back(glm::vec4(mesh.GetBoundsMin(), 1.0f));
+                bounds.push_back(glm::vec4(mesh.GetBoundsMax(), 1.0f));
+                commandGroups.push_back(g);
+                commandGroups.push_back(groups[g].firstCommand);
+            }
+        }
+
+        glGenBuffers(1, &culledBuffer);
+        glGenBuffers(1, &countBuffer);
+        glGenBuffers(1, &boundsBuffer);
+        glGenBuffers(1, &groupBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, groupBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, commandGroups.size() * sizeof(GLuint), commandGroups.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        // sized with the frame's commands on the next upload
+        uploaded = false;
+    }
+
+    void MeshBatch::Cull(size_t submission, gps::GpuCuller& culler, const glm::mat4& model,
+                         const std::vector<Mesh>& meshes) {
+        if (submission >= submissions.size() || !culler.IsReady()) {
+            return;
+        }
+        if (!culledBuffer) {
+            createCullBuffers(meshes);
+        }
+        submissions[submission].culler = &culler;
+        submissions[submission].model = model;
+    }
+
+    // Every Prepare comes before the frame's first Draw, so the frame's commands go up in one upload.
+    // The culled commands and the counts get a place for every submission as well.
+    void MeshBatch::upload() {
+        if (uploaded) {
+            return;
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, frameCommands.size() * sizeof(DrawElementsCommand), frameCommands.data(),
+                     GL_STREAM_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        if (culledBuffer) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, frameCommands.size() * sizeof(DrawElementsCommand), NULL,
+                         GL_STREAM_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, submissions.size() * groups.size() * sizeof(GLuint), NULL,
+                         GL_STREAM_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        uploaded = true;
+    }
+
+    void MeshBatch::dispatchCull(size_t submission) {
+        const Submission& culled = submissions[submission];
+        GLuint source = culled.isStatic ? staticBuffer : indirectBuffer;
+        GLuint target = culled.isStatic ? staticCulledBuffer : culledBuffer;
+        // commands past a group's survivors stay zero, a plain multi-draw skips them
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, target);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, culled.firstCommand * sizeof(DrawElementsCommand),
+                             commands.size() * sizeof(DrawElementsCommand), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, submission * groups.size() * sizeof(GLuint),
+                             groups.size() * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        culled.culler->Dispatch(source, target, boundsBuffer, groupBuffer, countBuffer,
+                                culled.firstCommand, submission * groups.size(), commands.size(), culled.model);
+    }
+
+    // With the counts the GPU wrote only the group's survivors are read, otherwise its whole range
+    void MeshBatch::drawGroup(size_t submission, size_t group, bool counted) const {
+        size_t first = submissions[submission].firstCommand + groups[group].firstCommand;
+        const GLvoid* offset = (const GLvoid*)(first * sizeof(DrawElementsCommand));
+        if (counted) {
+            glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, offset,
+                                                (submission * groups.size() + group) * sizeof(GLuint),
+                                                groups[group].commandCount, 0);
+        } else {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, groups[group].commandCount, 0);
+        }
+    }
+
+    void MeshBatch::Draw(const gps::Shader& shader, const std::vector<Mesh>& meshes, const MaterialTable& materials,
+                         size_t submission) {
+        if (frame != DrawDataRing::GetShared().GetFrame() || submission >= submissions.size()) {
+            return;
+        }
+        upload();
+        // the cull program is bound in between, the draw state is set after it
+        const Submission& drawn = submissions[submission];
+        bool gpuCulled = drawn.culler != NULL;
+        if (gpuCulled) {
+            dispatchCull(submission);
+        }
+
+        shader.useShaderProgram();
+        GLState::Get().BindVertexArray(VAO);
+        bool counted = gpuCulled && GpuCuller::HasIndirectCount();
+        if (drawn.isStatic) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulled ? staticCulledBuffer : staticBuffer);
+        } else {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuCulled ? culledBuffer : indirectBuffer);
+        }
+        if (counted) {
+            glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+        }
+        if (materials.IsBuilt()) {
+            materials.Bind();
+        }
+        // the counts are per group, packed textures need no more than one multi-draw otherwise
+        if (materials.IsBuilt() && !counted) {
+            const GLvoid* offset = (const GLvoid*)(drawn.firstCommand * sizeof(DrawElementsCommand));
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, commands.size(), 0);
+        } else {
+            const std::vector<bool>& skippedGroups = drawn.isStatic ? staticSkippedGroups : drawn.skippedGroups;
+            for (size_t g = 0; g < groups.size(); g++) {
+                if (skippedGroups[g]) {
+                    continue;
+                }
+                if (!materials.IsBuilt()) {
+                    meshes[groups[g].mesh].BindTextures();
+                }
+                drawGroup(submission, g, counted);
+            }
+        }
+        if (counted) {
+            glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
@@ -0,0 +1,144 @@
+#ifndef MeshBatch_hpp
+#define MeshBatch_hpp
+
+#include <GL/glew.h>
+
+#include "Mesh.hpp"
+#include "MaterialTable.hpp"
+#include "Shader.hpp"
+#include "GpuCuller.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Layout glMultiDrawElementsIndirect reads from the indirect buffer
+    struct DrawElementsCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // All meshes of a model in one vertex and one index buffer, drawn with one
+    // glMultiDrawElementsIndirect per set of textures, or a single one once the textures are packed
+    // into a MaterialTable. The draw's base instance selects its DrawDataRing slot through the
+    // ring's draw id buffer.
+    // A batch may be submitted several times a frame, by one model drawn in several places or by models
+    // sharing the meshes: every Prepare appends its own range of commands to the frame's indirect buffer,
+    // and Draw is told which range to issue. A model that stays in place and is culled on the GPU takes
+    // PrepareStatic instead, whose commands and draw data are kept from frame to frame.
+    class MeshBatch
+    {
+    public:
+        MeshBatch();
+        ~MeshBatch();
+
+        MeshBatch(MeshBatch&& other) noexcept;
+        MeshBatch& operator=(MeshBatch&& other) noexcept;
+
+        // Copies the meshes' buffers on the GPU, the meshes stay usable on their own
+        void Build(const std::vector<Mesh>& meshes);
+        bool IsBuilt() const;
+
+        // Writes one draw's data to the DrawDataRing and appends its commands to this frame's, submission is
+        // what Draw takes to issue them. Meshes flagged in skipped (indexed like the meshes) are left out,
+        // they are drawn on their own. False when the ring is full.
+        bool Prepare(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                     const std::vector<bool>& skipped, size_t& submission);
+
+        // Prepare for a model that stays where it is and whose commands the GPU culls: the commands and draw
+        // data are written once, in their own buffer and in static DrawDataRing slots, so the CPU's part does
+        // not grow with the meshes. They are written again when the transform changes or the material table
+        // is built - skipped must not change in between. One per batch and frame, the next ones take Prepare.
+        bool PrepareStatic(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                           const std::vector<bool>& skipped, size_t& submission);
+
+        // Culls the submission's commands on the GPU right before Draw issues them.
+        // meshes must be the ones the batch was built from, their boxes are uploaded once.
+        void Cull(size_t submission, gps::GpuCuller& culler, const glm::mat4& model, const std::vector<Mesh>& meshes);
+
+        // Draws one submission of this frame. meshes must be the ones the batch was built from, they
+        // provide the textures until the material table is built from them too.
+        void Draw(const gps::Shader& shader, const std::vector<Mesh>& meshes, const MaterialTable& materials,
+                  size_t submission);
+
+        // Multi-draw indirect with base instances, core in GL 4.3
+        static bool IsSupported();
+
+    private:
+        // Consecutive commands sharing the textures of one mesh
+        struct Group {
+            size_t mesh;
+            size_t firstCommand;
+            size_t commandCount;
+        };
+
+        // One Prepare's commands, at firstCommand in the frame's commands
+        struct Submission {
+            size_t firstCommand;
+            // from PrepareStatic, the commands are the static ones
+            bool isStatic;
+            // groups whose meshes were all skipped, not drawn and their textures not bound - the static
+            // submission's are in staticSkippedGroups
+            std::vector<bool> skippedGroups;
+            // set by Cull
+            gps::GpuCuller* culler;
+            glm::mat4 model;
+        };
+
+        GLuint VAO;
+        GLuint VBO;
+        GLuint EBO;
+        // the frame's commands, uploaded by its first Draw
+        GLuint indirectBuffer;
+        // written by the GPU cull, at the same place as the commands they come from, and the per
+        // group counts of each submission
+        GLuint culledBuffer;
+        GLuint countBuffer;
+        // the boxes and groups of the commands the GPU cull reads, uploaded once
+        GLuint boundsBuffer;
+        GLuint groupBuffer;
+        // the commands of one draw of every mesh, with one instance
+        std::vector<DrawElementsCommand> commands;
+        // mesh each command draws
+        std::vector<size_t> commandMeshes;
+        std::vector<Group> groups;
+
+        // DrawDataRing frame the submissions belong to
+        uint64_t frame;
+        std::vector<DrawElementsCommand> frameCommands;
+        std::vector<Submission> submissions;
+        // frameCommands are in indirectBuffer, set by the frame's first Draw
+        bool uploaded;
+
+        // PrepareStatic's commands, and where the GPU cull packs their survivors
+        GLuint staticBuffer;
+        GLuint staticCulledBuffer;
+        // its DrawDataRing slots - one shared, or one per command with packed textures - and what they hold
+        GLuint staticSlots;
+        GLuint staticSlotCount;
+        bool staticPacked;
+        glm::mat4 staticModel;
+        glm::mat3 staticNormalMatrix;
+        std::vector<bool> staticSkippedGroups;
+        // frame of the last static submission
+        uint64_t staticFrame;
+
+        void deleteBuffers();
+        void createCullBuffers(const std::vector<Mesh>& meshes);
+        void findSkippedGroups(const DrawElementsCommand* first, std::vector<bool>& skippedGroups) const;
+        bool writeStatic(const MaterialTable& materials, const glm::mat4& model, const glm::mat3& normalMatrix,
+                         const std::vector<bool>& skipped);
+        void beginFrame();
+        void upload();
+        void dispatchCull(size_t submission);
+        void drawGroup(size_t submission, size_t group, bool counted) const;
+
+        MeshBatch(const MeshBatch&);
+        MeshBatch& operator=(const MeshBatch&);
+    };
+}
+
+#endif /* MeshBatch_hpp */
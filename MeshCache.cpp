@@ -0,0 +1,272 @@
+#include "MeshCache.hpp"
+#include "Hash.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace gps {
+
+    static const char MESH_CACHE_MAGIC[8] = {'G', 'P', 'S', 'M', 'E', 'S', 'H', '\0'};
+
+    struct MeshCache::Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t shapeCount;
+        uint64_t contentHash;
+        float weldEpsilon;
+        uint32_t vertexSize;
+        // 0 when the shapes were not merged into static batches
+        float batchCellSize;
+        // 1 when repeated shapes were turned into instances
+        uint32_t detectInstances;
+    };
+
+    struct MeshCache::ShapeEntry {
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        uint64_t textureOffset;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t textureCount;
+        int32_t materialId;
+        uint64_t instanceOffset;
+        uint32_t instanceCount;
+        uint32_t padding;
+    };
+
+    // Texture references are stored as length prefixed type and path strings
+    static size_t TextureRefSize(const TextureRef& texture) {
+        return 2 * sizeof(uint32_t) + texture.type.size() + texture.path.size();
+    }
+
+    static size_t AlignUp(size_t offset) {
+        return (offset + 15) & ~(size_t)15;
+    }
+
+    MeshCache::MeshCache() : header(NULL), shapeEntries(NULL) {
+    }
+
+    bool MeshCache::Open(const std::string& cacheFileName, uint64_t contentHash, float weldEpsilon, float batchCellSize,
+                         bool detectInstances) {
+        Close();
+        if (!file.Open(cacheFileName)) {
+            return false;
+        }
+
+        const char* data = file.GetData();
+        size_t size = file.GetSize();
+        if (size < sizeof(Header)) {
+            Close();
+            return false;
+        }
+
+        header = reinterpret_cast<const Header*>(data);
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 ||
+            header->version != MESH_CACHE_VERSION || header->contentHash != contentHash ||
+            header->weldEpsilon != weldEpsilon || header->batchCellSize != batchCellSize ||
+            header->detectInstances != (uint32_t)detectInstances ||
+            header->vertexSize != sizeof(Vertex) ||
+            sizeof(Header) + (uint64_t)header->shapeCount * sizeof(ShapeEntry) > size) {
+            Close();
+            return false;
+        }
+        shapeEntries = reinterpret_cast<const ShapeEntry*>(data + sizeof(Header));
+
+        // reject truncated files before anything points into them
+        for (size_t s = 0; s < header->shapeCount; s++) {
+            const ShapeEntry& entry = shapeEntries[s];
+            if (entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex) > size ||
+                entry.indexOffset + (uint64_t)entry.indexCount * sizeof(GLuint) > size ||
+                entry.instanceOffset + (uint64_t)entry.instanceCount * sizeof(glm::mat4) > size ||
+                entry.textureOffset > size) {
+                Close();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void MeshCache::Close() {
+        file.Close();
+        header = NULL;
+        shapeEntries = NULL;
+    }
+
+    size_t MeshCache::GetShapeCount() const {
+        return header ? header->shapeCount : 0;
+    }
+
+    const Vertex* MeshCache::GetVertices(size_t shape) const {
+        return reinterpret_cast<const Vertex*>(file.GetData() + shapeEntries[shape].vertexOffset);
+    }
+
+    size_t MeshCache::GetVertexCount(size_t shape) const {
+        return shapeEntries[shape].vertexCount;
+    }
+
+    const GLuint* MeshCache::GetIndices(size_t shape) const {
+        return reinterpret_cast<const GLuint*>(file.GetData() + shapeEntries[shape].indexOffset);
+    }
+
+    size_t MeshCache::GetIndexCount(size_t shape) const {
+        return shapeEntries[shape].indexCount;
+    }
+
+    int MeshCache::GetMaterialId(size_t shape) const {
+        return shapeEntries[shape].materialId;
+    }
+
+    const glm::mat4* MeshCache::GetInstances(size_t shape) const {
+        return reinterpret_cast<const glm::mat4*>(file.GetData() + shapeEntries[shape].instanceOffset);
+    }
+
+    size_t MeshCache::GetInstanceCount(size_t shape) const {
+        return shapeEntries[shape].instanceCount;
+    }
+
+    std::vector<TextureRef> MeshCache::GetTextures(size_t shape) const {
+        std::vector<TextureRef> textures;
+        const char* cursor = file.GetData() + shapeEntries[shape].textureOffset;
+        const char* end = file.GetData() + file.GetSize();
+
+        for (uint32_t t = 0; t < shapeEntries[shape].textureCount; t++) {
+            std::string* fields[2];
+            TextureRef texture;
+            fields[0] = &texture.type;
+            fields[1] = &texture.path;
+            for (int f = 0; f < 2; f++) {
+                uint32_t length;
+                if (end - cursor < (ptrdiff_t)sizeof(length)) {
+                    return textures;
+                }
+                memcpy(&length, cursor, sizeof(length));
+                cursor += sizeof(length);
+                if (end - cursor < (ptrdiff_t)length) {
+                    return textures;
+                }
+                fields[f]->assign(cursor, length);
+                cursor += length;
+            }
+            textures.push_back(texture);
+        }
+        return textures;
+    }
+
+    bool MeshCache::Write(const std::string& cacheFileName, uint64_t contentHash, float weldEpsilon, float batchCellSize,
+                          bool detectInstances, const std::vector<MeshData>& shapes) {
+        Header header;
+        memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+        header.version = MESH_CACHE_VERSION;
+        header.shapeCount = shapes.size();
+        header.contentHash = contentHash;
+        header.weldEpsilon = weldEpsilon;
+        header.vertexSize = sizeof(Vertex);
+        header.batchCellSize = batchCellSize;
+        header.detectInstances = detectInstances;
+
+        // lay out the shape arrays after the header and the shape table
+        std::vector<ShapeEntry> entries(shapes.size());
+        size_t offset = sizeof(Header) + shapes.size() * sizeof(ShapeEntry);
+        for (size_t s = 0; s < shapes.size(); s++) {
+            offset = AlignUp(offset);
+            entries[s].vertexOffset = offset;
+            entries[s].vertexCount = shapes[s].vertices.size();
+            offset += shapes[s].vertices.size() * sizeof(Vertex);
+
+            offset = AlignUp(offset);
+            entries[s].indexOffset = offset;
+            entries[s].indexCount = shapes[s].indices.size();
+            offset += shapes[s].indices.size() * sizeof(GLuint);
+
+            offset = AlignUp(offset);
+            entries[s].instanceOffset = offset;
+            entries[s].instanceCount = shapes[s].instances.size();
+            entries[s].padding = 0;
+            offset += shapes[s].instances.size() * sizeof(glm::mat4);
+
+            entries[s].textureOffset = offset;
+            entries[s].textureCount = shapes[s].textures.size();
+            for (size_t t = 0; t < shapes[s].textures.size(); t++) {
+                offset += TextureRefSize(shapes[s].textures[t]);
+            }
+            entries[s].materialId = shapes[s].materialId;
+        }
+
+        std::vector<char> buffer(offset, 0);
+        memcpy(&buffer[0], &header, sizeof(Header));
+        if (!entries.empty()) {
+            memcpy(&buffer[sizeof(Header)], &entries[0], entries.size() * sizeof(ShapeEntry));
+        }
+        for (size_t s = 0; s < shapes.size(); s++) {
+            if (!shapes[s].vertices.empty()) {
+                memcpy(&buffer[entries[s].vertexOffset], &shapes[s].vertices[0], shapes[s].vertices.size() * sizeof(Vertex));
+            }
+            if (!shapes[s].indices.empty()) {
+                memcpy(&buffer[entries[s].indexOffset], &shapes[s].indices[0], shapes[s].indices.size() * sizeof(GLuint));
+            }
+            if (!shapes[s].instances.empty()) {
+                memcpy(&buffer[entries[s].instanceOffset], &shapes[s].instances[0], shapes[s].instances.size() * sizeof(glm::mat4));
+            }
+            char* cursor = &buffer[0] + entries[s].textureOffset;
+            for (size_t t = 0; t < shapes[s].textures.size(); t++) {
+                const std::string* fields[2] = {&shapes[s].textures[t].type, &shapes[s].textures[t].path};
+                for (int f = 0; f < 2; f++) {
+                    uint32_t length = fields[f]->size();
+                    memcpy(cursor, &length, sizeof(length));
+                    cursor += sizeof(length);
+                    memcpy(cursor, fields[f]->data(), length);
+                    cursor += length;
+                }
+            }
+        }
+
+        // a reader never sees a half written cache
+        std::string tempFileName = cacheFileName + ".tmp";
+        FILE* out = fopen(tempFileName.c_str(), "wb");
+        if (!out) {
+            return false;
+        }
+        bool written = fwrite(&buffer[0], 1, buffer.size(), out) == buffer.size();
+        written = fclose(out) == 0 && written;
+        if (!written || rename(tempFileName.c_str(), cacheFileName.c_str()) != 0) {
+            remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool MeshCache::HashSource(const std::string& fileName, const std::string& basePath, uint64_t& contentHash) {
+        MappedFile source;
+        if (!source.Open(fileName)) {
+            return false;
+        }
+        const char* data = source.GetData();
+        size_t size = source.GetSize();
+        contentHash = HashBytes(data, size);
+
+        // material libraries feed the texture references, so they are part of the key
+        const char* end = data + size;
+        for (const char* line = data; line < end; ) {
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+            if (!lineEnd) {
+                lineEnd = end;
+            }
+            if (lineEnd - line > 7 && strncmp(line, "mtllib", 6) == 0 && (line[6] == ' ' || line[6] == '\t')) {
+                const char* name = line + 7;
+                const char* nameEnd = lineEnd;
+                while (nameEnd > name && (nameEnd[-1] == '\r' || nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) {
+                    nameEnd--;
+                }
+                MappedFile library;
+                std::string libraryName(name, nameEnd);
+                contentHash = HashBytes(libraryName.data(), libraryName.size(), contentHash);
+                if (library.Open(basePath + libraryName)) {
+                    contentHash = HashBytes(library.GetData(), library.GetSize(), contentHash);
+                }
+            }
+            line = lineEnd + 1;
+        }
+        return true;
+    }
+}
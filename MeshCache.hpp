@@ -0,0 +1,57 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Bump whenever the loader changes the geometry it produces, so stale caches get rebuilt
+    const uint32_t MESH_CACHE_VERSION = 4;
+
+    // Binary copy of the final per-shape vertex/index arrays of an OBJ file, stored next to it.
+    // Opening the cache maps the file so the arrays can be handed to glBufferData as they are.
+    class MeshCache
+    {
+    public:
+        MeshCache();
+
+        // Maps the cache and checks it was written by this loader version for the given source content
+        // and load settings
+        bool Open(const std::string& cacheFileName, uint64_t contentHash, float weldEpsilon, float batchCellSize,
+                  bool detectInstances);
+        void Close();
+
+        size_t GetShapeCount() const;
+        const Vertex* GetVertices(size_t shape) const;
+        size_t GetVertexCount(size_t shape) const;
+        const GLuint* GetIndices(size_t shape) const;
+        size_t GetIndexCount(size_t shape) const;
+        int GetMaterialId(size_t shape) const;
+        std::vector<TextureRef> GetTextures(size_t shape) const;
+        // Transforms of the shape's copies, none when it is drawn once
+        const glm::mat4* GetInstances(size_t shape) const;
+        size_t GetInstanceCount(size_t shape) const;
+
+        // Writes the shapes to a temporary file and moves it over cacheFileName
+        static bool Write(const std::string& cacheFileName, uint64_t contentHash, float weldEpsilon, float batchCellSize,
+                          bool detectInstances, const std::vector<MeshData>& shapes);
+
+        // Hashes an OBJ file together with the .mtl libraries it references
+        static bool HashSource(const std::string& fileName, const std::string& basePath, uint64_t& contentHash);
+
+    private:
+        struct Header;
+        struct ShapeEntry;
+
+        MappedFile file;
+        const Header* header;
+        const ShapeEntry* shapeEntries;
+    };
+}
+
+#endif /* MeshCache_hpp */
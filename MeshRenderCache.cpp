@@ -0,0 +1,38 @@
+#include "MeshRenderCache.hpp"
+
+namespace gps {
+
+    MeshRenderCache& MeshRenderCache::Get() {
+        // never destroyed, so global models can still release into it at exit
+        static MeshRenderCache* cache = new MeshRenderCache();
+        return *cache;
+    }
+
+    MeshRenderCache::MeshRenderCache() {
+    }
+
+    uint64_t MeshRenderCache::Key(MeshHandle handle) {
+        return ((uint64_t)handle.index << 32) | handle.generation;
+    }
+
+    MeshRenderData& MeshRenderCache::Acquire(MeshHandle handle) {
+        Entry& entry = entries[Key(handle)];
+        entry.refCount++;
+        return entry.data;
+    }
+
+    MeshRenderData* MeshRenderCache::Find(MeshHandle handle) {
+        std::unordered_map<uint64_t, Entry>::iterator found = entries.find(Key(handle));
+        return found == entries.end() ? NULL : &found->second.data;
+    }
+
+    void MeshRenderCache::Release(MeshHandle handle) {
+        if (!handle.IsValid()) {
+            return;
+        }
+        std::unordered_map<uint64_t, Entry>::iterator found = entries.find(Key(handle));
+        if (found != entries.end() && --found->second.refCount == 0) {
+            entries.erase(found);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef MeshRenderCache_hpp
+#define MeshRenderCache_hpp
+
+#include "AssetRegistry.hpp"
+#include "MeshBatch.hpp"
+#include "MaterialTable.hpp"
+#include "Frustum.hpp"
+#include "OcclusionRasterizer.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // What the renderer derives from one MeshSet, shared by every model drawing it
+    struct MeshRenderData {
+        // the meshes packed for multi-draw, built on first draw once the set is complete
+        MeshBatch batch;
+        // their textures packed into arrays, tried once nothing is loading any more
+        MaterialTable materials;
+        bool materialsTried = false;
+        // object space bounds of the meshes for frustum culling, extended as they are uploaded
+        BoundsList bounds;
+        // CPU copies of the meshes picked to hide others in the software occlusion test
+        std::vector<OccluderMesh> occluders;
+        // per mesh, drawn blended for a translucent diffuse texture
+        std::vector<bool> blended;
+        // per mesh, drawn on its own outside the batch - blended, or instanced with copies found by FindInstances
+        std::vector<bool> ownDraw;
+        // the meshes with ownDraw set
+        std::vector<size_t> ownDrawMeshes;
+        // box around every mesh, the batch sorts by its centre
+        glm::vec3 boundsMin = glm::vec3(0.0f);
+        glm::vec3 boundsMax = glm::vec3(0.0f);
+        // the above stop changing once the set and its textures are loaded, they are not redone then
+        bool flagsFinal = false;
+    };
+
+    // Render side caches of the registry's mesh sets, keyed by MeshHandle. Models acquire an entry next to
+    // the meshes themselves, so the registry only holds meshes and textures. GL thread only.
+    class MeshRenderCache
+    {
+    public:
+        static MeshRenderCache& Get();
+
+        // Adds a reference, the entry is created empty the first time
+        MeshRenderData& Acquire(MeshHandle handle);
+        // NULL once every model acquiring it has released it
+        MeshRenderData* Find(MeshHandle handle);
+        // Deletes the entry with its GL objects when the last reference goes
+        void Release(MeshHandle handle);
+
+    private:
+        MeshRenderCache();
+
+        struct Entry {
+            MeshRenderData data;
+            uint32_t refCount = 0;
+        };
+
+        // references to the entries stay valid while others are added
+        std::unordered_map<uint64_t, Entry> entries;
+
+        static uint64_t Key(MeshHandle handle);
+
+        MeshRenderCache(const MeshRenderCache&);
+        MeshRenderCache& operator=(const MeshRenderCache&);
+    };
+}
+
+#endif /* MeshRenderCache_hpp */
@@ -1,27 +1,772 @@
 #include "Model3D.hpp"
+#include "MeshRenderCache.hpp"
+#include "MeshCache.hpp"
+#include "ObjParser.hpp"
+#include "ThreadPool.hpp"
+#include "TextureStreamer.hpp"
+#include "GLTaskQueue.hpp"
+#include "GLState.hpp"
+#include "DrawDataRing.hpp"
+#include "Hash.hpp"
+#include "StaticBatch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace gps {
 
+	// Identifies a face corner by the index triple tinyobj produced for it
+	struct VertexKey {
+		int vertex_index;
+		int normal_index;
+		int texcoord_index;
+
+		bool operator==(const VertexKey& other) const {
+			return vertex_index == other.vertex_index && normal_index == other.normal_index && texcoord_index == other.texcoord_index;
+		}
+	};
+
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey& key) const {
+			size_t h = (size_t)key.vertex_index * 73856093u;
+			h ^= (size_t)key.normal_index * 19349663u;
+			h ^= (size_t)key.texcoord_index * 83492791u;
+			return h;
+		}
+	};
+
+	// Position, normal and texture coordinates snapped to the weld epsilon grid
+	struct QuantizedVertex {
+		long long q[8];
+
+		bool operator==(const QuantizedVertex& other) const {
+			for (int i = 0; i < 8; i++) {
+				if (q[i] != other.q[i])
+					return false;
+			}
+			return true;
+		}
+	};
+
+	struct QuantizedVertexHash {
+		size_t operator()(const QuantizedVertex& vertex) const {
+			size_t h = 1469598103934665603ull;
+			for (int i = 0; i < 8; i++) {
+				h = (h ^ (size_t)vertex.q[i]) * 1099511628211ull;
+			}
+			return h;
+		}
+	};
+
 	void Model3D::LoadModel(std::string fileName)
 	{
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)
 	{
-		ReadOBJ(fileName, basePath);
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		DeleteInstanceArrays();
+		ReleaseOcclusionNodes();
+		gps::MeshRenderCache::Get().Release(meshHandle);
+		registry.ReleaseMeshes(meshHandle);
+
+		// another model already loaded this file - share its meshes
+		meshHandle = registry.AcquireMeshes(fileName);
+		if (meshHandle.IsValid()) {
+			gps::MeshRenderCache::Get().Acquire(meshHandle);
+			std::cout << "Reusing : " << fileName << std::endl;
+			return;
+		}
+
+		gps::MeshCache cache;
+		std::vector<gps::MeshData> shapes;
+		// a file that cannot be read leaves the model empty
+		bool cached = false;
+		ReadShapeData(fileName, basePath, cache, shapes, cached);
+		size_t shapeCount = cached ? cache.GetShapeCount() : shapes.size();
+
+		std::vector<std::vector<gps::TextureRef> > shapeTextures(shapeCount);
+		std::vector<gps::TextureRef> allTextures;
+		for (size_t s = 0; s < shapeCount; s++) {
+			shapeTextures[s] = cached ? cache.GetTextures(s) : shapes[s].textures;
+			allTextures.insert(allTextures.end(), shapeTextures[s].begin(), shapeTextures[s].end());
+		}
+		PreloadTextures(allTextures, basePath);
+
+		gps::MeshSet meshSet;
+		std::vector<gps::OccluderMesh> occluders;
+		for (size_t s = 0; s < shapeCount; s++) {
+			std::vector<gps::Texture> textures = LoadTextures(shapeTextures[s], basePath);
+			if (cached) {
+				AddOccluder(occluders, cache.GetVertices(s), cache.GetVertexCount(s), cache.GetIndices(s),
+							cache.GetIndexCount(s), occluderMaxTriangles, occluderMinSize, cache.GetInstances(s),
+							cache.GetInstanceCount(s));
+				// the cache is mapped and its arrays go straight to the GPU
+				meshSet.meshes.push_back(gps::Mesh(cache.GetVertices(s), cache.GetVertexCount(s),
+												   cache.GetIndices(s), cache.GetIndexCount(s), textures, keepGeometry));
+				meshSet.meshes.back().SetInstances(cache.GetInstances(s), cache.GetInstanceCount(s));
+			} else {
+				AddOccluder(occluders, shapes[s].vertices.data(), shapes[s].vertices.size(), shapes[s].indices.data(),
+							shapes[s].indices.size(), occluderMaxTriangles, occluderMinSize, shapes[s].instances.data(),
+							shapes[s].instances.size());
+				meshSet.meshes.push_back(gps::Mesh(std::move(shapes[s].vertices), std::move(shapes[s].indices), textures, keepGeometry));
+				meshSet.meshes.back().SetInstances(shapes[s].instances.data(), shapes[s].instances.size());
+			}
+		}
+
+		meshSet.textures.swap(textureHandles);
+		meshSet.complete = true;
+		meshHandle = registry.AddMeshes(fileName, std::move(meshSet));
+		gps::MeshRenderCache::Get().Acquire(meshHandle).occluders.swap(occluders);
+	}
+
+	// Shape data of a model loaded in the background, kept alive by the tasks uploading it
+	struct Model3D::PendingModel {
+		gps::MeshCache cache;
+		std::vector<gps::MeshData> shapes;
+		size_t shapeCount;
+		bool cached;
+		bool keepGeometry;
+		size_t occluderMaxTriangles;
+		float occluderMinSize;
+		std::string basePath;
+		gps::MeshHandle meshHandle;
+	};
+
+	void Model3D::LoadModelAsync(std::string fileName)
+	{
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		DeleteInstanceArrays();
+		ReleaseOcclusionNodes();
+		gps::MeshRenderCache::Get().Release(meshHandle);
+		registry.ReleaseMeshes(meshHandle);
+
+		meshHandle = registry.AcquireMeshes(fileName);
+		if (meshHandle.IsValid()) {
+			gps::MeshRenderCache::Get().Acquire(meshHandle);
+			std::cout << "Reusing : " << fileName << std::endl;
+			return;
+		}
+
+		// registered empty right away, so models of the same file share it while it fills up
+		meshHandle = registry.AddMeshes(fileName, gps::MeshSet());
+		gps::MeshRenderCache::Get().Acquire(meshHandle);
+
+		std::shared_ptr<PendingModel> pending(new PendingModel());
+		pending->basePath = basePath;
+		pending->keepGeometry = keepGeometry;
+		pending->occluderMaxTriangles = occluderMaxTriangles;
+		pending->occluderMinSize = occluderMinSize;
+		pending->meshHandle = meshHandle;
+
+		gps::GLTaskQueue::GetShared().Retain();
+		gps::ThreadPool::GetShared().Enqueue([this, fileName, pending]() {
+			pending->cached = false;
+			bool read = ReadShapeData(fileName, pending->basePath, pending->cache, pending->shapes, pending->cached);
+			pending->shapeCount = pending->cached ? pending->cache.GetShapeCount() : pending->shapes.size();
+
+			gps::GLTaskQueue& queue = gps::GLTaskQueue::GetShared();
+			// nothing to upload, the set is finished empty so the model is not left loading forever
+			if (!read || pending->shapeCount == 0) {
+				queue.Post([pending]() {
+					gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(pending->meshHandle);
+					if (meshSet)
+						meshSet->complete = true;
+				});
+			}
+			// one shape per task, so a large model does not stall a frame
+			for (size_t s = 0; s < pending->shapeCount; s++) {
+				queue.Post([pending, s]() {
+					UploadShapeAsync(*pending, s);
+				});
+			}
+			queue.Release();
+		});
+	}
+
+	// Runs on the GL thread once the shape data is ready
+	void Model3D::UploadShapeAsync(PendingModel& pending, size_t shape)
+	{
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		gps::MeshSet* meshSet = registry.GetMeshes(pending.meshHandle);
+		gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(pending.meshHandle);
+		if (!meshSet || !renderData) {
+			// every model using it was released before it finished loading
+			return;
+		}
+
+		std::vector<gps::TextureRef> textureRefs = pending.cached ? pending.cache.GetTextures(shape) : pending.shapes[shape].textures;
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < textureRefs.size(); i++) {
+			gps::Texture currentTexture;
+			currentTexture.path = pending.basePath + textureRefs[i].path;
+			currentTexture.type = textureRefs[i].type;
+			gps::TextureHandle handle = LoadTextureAsync(currentTexture.path);
+			currentTexture.id = registry.GetTexture(handle);
+			meshSet->textures.push_back(handle);
+			textures.push_back(currentTexture);
+		}
+
+		if (pending.cached) {
+			AddOccluder(renderData->occluders, pending.cache.GetVertices(shape), pending.cache.GetVertexCount(shape),
+						pending.cache.GetIndices(shape), pending.cache.GetIndexCount(shape), pending.occluderMaxTriangles,
+						pending.occluderMinSize, pending.cache.GetInstances(shape), pending.cache.GetInstanceCount(shape));
+			meshSet->meshes.push_back(gps::Mesh(pending.cache.GetVertices(shape), pending.cache.GetVertexCount(shape),
+												pending.cache.GetIndices(shape), pending.cache.GetIndexCount(shape), textures,
+												pending.keepGeometry));
+			meshSet->meshes.back().SetInstances(pending.cache.GetInstances(shape), pending.cache.GetInstanceCount(shape));
+		} else {
+			gps::MeshData& data = pending.shapes[shape];
+			AddOccluder(renderData->occluders, data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size(),
+						pending.occluderMaxTriangles, pending.occluderMinSize, data.instances.data(), data.instances.size());
+			meshSet->meshes.push_back(gps::Mesh(std::move(data.vertices), std::move(data.indices), textures, pending.keepGeometry));
+			meshSet->meshes.back().SetInstances(data.instances.data(), data.instances.size());
+		}
+		meshSet->complete = meshSet->meshes.size() == pending.shapeCount;
+	}
+
+	// Maps a valid cache, or parses the .obj file and refreshes the cache - touches no GL state
+	bool Model3D::ReadShapeData(std::string fileName, std::string basePath, gps::MeshCache& cache,
+								std::vector<gps::MeshData>& shapes, bool& cached)
+	{
+		cached = false;
+		std::string cacheFileName = fileName + ".meshcache";
+		uint64_t contentHash = 0;
+		bool hashed = gps::MeshCache::HashSource(fileName, basePath, contentHash);
+
+		if (hashed && cache.Open(cacheFileName, contentHash, weldEpsilon, batchCellSize, detectInstances)) {
+			std::cout << "Loading : " << cacheFileName << std::endl;
+			std::cout << (batchCellSize > 0.0f ? "# of batches   : " : "# of shapes    : ") << cache.GetShapeCount() << std::endl;
+			cached = true;
+			return true;
+		}
+
+		if (!ReadOBJ(fileName, basePath, shapes)) {
+			shapes.clear();
+			return false;
+		}
+
+		// the cache stores the merged shapes, so later loads map the batches directly
+		if (batchCellSize > 0.0f) {
+			size_t shapeCount = shapes.size();
+			MergeStaticBatches(shapes);
+			std::cout << "# of batches   : " << shapes.size() << " (from " << shapeCount << " shapes)" << std::endl;
+		}
+
+		if (hashed && !gps::MeshCache::Write(cacheFileName, contentHash, weldEpsilon, batchCellSize, detectInstances, shapes)) {
+			fprintf(stderr, "WARNING: could not write mesh cache %s\n", cacheFileName.c_str());
+		}
+		return true;
+	}
+
+	void Model3D::SetWeldEpsilon(float epsilon)
+	{
+		weldEpsilon = epsilon;
+	}
+
+	void Model3D::SetInstanceDetection(bool detect)
+	{
+		detectInstances = detect;
+	}
+
+	void Model3D::SetStaticBatching(float cellSize)
+	{
+		batchCellSize = cellSize > 0.0f ? cellSize : 0.0f;
+	}
+
+	void Model3D::SetOccluders(size_t maxTriangles, float minSize)
+	{
+		occluderMaxTriangles = maxTriangles;
+		occluderMinSize = minSize;
+	}
+
+	void Model3D::SetOcclusionRasterizer(gps::OcclusionRasterizer* rasterizer)
+	{
+		occlusionRasterizer = rasterizer;
+	}
+
+	void Model3D::AddOccluder(std::vector<gps::OccluderMesh>& occluders, const gps::Vertex* vertices, size_t vertexCount,
+							  const GLuint* indices, size_t indexCount, size_t maxTriangles, float minSize,
+							  const glm::mat4* instances, size_t instanceCount)
+	{
+		if (maxTriangles == 0 || vertexCount == 0)
+			return;
+		gps::OccluderMesh occluder;
+		if (gps::MakeOccluder(&vertices[0].Position, sizeof(gps::Vertex), vertexCount, indices, indexCount,
+							  maxTriangles, minSize, occluder)) {
+			occluder.placements.assign(instances, instances + instanceCount);
+			occluders.push_back(std::move(occluder));
+		}
+	}
+
+	void Model3D::AddOccluders(gps::OcclusionRasterizer& rasterizer, const glm::mat4& model) const
+	{
+		const gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(meshHandle);
+		if (!renderData)
+			return;
+		for (size_t i = 0; i < renderData->occluders.size(); i++) {
+			const gps::OccluderMesh& occluder = renderData->occluders[i];
+			if (occluder.placements.empty())
+				rasterizer.AddOccluder(model, occluder);
+			for (size_t p = 0; p < occluder.placements.size(); p++)
+				rasterizer.AddOccluder(model * occluder.placements[p], occluder);
+		}
+	}
+
+	void Model3D::SetKeepGeometry(bool keep)
+	{
+		keepGeometry = keep;
+	}
+
+	void Model3D::SetBatched(bool batched)
+	{
+		this->batched = batched;
+	}
+
+	void Model3D::SetMaterialArrays(bool materialArrays)
+	{
+		this->materialArrays = materialArrays;
+	}
+
+	bool Model3D::TriedMaterialArrays() const
+	{
+		const gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(meshHandle);
+		return renderData && renderData->materialsTried;
+	}
+
+	bool Model3D::UsesMaterialArrays() const
+	{
+		const gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(meshHandle);
+		return renderData && renderData->materials.IsBuilt();
+	}
+
+	// A mesh is blended when its diffuse texture has translucent texels
+	static bool IsBlended(const gps::Mesh& mesh)
+	{
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		for (size_t t = 0; t < mesh.textures.size(); t++)
+			if (mesh.textures[t].type == "diffuseTexture" && registry.IsTextureTranslucent(mesh.textures[t].id))
+				return true;
+		return false;
+	}
+
+	// Blended and own draw flags and the batch box change while meshes and textures arrive, afterwards
+	// they are kept - a mesh's copies are fixed when it is created
+	static void UpdateMeshFlags(const gps::MeshSet& meshSet, gps::MeshRenderData& renderData)
+	{
+		if (renderData.flagsFinal)
+			return;
+		const std::vector<gps::Mesh>& meshes = meshSet.meshes;
+		renderData.blended.resize(meshes.size());
+		renderData.ownDraw.resize(meshes.size());
+		renderData.ownDrawMeshes.clear();
+		for (size_t i = 0; i < meshes.size(); i++) {
+			renderData.blended[i] = IsBlended(meshes[i]);
+			renderData.ownDraw[i] = renderData.blended[i] || !meshes[i].GetInstances().empty();
+			if (renderData.ownDraw[i])
+				renderData.ownDrawMeshes.push_back(i);
+		}
+		if (!meshes.empty()) {
+			renderData.boundsMin = meshes[0].GetBoundsMin();
+			renderData.boundsMax = meshes[0].GetBoundsMax();
+			for (size_t i = 1; i < meshes.size(); i++) {
+				renderData.boundsMin = glm::min(renderData.boundsMin, meshes[i].GetBoundsMin());
+				renderData.boundsMax = glm::max(renderData.boundsMax, meshes[i].GetBoundsMax());
+			}
+		}
+		// translucency is known once every texture is decoded
+		renderData.flagsFinal = meshSet.complete && gps::GLTaskQueue::GetShared().IsIdle() &&
+								gps::TextureStreamer::GetShared().IsIdle();
+	}
+
+	// Sorting material of a mesh drawn on its own - the first texture it binds
+	static GLuint MaterialKey(const gps::Mesh& mesh)
+	{
+		return mesh.textures.empty() ? 0 : mesh.textures[0].id;
+	}
+
+	static glm::vec3 BoundsCentre(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+	{
+		return glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+	}
+
+	void Model3D::DrawBatchPacket(const gps::DrawPacket& packet)
+	{
+		Model3D* model = static_cast<Model3D*>(packet.object);
+		gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(model->meshHandle);
+		gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(model->meshHandle);
+		renderData->batch.Draw(*packet.shader, meshSet->meshes, renderData->materials, packet.item);
+	}
+
+	static void DrawMeshPacket(const gps::DrawPacket& packet)
+	{
+		gps::MeshSet* meshSet = static_cast<gps::MeshSet*>(packet.object);
+		// a current attribute value, not VAO state
+		glVertexAttribI1ui(gps::DRAW_INDEX_ATTRIBUTE, packet.drawIndex);
+		meshSet->meshes[packet.item].Draw(*packet.shader);
+	}
+
+	void Model3D::DrawInstancedPacket(const gps::DrawPacket& packet)
+	{
+		Model3D* model = static_cast<Model3D*>(packet.object);
+		gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(model->meshHandle);
+		const InstanceArray& instances = model->instanceArrays[packet.item];
+		// a current attribute value, not VAO state
+		glVertexAttribI1ui(gps::DRAW_INDEX_ATTRIBUTE, packet.drawIndex);
+		meshSet->meshes[packet.item].DrawInstances(*packet.shader, instances.vertexArray, instances.count);
+	}
+
+	// Only drawn if its box passed this frame, the query issued at the start of PASS_OCCLUSION
+	void Model3D::DrawConditionalPacket(const gps::DrawPacket& packet)
+	{
+		Model3D* model = static_cast<Model3D*>(packet.object);
+		gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(model->meshHandle);
+		uint32_t node = model->occlusionNodes[packet.item];
+		model->occlusionCuller->BeginConditional(node);
+		glVertexAttribI1ui(gps::DRAW_INDEX_ATTRIBUTE, packet.drawIndex);
+		meshSet->meshes[packet.item].Draw(*packet.shader);
+		model->occlusionCuller->EndConditional(node);
+	}
+
+	void Model3D::SetOcclusionCuller(gps::OcclusionCuller* culler)
+	{
+		ReleaseOcclusionNodes();
+		occlusionCuller = culler;
+	}
+
+	void Model3D::SetGpuCuller(gps::GpuCuller* culler)
+	{
+		gpuCuller = culler;
+	}
+
+	void Model3D::SetSceneVisibility(const uint8_t* visible, size_t count)
+	{
+		sceneVisible = visible;
+		sceneVisibleCount = visible ? count : 0;
+	}
+
+	void Model3D::ReleaseOcclusionNodes()
+	{
+		for (size_t i = 0; i < occlusionNodes.size(); i++)
+			occlusionCuller->ReleaseNode(occlusionNodes[i]);
+		occlusionNodes.clear();
+	}
+
+	void Model3D::SetInstances(const std::vector<glm::mat4>& transforms)
+	{
+		// rebuilt on the next Submit, meshes with copies multiply their buffers by the new transforms
+		DeleteInstanceArrays();
+		instanceTransforms = transforms;
+		if (transforms.empty())
+			return;
+
+		glm::vec3 centre(0.0f);
+		for (size_t i = 0; i < transforms.size(); i++)
+			centre += glm::vec3(transforms[i][3]);
+		instanceCentre = centre / (float)transforms.size();
+
+		if (!instanceBuffer)
+			glGenBuffers(1, &instanceBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	size_t Model3D::GetInstanceCount() const
+	{
+		return instanceTransforms.size();
+	}
+
+	bool Model3D::IsLoaded() const
+	{
+		const gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(meshHandle);
+		return meshSet && meshSet->complete;
+	}
+
+	size_t Model3D::AppendBounds(const glm::mat4& model, std::vector<gps::BVHItem>& items) const
+	{
+		const gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(meshHandle);
+		if (!meshSet)
+			return 0;
+
+		size_t first = items.size();
+		size_t instances = std::max<size_t>(instanceTransforms.size(), 1);
+		for (size_t instance = 0; instance < instances; instance++) {
+			glm::mat4 placement = instanceTransforms.empty() ? model : model * instanceTransforms[instance];
+			for (size_t i = 0; i < meshSet->meshes.size(); i++) {
+				gps::BVHItem item;
+				gps::TransformBounds(meshSet->meshes[i].GetBoundsMin(), meshSet->meshes[i].GetBoundsMax(), placement,
+									 item.boundsMin, item.boundsMax);
+				items.push_back(item);
+			}
+		}
+		return items.size() - first;
+	}
+
+	// Meshes only ever get appended while loading, so the arrays built so far stay valid
+	void Model3D::UpdateInstanceArrays(const gps::MeshSet& meshSet)
+	{
+		gps::GLState& state = gps::GLState::Get();
+		while (instanceArrays.size() < meshSet.meshes.size()) {
+			const gps::Mesh& mesh = meshSet.meshes[instanceArrays.size()];
+			const std::vector<glm::mat4>& copies = mesh.GetInstances();
+			InstanceArray instances;
+			instances.copyBuffer = 0;
+			instances.count = instanceTransforms.size();
+			if (!copies.empty()) {
+				// the copies' placement is applied first, the model instance's after it
+				std::vector<glm::mat4> combined;
+				combined.reserve(instanceTransforms.size() * copies.size());
+				for (size_t i = 0; i < instanceTransforms.size(); i++)
+					for (size_t c = 0; c < copies.size(); c++)
+						combined.push_back(instanceTransforms[i] * copies[c]);
+				glGenBuffers(1, &instances.copyBuffer);
+				glBindBuffer(GL_ARRAY_BUFFER, instances.copyBuffer);
+				glBufferData(GL_ARRAY_BUFFER, combined.size() * sizeof(glm::mat4), combined.data(), GL_STATIC_DRAW);
+				instances.count = combined.size();
+			}
+
+			gps::Buffers buffers = mesh.getBuffers();
+			glGenVertexArrays(1, &instances.vertexArray);
+			state.BindVertexArray(instances.vertexArray);
+			glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+			gps::Mesh::SetVertexLayout();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.EBO);
+			glBindBuffer(GL_ARRAY_BUFFER, instances.copyBuffer ? instances.copyBuffer : instanceBuffer);
+			gps::Mesh::SetInstanceLayout();
+			state.BindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			instanceArrays.push_back(instances);
+		}
+	}
+
+	void Model3D::DeleteInstanceArrays()
+	{
+		for (size_t i = 0; i < instanceArrays.size(); i++) {
+			gps::GLState::Get().ForgetVertexArray(instanceArrays[i].vertexArray);
+			glDeleteVertexArrays(1, &instanceArrays[i].vertexArray);
+			glDeleteBuffers(1, &instanceArrays[i].copyBuffer);
+		}
+		instanceArrays.clear();
+	}
+
+	// Queue each mesh from the model
+	void Model3D::Submit(gps::RenderQueue& queue, const gps::Shader& shaderProgram, const glm::mat4& model,
+						 const glm::mat3& normalMatrix)
+	{
+		gps::MeshSet* meshSet = gps::AssetRegistry::Get().GetMeshes(meshHandle);
+		gps::MeshRenderData* renderData = gps::MeshRenderCache::Get().Find(meshHandle);
+		if (!meshSet || !renderData)
+			return;
+
+		UpdateMeshFlags(*meshSet, *renderData);
+		const std::vector<bool>& blended = renderData->blended;
+		// meshes with copies of their own are drawn instanced outside the batch, like the blended ones
+		const std::vector<bool>& ownDraw = renderData->ownDraw;
+
+		gps::DrawPacket packet;
+		packet.shader = &shaderProgram;
+		packet.object = meshSet;
+		packet.item = 0;
+		packet.drawIndex = 0;
+
+		// every mesh draws all instances at once, they share the model's slot for the base transform
+		if (!instanceTransforms.empty()) {
+			if (sceneVisibleCount == meshSet->meshes.size() * instanceTransforms.size() &&
+				std::find(sceneVisible, sceneVisible + sceneVisibleCount, 1) == sceneVisible + sceneVisibleCount) {
+				queue.CountCulled(meshSet->meshes.size(), meshSet->meshes.size());
+				return;
+			}
+			UpdateInstanceArrays(*meshSet);
+			packet.drawIndex = gps::DrawDataRing::GetShared().Push(model, normalMatrix, gps::BoundTextureMaterial());
+			if (packet.drawIndex == gps::DrawDataRing::FULL)
+				return;
+			packet.object = this;
+			packet.draw = DrawInstancedPacket;
+			float depth = queue.ViewDepth(glm::vec3(model * glm::vec4(instanceCentre, 1.0f)));
+			for (size_t i = 0; i < meshSet->meshes.size(); i++) {
+				packet.key = gps::RenderQueue::MakeKey(blended[i] ? gps::PASS_BLENDED : gps::PASS_OPAQUE,
+													   shaderProgram.shaderProgram, MaterialKey(meshSet->meshes[i]), depth);
+				packet.item = i;
+				queue.Submit(packet);
+			}
+			return;
+		}
+
+		// the batch keeps its commands for the GPU to cull, which needs the final ownDraw flags
+		bool useBatch = batched && meshSet->complete && gps::MeshBatch::IsSupported();
+		if (useBatch && gpuCuller && gpuCuller->IsReady() && renderData->flagsFinal) {
+			SubmitGpuCulled(queue, shaderProgram, model, normalMatrix, *meshSet, *renderData);
+			return;
+		}
+
+		// planes in object space, so the bounds are tested as they are stored
+		while (renderData->bounds.count < meshSet->meshes.size()) {
+			const gps::Mesh& mesh = meshSet->meshes[renderData->bounds.count];
+			renderData->bounds.Add(mesh.GetBoundsMin(), mesh.GetBoundsMax(), mesh.GetSphereCentre(), mesh.GetSphereRadius());
+		}
+		std::vector<uint8_t>& visible = submitVisible;
+		size_t visibleCount = 0;
+		if (sceneVisibleCount == meshSet->meshes.size()) {
+			// the scene BVH has culled the meshes already, in world space
+			visible.assign(sceneVisible, sceneVisible + sceneVisibleCount);
+			visibleCount = std::count(visible.begin(), visible.end(), 1);
+		} else {
+			gps::Frustum frustum;
+			frustum.Extract(queue.GetViewProjection() * model);
+			visible.resize(renderData->bounds.count);
+			visibleCount = frustum.Cull(renderData->bounds, visible.data());
+		}
+		queue.CountCulled(meshSet->meshes.size(), meshSet->meshes.size() - visibleCount);
+		if (visibleCount == 0)
+			return;
+
+		// boxes the rasterized occluders hide everywhere are culled like those outside the frustum
+		if (occlusionRasterizer) {
+			glm::mat4 modelViewProjection = occlusionRasterizer->GetViewProjection() * model;
+			for (size_t i = 0; i < meshSet->meshes.size(); i++) {
+				const gps::Mesh& mesh = meshSet->meshes[i];
+				if (visible[i] && !occlusionRasterizer->IsVisible(modelViewProjection, mesh.GetBoundsMin(), mesh.GetBoundsMax())) {
+					visible[i] = 0;
+					visibleCount--;
+				}
+			}
+			if (visibleCount == 0)
+				return;
+		}
+
+		// meshes hidden at their last occlusion test are drawn on their own, if this frame's query passes
+		std::vector<bool>& conditional = submitConditional;
+		conditional.assign(meshSet->meshes.size(), false);
+		if (occlusionCuller) {
+			while (occlusionNodes.size() < meshSet->meshes.size())
+				occlusionNodes.push_back(occlusionCuller->AddNode());
+			for (size_t i = 0; i < meshSet->meshes.size(); i++) {
+				const gps::Mesh& mesh = meshSet->meshes[i];
+				conditional[i] = visible[i] &&
+					!occlusionCuller->Test(occlusionNodes[i], model, mesh.GetBoundsMin(), mesh.GetBoundsMax());
+			}
+		}
+
+		// culled meshes keep their batch command, with no instance
+		std::vector<bool>& skipped = submitSkipped;
+		skipped.resize(meshSet->meshes.size());
+		for (size_t i = 0; i < meshSet->meshes.size(); i++)
+			skipped[i] = ownDraw[i] || !visible[i] || conditional[i];
+
+		// while it is still loading the meshes are drawn one by one
+		if (useBatch) {
+			PrepareBatch(*meshSet, *renderData);
+			// the packet draws this submission's commands, whatever else is submitted from the batch
+			if (!renderData->batch.Prepare(renderData->materials, model, normalMatrix, skipped, packet.item))
+				return;
+			if (gpuCuller && gpuCuller->IsReady())
+				renderData->batch.Cull(packet.item, *gpuCuller, model, meshSet->meshes);
+
+			// the batch sorts as a whole, by the centre of all its meshes
+			packet.key = gps::RenderQueue::MakeKey(gps::PASS_OPAQUE, shaderProgram.shaderProgram, 0,
+												   queue.ViewDepth(BoundsCentre(renderData->boundsMin, renderData->boundsMax, model)));
+			packet.draw = DrawBatchPacket;
+			packet.object = this;
+			queue.Submit(packet);
+			packet.object = meshSet;
+		}
+
+		// the meshes drawn on their own share one slot
+		bool pushed = false;
+		for (size_t i = 0; i < meshSet->meshes.size(); i++) {
+			if (!visible[i] || (useBatch && !ownDraw[i] && !conditional[i]))
+				continue;
+			if (!pushed) {
+				packet.drawIndex = gps::DrawDataRing::GetShared().Push(model, normalMatrix, gps::BoundTextureMaterial());
+				if (packet.drawIndex == gps::DrawDataRing::FULL)
+					return;
+				pushed = true;
+			}
+			const gps::Mesh& mesh = meshSet->meshes[i];
+			float depth = queue.ViewDepth(BoundsCentre(mesh.GetBoundsMin(), mesh.GetBoundsMax(), model));
+			gps::RenderPass pass = blended[i] ? gps::PASS_BLENDED : conditional[i] ? gps::PASS_OCCLUSION : gps::PASS_OPAQUE;
+			packet.key = gps::RenderQueue::MakeKey(pass, shaderProgram.shaderProgram, MaterialKey(mesh), depth);
+			packet.draw = conditional[i] ? DrawConditionalPacket : DrawMeshPacket;
+			packet.object = conditional[i] ? (void*)this : (void*)meshSet;
+			packet.item = i;
+			queue.Submit(packet);
+		}
+	}
+
+	void Model3D::PrepareBatch(const gps::MeshSet& meshSet, gps::MeshRenderData& renderData)
+	{
+		if (!renderData.batch.IsBuilt())
+			renderData.batch.Build(meshSet.meshes);
+		// textures still streaming in would be copied half done
+		if (materialArrays && !renderData.materialsTried && gps::MaterialTable::IsSupported() &&
+			gps::GLTaskQueue::GetShared().IsIdle() && gps::TextureStreamer::GetShared().IsIdle()) {
+			renderData.materialsTried = true;
+			renderData.materials.Build(meshSet.meshes);
+		}
 	}
 
-	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram)
+	// The model's box is tested and the batch left to the GPU, with the commands and draw data it keeps -
+	// only the meshes drawn on their own are looked at one by one
+	void Model3D::SubmitGpuCulled(gps::RenderQueue& queue, const gps::Shader& shaderProgram, const glm::mat4& model,
+								  const glm::mat3& normalMatrix, gps::MeshSet& meshSet, gps::MeshRenderData& renderData)
 	{
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+		gps::Frustum frustum;
+		frustum.Extract(queue.GetViewProjection() * model);
+		if (!frustum.IsVisible(renderData.boundsMin, renderData.boundsMax)) {
+			queue.CountCulled(meshSet.meshes.size(), meshSet.meshes.size());
+			return;
+		}
+
+		gps::DrawPacket packet;
+		packet.shader = &shaderProgram;
+		packet.drawIndex = 0;
+		PrepareBatch(meshSet, renderData);
+		if (!renderData.batch.PrepareStatic(renderData.materials, model, normalMatrix, renderData.ownDraw, packet.item))
+			return;
+		renderData.batch.Cull(packet.item, *gpuCuller, model, meshSet.meshes);
+		packet.key = gps::RenderQueue::MakeKey(gps::PASS_OPAQUE, shaderProgram.shaderProgram, 0,
+											   queue.ViewDepth(BoundsCentre(renderData.boundsMin, renderData.boundsMax, model)));
+		packet.draw = DrawBatchPacket;
+		packet.object = this;
+		queue.Submit(packet);
+
+		// the batch's meshes are counted by the GPU culler
+		size_t culled = 0;
+		bool pushed = false;
+		packet.draw = DrawMeshPacket;
+		packet.object = &meshSet;
+		for (size_t o = 0; o < renderData.ownDrawMeshes.size(); o++) {
+			size_t i = renderData.ownDrawMeshes[o];
+			const gps::Mesh& mesh = meshSet.meshes[i];
+			if (!frustum.IsVisible(mesh.GetBoundsMin(), mesh.GetBoundsMax())) {
+				culled++;
+				continue;
+			}
+			if (!pushed) {
+				packet.drawIndex = gps::DrawDataRing::GetShared().Push(model, normalMatrix, gps::BoundTextureMaterial());
+				if (packet.drawIndex == gps::DrawDataRing::FULL)
+					break;
+				pushed = true;
+			}
+			float depth = queue.ViewDepth(BoundsCentre(mesh.GetBoundsMin(), mesh.GetBoundsMax(), model));
+			packet.key = gps::RenderQueue::MakeKey(renderData.blended[i] ? gps::PASS_BLENDED : gps::PASS_OPAQUE,
+												   shaderProgram.shaderProgram, MaterialKey(mesh), depth);
+			packet.item = i;
+			queue.Submit(packet);
+		}
+		queue.CountCulled(renderData.ownDrawMeshes.size(), culled);
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath){
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& shapeData){
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -30,24 +775,34 @@ namespace gps {
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = gps::LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
 
 		if (!err.empty()) { // `err` may contain warning message.
 			std::cerr << err << std::endl;
 		}
 
+		// this can run on a loader thread, the caller decides what an unreadable model means
 		if (!ret) {
-			exit(1);
+			fprintf(stderr, "ERROR: could not load %s\n", fileName.c_str());
+			return false;
 		}
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		size_t totalCorners = 0;
+		size_t totalVertices = 0;
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 			std::vector<gps::Vertex> vertices;
 			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			std::vector<gps::TextureRef> textures;
+
+			// face corners sharing the same index triple become one vertex
+			std::unordered_map<VertexKey, GLuint, VertexKeyHash> weldedVertices;
+			weldedVertices.reserve(shapes[s].mesh.indices.size());
+			indices.reserve(shapes[s].mesh.indices.size());
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -62,12 +817,24 @@ namespace gps {
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+					VertexKey key = {idx.vertex_index, idx.normal_index, idx.texcoord_index};
+					auto welded = weldedVertices.find(key);
+					if (welded != weldedVertices.end()) {
+						indices.push_back(welded->second);
+						continue;
+					}
+
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
-					float nx = attrib.normals[3 * idx.normal_index + 0];
-					float ny = attrib.normals[3 * idx.normal_index + 1];
-					float nz = attrib.normals[3 * idx.normal_index + 2];
+					float nx = 0.0f;
+					float ny = 0.0f;
+					float nz = 0.0f;
+					if (idx.normal_index != -1) {
+						nx = attrib.normals[3 * idx.normal_index + 0];
+						ny = attrib.normals[3 * idx.normal_index + 1];
+						nz = attrib.normals[3 * idx.normal_index + 2];
+					}
 					float tx = 0.0f;
 					float ty = 0.0f;
 					if (idx.texcoord_index != -1) {
@@ -84,17 +851,28 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
+					GLuint vertexIndex = vertices.size();
+					weldedVertices[key] = vertexIndex;
 					vertices.push_back(currentVertex);
 
-					indices.push_back(index_offset + v);
+					indices.push_back(vertexIndex);
 				}
 
 				index_offset += fv;
 			}
 
+			// different index triples may still carry (nearly) identical attributes
+			if (weldEpsilon > 0.0f) {
+				WeldByEpsilon(vertices, indices);
+			}
+
+			totalCorners += indices.size();
+			totalVertices += vertices.size();
+
 			// get material id
 			// Only try to read materials if the .mtl file is present
 			int a = shapes[s].mesh.material_ids.size();
+			materialId = -1;
 			if (a > 0 && materials.size()>0) {
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
@@ -107,8 +885,9 @@ namespace gps {
 					std::string ambientTexturePath = materials[materialId].ambient_texname;
 					if (!ambientTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
+						gps::TextureRef currentTexture;
+						currentTexture.type = "ambientTexture";
+						currentTexture.path = ambientTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -116,8 +895,9 @@ namespace gps {
 					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
 					if (!diffuseTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
+						gps::TextureRef currentTexture;
+						currentTexture.type = "diffuseTexture";
+						currentTexture.path = diffuseTexturePath;
 						textures.push_back(currentTexture);
 					}
 
@@ -125,109 +905,485 @@ namespace gps {
 					std::string specularTexturePath = materials[materialId].specular_texname;
 					if (!specularTexturePath.empty())
 					{
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
+						gps::TextureRef currentTexture;
+						currentTexture.type = "specularTexture";
+						currentTexture.path = specularTexturePath;
 						textures.push_back(currentTexture);
 					}
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			shapeData.push_back(gps::MeshData());
+			shapeData.back().vertices.swap(vertices);
+			shapeData.back().indices.swap(indices);
+			shapeData.back().textures.swap(textures);
+			shapeData.back().materialId = materialId;
+		}
+
+		std::cout << "# of vertices  : " << totalCorners << " -> " << totalVertices
+			<< " (" << totalCorners * sizeof(gps::Vertex) << " -> " << totalVertices * sizeof(gps::Vertex) << " bytes)" << std::endl;
+
+		// props baked into the scene several times keep one copy of their geometry
+		if (detectInstances) {
+			FindInstances(shapeData);
+		}
+		return true;
+	}
+
+	// Size of the cells copies are gathered in when the shapes are not batched
+	static const float INSTANCE_CELL_SIZE = 25.0f;
+
+	// Everything about a shape that a rigid transform leaves alone - copies exported from the same
+	// prop keep their vertex order, indices, texture coordinates and material
+	static uint64_t PoseInvariantHash(const gps::MeshData& shape)
+	{
+		uint64_t vertexCount = shape.vertices.size();
+		uint64_t hash = gps::HashBytes(&vertexCount, sizeof(vertexCount));
+		hash = gps::HashBytes(&shape.materialId, sizeof(shape.materialId), hash);
+		if (!shape.indices.empty())
+			hash = gps::HashBytes(&shape.indices[0], shape.indices.size() * sizeof(GLuint), hash);
+		for (size_t v = 0; v < shape.vertices.size(); v++)
+			hash = gps::HashBytes(&shape.vertices[v].TexCoords, sizeof(glm::vec2), hash);
+		return hash;
+	}
+
+	// Pose of a shape: its centroid and an orthonormal frame through two of its vertices. The vertices are
+	// picked on the first copy and the same ones are used on the others, so matching copies get matching frames.
+	struct ShapePose {
+		glm::vec3 centroid;
+		glm::mat3 axes;
+	};
+
+	static glm::vec3 Centroid(const std::vector<gps::Vertex>& vertices)
+	{
+		glm::vec3 sum(0.0f);
+		for (size_t v = 0; v < vertices.size(); v++)
+			sum += vertices[v].Position;
+		return sum / (float)vertices.size();
+	}
+
+	static bool PoseFrom(const std::vector<gps::Vertex>& vertices, size_t first, size_t second, ShapePose& pose)
+	{
+		pose.centroid = Centroid(vertices);
+		glm::vec3 a = vertices[first].Position - pose.centroid;
+		glm::vec3 b = vertices[second].Position - pose.centroid;
+		glm::vec3 normal = glm::cross(a, b);
+		if (glm::length(a) < 1e-6f || glm::length(normal) < 1e-6f * glm::dot(a, a))
+			return false;
+		glm::vec3 x = glm::normalize(a);
+		glm::vec3 z = glm::normalize(normal);
+		pose.axes = glm::mat3(x, glm::cross(z, x), z);
+		return true;
+	}
+
+	// Farthest vertex from the centroid, then the one farthest off that axis - the most stable frame
+	static bool ChooseFrameVertices(const std::vector<gps::Vertex>& vertices, size_t& first, size_t& second)
+	{
+		glm::vec3 centroid = Centroid(vertices);
+		first = 0;
+		float farthest = -1.0f;
+		for (size_t v = 0; v < vertices.size(); v++) {
+			glm::vec3 offset = vertices[v].Position - centroid;
+			if (glm::dot(offset, offset) > farthest) {
+				farthest = glm::dot(offset, offset);
+				first = v;
+			}
+		}
+		glm::vec3 axis = vertices[first].Position - centroid;
+		second = first;
+		float widest = 0.0f;
+		for (size_t v = 0; v < vertices.size(); v++) {
+			glm::vec3 offAxis = glm::cross(axis, vertices[v].Position - centroid);
+			if (glm::dot(offAxis, offAxis) > widest) {
+				widest = glm::dot(offAxis, offAxis);
+				second = v;
+			}
+		}
+		return second != first;
+	}
+
+	// Finds the rotation and translation taking the reference's vertices onto the copy's and checks every
+	// vertex and normal lands where it should
+	static bool MatchRigid(const gps::MeshData& reference, const ShapePose& referencePose, size_t first, size_t second,
+						   float tolerance, const gps::MeshData& copy, glm::mat4& transform)
+	{
+		ShapePose copyPose;
+		if (!PoseFrom(copy.vertices, first, second, copyPose))
+			return false;
+
+		glm::mat3 rotation = copyPose.axes * glm::transpose(referencePose.axes);
+		glm::vec3 translation = copyPose.centroid - rotation * referencePose.centroid;
+		for (size_t v = 0; v < reference.vertices.size(); v++) {
+			const gps::Vertex& from = reference.vertices[v];
+			const gps::Vertex& to = copy.vertices[v];
+			if (glm::length(rotation * from.Position + translation - to.Position) > tolerance ||
+				glm::length(rotation * from.Normal - to.Normal) > 1e-3f)
+				return false;
+		}
+
+		transform = glm::mat4(rotation);
+		transform[3] = glm::vec4(translation, 1.0f);
+		return true;
+	}
+
+	// Shapes that are rigid transforms of an earlier one in the same cell are dropped, the earlier one gets an
+	// instance per copy. Copies are only gathered from one cell so the instanced mesh keeps tight bounds, copies
+	// spread over the whole map would make a box that is never culled.
+	void Model3D::FindInstances(std::vector<gps::MeshData>& shapeData)
+	{
+		float cellSize = batchCellSize > 0.0f ? batchCellSize : INSTANCE_CELL_SIZE;
+		struct Reference {
+			size_t shape;
+			ShapePose pose;
+			size_t first;
+			size_t second;
+			float tolerance;
+		};
+		std::unordered_map<uint64_t, std::vector<Reference> > references;
+		std::vector<bool> isCopy(shapeData.size(), false);
+		size_t copyCount = 0;
+		size_t savedBytes = 0;
+
+		for (size_t s = 0; s < shapeData.size(); s++) {
+			gps::MeshData& shape = shapeData[s];
+			if (shape.vertices.size() < 3)
+				continue;
+
+			glm::vec3 centroid = Centroid(shape.vertices);
+			long long cell[3] = {(long long)std::floor(centroid.x / cellSize), (long long)std::floor(centroid.y / cellSize),
+								 (long long)std::floor(centroid.z / cellSize)};
+			std::vector<Reference>& candidates = references[gps::HashBytes(cell, sizeof(cell), PoseInvariantHash(shape))];
+			glm::mat4 transform;
+			bool matched = false;
+			for (size_t c = 0; c < candidates.size() && !matched; c++) {
+				Reference& reference = candidates[c];
+				gps::MeshData& original = shapeData[reference.shape];
+				if (MatchRigid(original, reference.pose, reference.first, reference.second, reference.tolerance, shape, transform)) {
+					if (original.instances.empty())
+						original.instances.push_back(glm::mat4(1.0f));
+					original.instances.push_back(transform);
+					matched = true;
+				}
+			}
+			if (matched) {
+				isCopy[s] = true;
+				copyCount++;
+				savedBytes += shape.vertices.size() * sizeof(gps::Vertex) + shape.indices.size() * sizeof(GLuint);
+				continue;
+			}
+
+			// the first of its kind, later copies are placed relative to it
+			Reference reference;
+			reference.shape = s;
+			if (!ChooseFrameVertices(shape.vertices, reference.first, reference.second) ||
+				!PoseFrom(shape.vertices, reference.first, reference.second, reference.pose))
+				continue;
+			glm::vec3 extent = shape.vertices[reference.first].Position - reference.pose.centroid;
+			reference.tolerance = 1e-4f * glm::length(extent) + 1e-5f;
+			candidates.push_back(reference);
+		}
+
+		if (copyCount == 0)
+			return;
+		size_t kept = 0;
+		for (size_t s = 0; s < shapeData.size(); s++) {
+			if (!isCopy[s]) {
+				if (kept != s)
+					shapeData[kept] = std::move(shapeData[s]);
+				kept++;
+			}
 		}
+		shapeData.resize(kept);
+		std::cout << "# of instances : " << copyCount << " shapes drawn as copies (" << savedBytes << " bytes saved)" << std::endl;
+	}
+
+	// Appends the shapes of each batch GroupStaticBatches picks to its first one, indices are moved past
+	// the vertices already in the batch
+	void Model3D::MergeStaticBatches(std::vector<gps::MeshData>& shapes)
+	{
+		std::vector<gps::BatchShape> batchShapes(shapes.size());
+		for (size_t s = 0; s < shapes.size(); s++) {
+			const gps::MeshData& shape = shapes[s];
+			gps::BatchShape& batchShape = batchShapes[s];
+			batchShape.materialId = shape.materialId;
+			// instanced shapes are placed by their transforms, merging them would undo the sharing
+			batchShape.mergeable = !shape.vertices.empty() && shape.instances.empty();
+			batchShape.boundsMin = batchShape.boundsMax = glm::vec3(0.0f);
+			if (!batchShape.mergeable)
+				continue;
+			batchShape.boundsMin = shape.vertices[0].Position;
+			batchShape.boundsMax = shape.vertices[0].Position;
+			for (size_t v = 1; v < shape.vertices.size(); v++) {
+				batchShape.boundsMin = glm::min(batchShape.boundsMin, shape.vertices[v].Position);
+				batchShape.boundsMax = glm::max(batchShape.boundsMax, shape.vertices[v].Position);
+			}
+		}
+		std::vector<size_t> batchOf;
+		gps::GroupStaticBatches(batchShapes, batchCellSize, batchOf);
+
+		// the first shape of a batch is taken as it is, textures included
+		std::vector<size_t> slot(shapes.size());
+		std::vector<gps::MeshData> batches;
+		for (size_t s = 0; s < shapes.size(); s++) {
+			gps::MeshData& shape = shapes[s];
+			if (shape.vertices.empty())
+				continue;
+			if (batchOf[s] == s) {
+				slot[s] = batches.size();
+				batches.push_back(std::move(shape));
+				continue;
+			}
+
+			gps::MeshData& batch = batches[slot[batchOf[s]]];
+			GLuint baseVertex = batch.vertices.size();
+			batch.vertices.insert(batch.vertices.end(), shape.vertices.begin(), shape.vertices.end());
+			batch.indices.reserve(batch.indices.size() + shape.indices.size());
+			for (size_t i = 0; i < shape.indices.size(); i++)
+				batch.indices.push_back(shape.indices[i] + baseVertex);
+		}
+
+		shapes.swap(batches);
+	}
+
+	// Merges vertices whose position, normal and texture coordinates fall in the same weldEpsilon sized cell
+	void Model3D::WeldByEpsilon(std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices) {
+		std::unordered_map<QuantizedVertex, GLuint, QuantizedVertexHash> cells;
+		cells.reserve(vertices.size());
+		std::vector<GLuint> remap(vertices.size());
+		std::vector<gps::Vertex> merged;
+		merged.reserve(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const float* attributes = &vertices[i].Position.x;
+			QuantizedVertex cell;
+			for (int a = 0; a < 8; a++) {
+				cell.q[a] = (long long)std::floor(attributes[a] / weldEpsilon + 0.5f);
+			}
+
+			auto found = cells.find(cell);
+			if (found != cells.end()) {
+				remap[i] = found->second;
+			} else {
+				remap[i] = merged.size();
+				cells[cell] = remap[i];
+				merged.push_back(vertices[i]);
+			}
+		}
+
+		for (size_t i = 0; i < indices.size(); i++) {
+			indices[i] = remap[indices[i]];
+		}
+		vertices.swap(merged);
+	}
+
+	// Decodes all textures that are not loaded yet on the thread pool, then uploads them here
+	void Model3D::PreloadTextures(const std::vector<gps::TextureRef>& textureRefs, std::string basePath) {
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		std::vector<gps::TextureRef> pending;
+		std::unordered_set<std::string> seen;
+		for (size_t i = 0; i < textureRefs.size(); i++) {
+			std::string path = basePath + textureRefs[i].path;
+			if (!seen.insert(path).second || registry.HasTexture(path)) {
+				continue;
+			}
+			gps::TextureRef texture;
+			texture.type = textureRefs[i].type;
+			texture.path = path;
+			pending.push_back(texture);
+		}
+		if (pending.empty()) {
+			return;
+		}
+
+		gps::ThreadPool& pool = gps::ThreadPool::GetShared();
+		bool compress = gps::CompressedTexture::IsSupported();
+		std::vector<std::unique_ptr<gps::CompressedTexture> > compressed(pending.size());
+		std::vector<std::unique_ptr<gps::Image> > images(pending.size());
+		auto decodeStart = std::chrono::steady_clock::now();
+		pool.ParallelFor(pending.size(), [&](size_t i) {
+			DecodeTexture(pending[i].path, compress, compressed[i], images[i]);
+		});
+
+		// the data itself reaches the GPU over the next frames
+		auto queueStart = std::chrono::steady_clock::now();
+		size_t compressedCount = 0;
+		for (size_t i = 0; i < pending.size(); i++) {
+			GLuint textureId = 0;
+			if (compressed[i]) {
+				textureId = CreateTexture();
+				UploadCompressedTexture(textureId, std::move(compressed[i]));
+				compressedCount++;
+			} else if (images[i]) {
+				textureId = CreateTexture();
+				UploadTexture(textureId, std::move(images[i]), pending[i].path.c_str());
+			} else {
+				fprintf(stderr, "ERROR: could not load %s\n", pending[i].path.c_str());
+			}
+			textureHandles.push_back(registry.AddTexture(pending[i].path, textureId));
+		}
+		auto queueEnd = std::chrono::steady_clock::now();
+
+		std::cout << "# of textures  : " << pending.size() << ", " << compressedCount << " block compressed"
+			<< " (decode " << std::chrono::duration<double, std::milli>(queueStart - decodeStart).count()
+			<< " ms on " << pool.GetThreadCount() << " threads, queue "
+			<< std::chrono::duration<double, std::milli>(queueEnd - queueStart).count() << " ms)" << std::endl;
+	}
+
+	// Loads the textures a shape refers to, relative to the model folder
+	std::vector<gps::Texture> Model3D::LoadTextures(const std::vector<gps::TextureRef>& textureRefs, std::string basePath) {
+		std::vector<gps::Texture> textures;
+		for (size_t i = 0; i < textureRefs.size(); i++) {
+			textures.push_back(LoadTexture(basePath + textureRefs[i].path, textureRefs[i].type));
+		}
+		return textures;
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
 	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+			gps::AssetRegistry& registry = gps::AssetRegistry::Get();
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
-				if (loadedTextures[i].path == path)
-				{
-					//already loaded texture
-					return loadedTextures[i];
-				}
+			// loaded once per process - the sampler it binds to depends on this use
+			gps::TextureHandle handle = registry.AcquireTexture(path);
+			if (!handle.IsValid()) {
+				handle = registry.AddTexture(path, ReadTextureFromFile(path.c_str()));
 			}
+			textureHandles.push_back(handle);
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = registry.GetTexture(handle);
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
-			loadedTextures.push_back(currentTexture);
-
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+	// Texture for a model loaded in the background - shows the placeholder until the pixels stream in
+	gps::TextureHandle Model3D::LoadTextureAsync(const std::string& path) {
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		gps::TextureHandle handle = registry.AcquireTexture(path);
+		if (handle.IsValid()) {
+			return handle;
 		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
+
+		GLuint textureID = CreateTexture();
+		handle = registry.AddTexture(path, textureID);
+		bool compress = gps::CompressedTexture::IsSupported();
+
+		gps::GLTaskQueue::GetShared().Retain();
+		gps::ThreadPool::GetShared().Enqueue([path, textureID, handle, compress]() {
+			// std::function needs copyable captures
+			std::shared_ptr<std::unique_ptr<gps::CompressedTexture> > compressed(new std::unique_ptr<gps::CompressedTexture>());
+			std::shared_ptr<std::unique_ptr<gps::Image> > image(new std::unique_ptr<gps::Image>());
+			DecodeTexture(path, compress, *compressed, *image);
+
+			gps::GLTaskQueue& queue = gps::GLTaskQueue::GetShared();
+			queue.Post([path, textureID, handle, compressed, image]() {
+				if (gps::AssetRegistry::Get().GetTexture(handle) != textureID) {
+					// released before the pixels arrived
+					return;
+				}
+				if (*compressed) {
+					UploadCompressedTexture(textureID, std::move(*compressed));
+				} else if (*image) {
+					UploadTexture(textureID, std::move(*image), path.c_str());
+				} else {
+					fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+				}
+			});
+			queue.Release();
+		});
+		return handle;
+	}
+
+	// Maps or encodes the block compressed chain, raw pixels only when that is not possible - any thread
+	void Model3D::DecodeTexture(const std::string& path, bool compress, std::unique_ptr<gps::CompressedTexture>& compressed,
+								std::unique_ptr<gps::Image>& image) {
+		compressed.reset(new gps::CompressedTexture());
+		if (compress && compressed->Load(path, true, true, true)) {
+			return;
+		}
+		compressed.reset();
+		image.reset(new gps::Image());
+		if (!image->Load(path, 4, true)) {
+			image.reset();
 		}
+	}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
+	// Reads the pixel data from an image file and loads it into the video memory
+	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+		std::unique_ptr<gps::CompressedTexture> compressed;
+		std::unique_ptr<gps::Image> image;
+		DecodeTexture(file_name, gps::CompressedTexture::IsSupported(), compressed, image);
 
-		for (int row = 0; row < half_height; row++) {
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-			for (int col = 0; col < width_in_bytes; col++) {
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
+		GLuint textureID = 0;
+		if (compressed) {
+			textureID = CreateTexture();
+			UploadCompressedTexture(textureID, std::move(compressed));
+		} else if (image) {
+			textureID = CreateTexture();
+			UploadTexture(textureID, std::move(image), file_name);
+		} else {
+			fprintf(stderr, "ERROR: could not load %s\n", file_name);
 		}
+		return textureID;
+	}
+
+	// Texture object with the model sampler settings and a 1x1 grey placeholder image
+	GLuint Model3D::CreateTexture() {
+		static const unsigned char placeholder[4] = {128, 128, 128, 255};
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
+		gps::GLState::Get().BindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
 		return textureID;
 	}
 
+	// Queues decoded RGBA pixels on the streamer - needs the GL context
+	void Model3D::UploadTexture(GLuint textureID, std::unique_ptr<gps::Image> image, const char* file_name) {
+		int x = image->GetWidth();
+		int y = image->GetHeight();
+		// NPOT check
+		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+			fprintf(
+				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
+			);
+		}
+
+		// alpha is only kept for images that use it, they are drawn blended
+		GLenum internalFormat = GL_SRGB;
+		if (image->HasTranslucency()) {
+			gps::AssetRegistry::Get().SetTextureTranslucent(textureID);
+			internalFormat = GL_SRGB_ALPHA;
+		}
+		// mipmaps are generated once the last row has arrived
+		gps::TextureStreamer::GetShared().QueueImage(textureID, GL_TEXTURE_2D, std::move(image), internalFormat, true);
+	}
+
+	// Queues every level as it is - no glGenerateMipmap, the chain was built when encoding
+	void Model3D::UploadCompressedTexture(GLuint textureID, std::unique_ptr<gps::CompressedTexture> texture) {
+		// BC3 is only chosen for pixels with alpha below 255
+		if (texture->GetFormat() == gps::BLOCK_BC3) {
+			gps::AssetRegistry::Get().SetTextureTranslucent(textureID);
+		}
+		gps::TextureStreamer::GetShared().QueueCompressed(textureID, GL_TEXTURE_2D, std::move(texture), true);
+	}
+
 	Model3D::~Model3D() {
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
-
-        for (size_t i = 0; i < meshes.size(); i++) {
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
+		DeleteInstanceArrays();
+		ReleaseOcclusionNodes();
+		glDeleteBuffers(1, &instanceBuffer);
+		gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+		gps::MeshRenderCache::Get().Release(meshHandle);
+		registry.ReleaseMeshes(meshHandle);
+		for (size_t i = 0; i < textureHandles.size(); i++) {
+			registry.ReleaseTexture(textureHandles[i]);
+		}
 	}
 }
@@ -2,16 +2,28 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "AssetRegistry.hpp"
+#include "Image.hpp"
+#include "CompressedTexture.hpp"
+#include "MeshCache.hpp"
+#include "RenderQueue.hpp"
+#include "SceneBVH.hpp"
+#include "OcclusionCuller.hpp"
+#include "GpuCuller.hpp"
+#include "OcclusionRasterizer.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace gps {
 
+    struct MeshRenderData;
+
     class Model3D
     {
 
@@ -22,22 +34,202 @@ namespace gps {
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		// Returns at once - the file is parsed and decoded on the thread pool and the meshes show up
+		// in Submit as the render loop uploads them, textures start as placeholders.
+		// The model must outlive the load.
+		void LoadModelAsync(std::string fileName);
+
+		// Writes the transforms to the DrawDataRing and queues the meshes - opaque ones in the model's
+		// batch when it has one, meshes with translucent textures one by one in the blended pass.
+		// normalMatrix is the world space one, the inverse transpose of model.
+		void Submit(gps::RenderQueue& queue, const gps::Shader& shaderProgram, const glm::mat4& model,
+					const glm::mat3& normalMatrix);
+
+		// Draw the model once per transform with glDrawElementsInstanced - each transform is applied before
+		// the model matrix given to Submit. An empty list goes back to a single draw. GL thread only.
+		void SetInstances(const std::vector<glm::mat4>& transforms);
+		size_t GetInstanceCount() const;
+
+		// Every shape has been uploaded
+		bool IsLoaded() const;
+
+		// Appends the world space box of every mesh, once per instance, for the scene BVH - returns how many
+		size_t AppendBounds(const glm::mat4& model, std::vector<gps::BVHItem>& items) const;
+
+		// Vertices closer than epsilon in position, normal and texture coordinates are merged (0 = exact index match only)
+		void SetWeldEpsilon(float epsilon);
+
+		// Shapes that are rotated and moved copies of another one nearby - in the same static batching cell -
+		// keep a single copy of the geometry and are drawn instanced - off by default. Applies to the next load.
+		void SetInstanceDetection(bool detect);
+
+		// Merge the shapes sharing a material into one mesh per cellSize sized cube of the model, so static
+		// scenery takes fewer draws while far apart parts stay separate for culling - 0 (default) keeps every
+		// shape. Applies to the next load.
+		void SetStaticBatching(float cellSize);
+
+		// Keep a CPU copy of the vertices and indices after upload - off by default, the meshes
+		// only keep counts and bounds. Applies to the next load.
+		void SetKeepGeometry(bool keep);
+
+		// Draw all meshes with one multi-draw per texture set where the GL supports it - on by default
+		void SetBatched(bool batched);
+
+		// Once loading is done, copy a batched model's textures into texture arrays so it draws with one
+		// multi-draw and no per-mesh binds - needs GL 4.3 or ARB_copy_image, off by default
+		void SetMaterialArrays(bool materialArrays);
+		// Whether packing the textures into arrays was tried yet, and whether it worked
+		bool TriedMaterialArrays() const;
+		bool UsesMaterialArrays() const;
+
+		// Keep a CPU copy of the positions of meshes with at most maxTriangles triangles and a box at least
+		// minSize wide, to be drawn as occluders by AddOccluders - 0 (default) keeps none. Meshes drawn
+		// instanced are left out. Applies to the next load.
+		void SetOccluders(size_t maxTriangles, float minSize);
+
+		// Adds the model's occluders to this frame of the rasterizer
+		void AddOccluders(gps::OcclusionRasterizer& rasterizer, const glm::mat4& model) const;
+
+		// Cull the meshes left after frustum culling whose boxes the rasterizer finds hidden - it must have
+		// been rendered before Submit. Instanced models are not tested. nullptr (default) turns it off.
+		void SetOcclusionRasterizer(gps::OcclusionRasterizer* rasterizer);
+
+		// Test the meshes left after frustum culling with the culler's box queries - meshes hidden at their
+		// last test leave the batch and are drawn under conditional rendering. Instanced models are not
+		// tested. nullptr (default) turns it off, the culler must outlive the model.
+		void SetOcclusionCuller(gps::OcclusionCuller* culler);
+
+		// Cull the batch's commands on the GPU, against the frustum and last frame's depth - only for models
+		// that stay put, their boxes are projected with last frame's matrices. Once the meshes and textures
+		// are all in, Submit tests no more than the model's box and the meshes drawn on their own, and the
+		// batch keeps its commands and draw data from frame to frame. nullptr (default) turns it off, the
+		// culler must outlive the model.
+		void SetGpuCuller(gps::GpuCuller* culler);
+
+		// This frame's visibility of the boxes AppendBounds added, from one scene wide query - the model
+		// takes it instead of testing its meshes against the frustum itself. An instanced model is skipped
+		// when none of its boxes is visible. nullptr (default) or a count that does not match the meshes
+		// lets it test them itself. The array must stay valid until the frame's Submit.
+		void SetSceneVisibility(const uint8_t* visible, size_t count);
 
     private:
-		// Component meshes - group of objects
-        std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// Component meshes - shared with every model loaded from the same file
+		gps::MeshHandle meshHandle;
+		// Textures referenced while loading, handed over to the mesh set
+		std::vector<gps::TextureHandle> textureHandles;
+		// Tolerance used when welding vertices
+		float weldEpsilon = 0.0f;
+		// Repeated shapes become instances of the first
+		bool detectInstances = false;
+		// Cell size shapes are merged in, 0 for none
+		float batchCellSize = 0.0f;
+		// Meshes keep their CPU geometry
+		bool keepGeometry = false;
+		// Drawn through the mesh set's MeshBatch once it is loaded
+		bool batched = true;
+		// Batched meshes sample texture arrays
+		bool materialArrays = false;
+		// Meshes kept as occluders, none when maxTriangles is 0
+		size_t occluderMaxTriangles = 0;
+		float occluderMinSize = 0.0f;
+		gps::OcclusionRasterizer* occlusionRasterizer = nullptr;
+
+		// Per-instance matrices, attributes INSTANCE_MATRIX_ATTRIBUTE.. of instanceArrays
+		GLuint instanceBuffer = 0;
+		std::vector<glm::mat4> instanceTransforms;
+		// Average instance position, where the instances sort as a whole
+		glm::vec3 instanceCentre;
+		// VAO drawing one mesh with the instance matrices - meshes are shared with other models, so the
+		// instance attributes cannot go into theirs
+		struct InstanceArray {
+			GLuint vertexArray;
+			// every instance times every copy of a mesh that has copies of its own, 0 for instanceBuffer
+			GLuint copyBuffer;
+			GLsizei count;
+		};
+		std::vector<InstanceArray> instanceArrays;
+
+		gps::OcclusionCuller* occlusionCuller = nullptr;
+		gps::GpuCuller* gpuCuller = nullptr;
+		// culler node of each mesh, added as the meshes show up
+		std::vector<uint32_t> occlusionNodes;
+		// visibility from the scene query, see SetSceneVisibility
+		const uint8_t* sceneVisible = nullptr;
+		size_t sceneVisibleCount = 0;
+		// per mesh scratch of Submit, kept so a frame allocates nothing
+		std::vector<uint8_t> submitVisible;
+		std::vector<bool> submitConditional;
+		std::vector<bool> submitSkipped;
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		struct PendingModel;
+
+		// Creates the instance VAOs of meshes uploaded since the last call
+		void UpdateInstanceArrays(const gps::MeshSet& meshSet);
+		void DeleteInstanceArrays();
+
+		void ReleaseOcclusionNodes();
+
+		// Builds the batch, and the material table once the textures are all in
+		void PrepareBatch(const gps::MeshSet& meshSet, gps::MeshRenderData& renderData);
+		// Submit while the GPU culls the batch, the work does not grow with the batch's meshes
+		void SubmitGpuCulled(gps::RenderQueue& queue, const gps::Shader& shaderProgram, const glm::mat4& model,
+							 const glm::mat3& normalMatrix, gps::MeshSet& meshSet, gps::MeshRenderData& renderData);
+
+		static void DrawBatchPacket(const gps::DrawPacket& packet);
+		static void DrawInstancedPacket(const gps::DrawPacket& packet);
+		static void DrawConditionalPacket(const gps::DrawPacket& packet);
+
+		// Fills either the mapped cache or the parsed shapes, cached tells which. False when the file
+		// cannot be read, both are left empty then.
+		bool ReadShapeData(std::string fileName, std::string basePath, gps::MeshCache& cache,
+						   std::vector<gps::MeshData>& shapes, bool& cached);
+
+		// Copies the positions of a mesh about to be uploaded into occluders when it qualifies, an instanced
+		// mesh is drawn at each of its instances
+		static void AddOccluder(std::vector<gps::OccluderMesh>& occluders, const gps::Vertex* vertices, size_t vertexCount,
+								const GLuint* indices, size_t indexCount, size_t maxTriangles, float minSize,
+								const glm::mat4* instances, size_t instanceCount);
+
+		// Creates one mesh of a model loaded in the background
+		static void UploadShapeAsync(PendingModel& pending, size_t shape);
+
+		// Does the parsing of the .obj file and fills in the data structure, false when it cannot be parsed
+		bool ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& shapeData);
+
+		// Replaces shapes that are rigid transforms of an earlier shape in the same cell by instances of it
+		void FindInstances(std::vector<gps::MeshData>& shapeData);
+
+		// Merges the shapes of each material and batchCellSize cell into one
+		void MergeStaticBatches(std::vector<gps::MeshData>& shapes);
+
+		// Merges the vertices of a shape that are equal within weldEpsilon and rewrites its indices
+		void WeldByEpsilon(std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices);
+
+		// Decodes the textures in parallel and uploads them, before the meshes ask for them one by one
+		void PreloadTextures(const std::vector<gps::TextureRef>& textureRefs, std::string basePath);
+
+		// Loads the textures a shape refers to, relative to the model folder
+		std::vector<gps::Texture> LoadTextures(const std::vector<gps::TextureRef>& textureRefs, std::string basePath);
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
+		// Acquires the texture, starting a background load when it is new
+		static gps::TextureHandle LoadTextureAsync(const std::string& path);
+
 		// Reads the pixel data from an image file and loads it into the video memory
 		GLuint ReadTextureFromFile(const char* file_name);
+
+		// Decodes on any thread - fills compressed if possible, otherwise image, nothing when the file is unreadable
+		static void DecodeTexture(const std::string& path, bool compress, std::unique_ptr<gps::CompressedTexture>& compressed,
+								  std::unique_ptr<gps::Image>& image);
+
+		// Texture object with a placeholder image, the real data is streamed in by the Upload functions
+		static GLuint CreateTexture();
+
+		static void UploadTexture(GLuint textureID, std::unique_ptr<gps::Image> image, const char* file_name);
+
+		static void UploadCompressedTexture(GLuint textureID, std::unique_ptr<gps::CompressedTexture> texture);
     };
 }
 
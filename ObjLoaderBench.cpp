@@ -0,0 +1,93 @@
+// Compares tinyobj::LoadObj with gps::LoadObjParallel on the same OBJ file.
+// Usage: ObjLoaderBench [file.obj] [runs]
+
+#include "ObjParser.hpp"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct LoadResult {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+};
+
+static bool sameIndices(const std::vector<tinyobj::index_t>& a, const std::vector<tinyobj::index_t>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].vertex_index != b[i].vertex_index || a[i].normal_index != b[i].normal_index ||
+            a[i].texcoord_index != b[i].texcoord_index) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sameResult(const LoadResult& a, const LoadResult& b) {
+    if (a.attrib.vertices != b.attrib.vertices || a.attrib.normals != b.attrib.normals ||
+        a.attrib.texcoords != b.attrib.texcoords || a.shapes.size() != b.shapes.size() ||
+        a.materials.size() != b.materials.size()) {
+        return false;
+    }
+    for (size_t s = 0; s < a.shapes.size(); s++) {
+        if (a.shapes[s].name != b.shapes[s].name ||
+            !sameIndices(a.shapes[s].mesh.indices, b.shapes[s].mesh.indices) ||
+            a.shapes[s].mesh.num_face_vertices != b.shapes[s].mesh.num_face_vertices ||
+            a.shapes[s].mesh.material_ids != b.shapes[s].mesh.material_ids) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    std::string fileName = argc > 1 ? argv[1] : "../models/teapot/teapot20segUT.obj";
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    std::string basePath = fileName.substr(0, fileName.find_last_of('/') + 1);
+
+    LoadResult reference;
+    LoadResult parallel;
+    double tinyobjTime = 0.0;
+    double parallelTime = 0.0;
+
+    for (int run = 0; run < runs; run++) {
+        std::string err;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = tinyobj::LoadObj(&reference.attrib, &reference.shapes, &reference.materials, &err,
+                                   fileName.c_str(), basePath.c_str(), true);
+        auto middle = std::chrono::steady_clock::now();
+        ok = gps::LoadObjParallel(&parallel.attrib, &parallel.shapes, &parallel.materials, &err,
+                                  fileName.c_str(), basePath.c_str(), true) && ok;
+        auto end = std::chrono::steady_clock::now();
+        if (!ok) {
+            std::cerr << err << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        tinyobjTime += std::chrono::duration<double, std::milli>(middle - start).count();
+        parallelTime += std::chrono::duration<double, std::milli>(end - middle).count();
+        // materials accumulate across calls, only the last run is compared
+        if (run + 1 < runs) {
+            reference = LoadResult();
+            parallel = LoadResult();
+        }
+    }
+
+    std::cout << "File           : " << fileName << std::endl;
+    std::cout << "tinyobj        : " << tinyobjTime / runs << " ms" << std::endl;
+    std::cout << "parallel       : " << parallelTime / runs << " ms" << std::endl;
+    std::cout << "speedup        : " << tinyobjTime / parallelTime << "x" << std::endl;
+
+    if (!sameResult(reference, parallel)) {
+        std::cout << "MISMATCH between the two loaders" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Results match" << std::endl;
+    return EXIT_SUCCESS;
+}
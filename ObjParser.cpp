@@ -0,0 +1,450 @@
+#include "ObjParser.hpp"
+#include "MappedFile.hpp"
+
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <thread>
+
+namespace gps {
+
+    // Face corner as written in the file; indices flagged as relative still need the
+    // element count of all previous chunks added to them
+    struct ObjCorner {
+        int v;
+        int vt;
+        int vn;
+        unsigned char relative;
+    };
+
+    enum {
+        RELATIVE_V = 1,
+        RELATIVE_VT = 2,
+        RELATIVE_VN = 4
+    };
+
+    // Statement that changes the shape or material state, replayed in order by the merge pass
+    struct ObjRecord {
+        enum Kind { USEMTL, MTLLIB, GROUP, OBJECT };
+
+        Kind kind;
+        // number of faces of the chunk that come before this record
+        size_t faceCount;
+        std::string name;
+    };
+
+    struct ObjChunk {
+        const char* begin;
+        const char* end;
+
+        std::vector<float> v;
+        std::vector<float> vn;
+        std::vector<float> vt;
+        std::vector<ObjCorner> corners;
+        std::vector<unsigned int> faceSizes;
+        std::vector<ObjRecord> records;
+
+        // element counts of all previous chunks
+        int vOffset;
+        int vnOffset;
+        int vtOffset;
+    };
+
+    // Faces [firstFace, endFace) of a chunk, whose corners start at firstCorner
+    struct ObjFaceRange {
+        const ObjChunk* chunk;
+        size_t firstFace;
+        size_t endFace;
+        size_t firstCorner;
+    };
+
+    static inline bool IsSpace(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static inline bool IsDigit(char c) {
+        return static_cast<unsigned int>(c - '0') < 10u;
+    }
+
+    static inline const char* SkipSpace(const char* token, const char* end) {
+        while (token < end && IsSpace(*token)) {
+            token++;
+        }
+        return token;
+    }
+
+    // Advances to the next character of the given set, or to the end of the line
+    static inline const char* SkipUntil(const char* token, const char* end, const char* set) {
+        while (token < end && !strchr(set, *token)) {
+            token++;
+        }
+        return token;
+    }
+
+    static inline float ParseFloat(const char** token, const char* end) {
+        *token = SkipSpace(*token, end);
+        const char* valueEnd = SkipUntil(*token, end, " \t\r");
+        double value = 0.0;
+        tinyobj::tryParseDouble(*token, valueEnd, &value);
+        *token = valueEnd;
+        return static_cast<float>(value);
+    }
+
+    // atoi without running past the end of the line
+    static inline int ParseInt(const char* token, const char* end) {
+        bool negative = false;
+        if (token < end && (*token == '+' || *token == '-')) {
+            negative = *token == '-';
+            token++;
+        }
+        int value = 0;
+        while (token < end && IsDigit(*token)) {
+            value = value * 10 + (*token - '0');
+            token++;
+        }
+        return negative ? -value : value;
+    }
+
+    // Makes an index zero based; negative ones are relative to the elements read so far
+    static inline int FixIndex(int index, int localCount, unsigned char flag, unsigned char* relative) {
+        if (index > 0) return index - 1;
+        if (index == 0) return 0;
+        *relative |= flag;
+        return localCount + index;
+    }
+
+    // Parses i, i/j, i//k and i/j/k corners
+    static ObjCorner ParseCorner(const char** token, const char* end, const ObjChunk& chunk) {
+        ObjCorner corner = {-1, -1, -1, 0};
+        int vCount = chunk.v.size() / 3;
+        int vnCount = chunk.vn.size() / 3;
+        int vtCount = chunk.vt.size() / 2;
+
+        corner.v = FixIndex(ParseInt(*token, end), vCount, RELATIVE_V, &corner.relative);
+        *token = SkipUntil(*token, end, "/ \t\r");
+        if (*token == end || **token != '/') {
+            return corner;
+        }
+        (*token)++;
+
+        if (*token < end && **token == '/') {
+            (*token)++;
+            corner.vn = FixIndex(ParseInt(*token, end), vnCount, RELATIVE_VN, &corner.relative);
+            *token = SkipUntil(*token, end, "/ \t\r");
+            return corner;
+        }
+
+        corner.vt = FixIndex(ParseInt(*token, end), vtCount, RELATIVE_VT, &corner.relative);
+        *token = SkipUntil(*token, end, "/ \t\r");
+        if (*token == end || **token != '/') {
+            return corner;
+        }
+        (*token)++;
+
+        corner.vn = FixIndex(ParseInt(*token, end), vnCount, RELATIVE_VN, &corner.relative);
+        *token = SkipUntil(*token, end, "/ \t\r");
+        return corner;
+    }
+
+    // First whitespace separated word after the keyword, like sscanf("%s")
+    static std::string ParseName(const char* token, const char* end) {
+        token = SkipSpace(token, end);
+        return std::string(token, SkipUntil(token, end, " \t\r"));
+    }
+
+    static void AddRecord(ObjChunk* chunk, ObjRecord::Kind kind, const std::string& name) {
+        ObjRecord record;
+        record.kind = kind;
+        record.faceCount = chunk->faceSizes.size();
+        record.name = name;
+        chunk->records.push_back(record);
+    }
+
+    static void ParseChunk(ObjChunk* chunk) {
+        const char* line = chunk->begin;
+        while (line < chunk->end) {
+            const char* lineEnd = static_cast<const char*>(memchr(line, '\n', chunk->end - line));
+            if (!lineEnd) {
+                lineEnd = chunk->end;
+            }
+            const char* next = lineEnd + 1;
+            if (lineEnd > line && lineEnd[-1] == '\r') {
+                lineEnd--;
+            }
+
+            const char* token = SkipSpace(line, lineEnd);
+            line = next;
+            if (token == lineEnd || token[0] == '#') {
+                continue;
+            }
+            size_t length = lineEnd - token;
+
+            // vertex
+            if (length > 1 && token[0] == 'v' && IsSpace(token[1])) {
+                token += 2;
+                chunk->v.push_back(ParseFloat(&token, lineEnd));
+                chunk->v.push_back(ParseFloat(&token, lineEnd));
+                chunk->v.push_back(ParseFloat(&token, lineEnd));
+                continue;
+            }
+
+            // normal
+            if (length > 2 && token[0] == 'v' && token[1] == 'n' && IsSpace(token[2])) {
+                token += 3;
+                chunk->vn.push_back(ParseFloat(&token, lineEnd));
+                chunk->vn.push_back(ParseFloat(&token, lineEnd));
+                chunk->vn.push_back(ParseFloat(&token, lineEnd));
+                continue;
+            }
+
+            // texcoord
+            if (length > 2 && token[0] == 'v' && token[1] == 't' && IsSpace(token[2])) {
+                token += 3;
+                chunk->vt.push_back(ParseFloat(&token, lineEnd));
+                chunk->vt.push_back(ParseFloat(&token, lineEnd));
+                continue;
+            }
+
+            // face
+            if (length > 1 && token[0] == 'f' && IsSpace(token[1])) {
+                token = SkipSpace(token + 2, lineEnd);
+                unsigned int faceSize = 0;
+                while (token < lineEnd) {
+                    chunk->corners.push_back(ParseCorner(&token, lineEnd, *chunk));
+                    faceSize++;
+                    while (token < lineEnd && (IsSpace(*token) || *token == '\r')) {
+                        token++;
+                    }
+                }
+                if (faceSize > 0) {
+                    chunk->faceSizes.push_back(faceSize);
+                }
+                continue;
+            }
+
+            if (length > 6 && strncmp(token, "usemtl", 6) == 0 && IsSpace(token[6])) {
+                AddRecord(chunk, ObjRecord::USEMTL, ParseName(token + 7, lineEnd));
+                continue;
+            }
+
+            if (length > 6 && strncmp(token, "mtllib", 6) == 0 && IsSpace(token[6])) {
+                AddRecord(chunk, ObjRecord::MTLLIB, ParseName(token + 7, lineEnd));
+                continue;
+            }
+
+            // group name - only the first name after 'g' is kept
+            if (length > 1 && token[0] == 'g' && IsSpace(token[1])) {
+                AddRecord(chunk, ObjRecord::GROUP, ParseName(token + 2, lineEnd));
+                continue;
+            }
+
+            // object name
+            if (length > 1 && token[0] == 'o' && IsSpace(token[1])) {
+                AddRecord(chunk, ObjRecord::OBJECT, ParseName(token + 2, lineEnd));
+                continue;
+            }
+
+            // Ignore unknown command.
+        }
+    }
+
+    static inline tinyobj::index_t ResolveCorner(const ObjCorner& corner, const ObjChunk& chunk) {
+        tinyobj::index_t index;
+        index.vertex_index = corner.v + ((corner.relative & RELATIVE_V) ? chunk.vOffset : 0);
+        index.texcoord_index = corner.vt + ((corner.relative & RELATIVE_VT) ? chunk.vtOffset : 0);
+        index.normal_index = corner.vn + ((corner.relative & RELATIVE_VN) ? chunk.vnOffset : 0);
+        return index;
+    }
+
+    // Counterpart of tinyobj's exportFaceGroupToShape working on chunk face ranges
+    static bool ExportFaceGroup(tinyobj::shape_t* shape, const std::vector<ObjFaceRange>& faceGroup,
+                                int materialId, const std::string& name, bool triangulate) {
+        bool empty = true;
+        for (size_t r = 0; r < faceGroup.size(); r++) {
+            const ObjFaceRange& range = faceGroup[r];
+            const ObjChunk& chunk = *range.chunk;
+            size_t corner = range.firstCorner;
+            for (size_t f = range.firstFace; f < range.endFace; f++) {
+                size_t faceSize = chunk.faceSizes[f];
+                const ObjCorner* face = &chunk.corners[corner];
+                corner += faceSize;
+                empty = false;
+
+                if (triangulate) {
+                    // Polygon -> triangle fan conversion
+                    for (size_t k = 2; k < faceSize; k++) {
+                        shape->mesh.indices.push_back(ResolveCorner(face[0], chunk));
+                        shape->mesh.indices.push_back(ResolveCorner(face[k - 1], chunk));
+                        shape->mesh.indices.push_back(ResolveCorner(face[k], chunk));
+                        shape->mesh.num_face_vertices.push_back(3);
+                        shape->mesh.material_ids.push_back(materialId);
+                    }
+                } else {
+                    for (size_t k = 0; k < faceSize; k++) {
+                        shape->mesh.indices.push_back(ResolveCorner(face[k], chunk));
+                    }
+                    shape->mesh.num_face_vertices.push_back(static_cast<unsigned char>(faceSize));
+                    shape->mesh.material_ids.push_back(materialId);
+                }
+            }
+        }
+        if (empty) {
+            return false;
+        }
+        shape->name = name;
+        return true;
+    }
+
+    // Appends faces [firstFace, endFace) of the chunk to the pending face group
+    static void AddFaces(std::vector<ObjFaceRange>* faceGroup, const ObjChunk& chunk,
+                         size_t firstFace, size_t endFace, size_t* corner) {
+        if (firstFace == endFace) {
+            return;
+        }
+        ObjFaceRange range = {&chunk, firstFace, endFace, *corner};
+        faceGroup->push_back(range);
+        for (size_t f = firstFace; f < endFace; f++) {
+            *corner += chunk.faceSizes[f];
+        }
+    }
+
+    bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                         std::vector<tinyobj::material_t>* materials, std::string* err,
+                         const char* filename, const char* mtl_basepath,
+                         bool triangulate, unsigned threadCount) {
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+
+        MappedFile file;
+        if (!file.Open(filename)) {
+            std::stringstream errss;
+            errss << "Cannot open file [" << filename << "]" << std::endl;
+            if (err) {
+                (*err) = errss.str();
+            }
+            return false;
+        }
+
+        // split the file into chunks that end on a line break
+        if (threadCount == 0) {
+            threadCount = std::thread::hardware_concurrency();
+        }
+        const size_t minChunkSize = 1 << 20;
+        size_t chunkCount = file.GetSize() / minChunkSize + 1;
+        if (chunkCount > threadCount) {
+            chunkCount = threadCount > 0 ? threadCount : 1;
+        }
+
+        const char* data = file.GetData();
+        const char* dataEnd = data + file.GetSize();
+        std::vector<ObjChunk> chunks;
+        const char* chunkBegin = data;
+        for (size_t c = 0; c < chunkCount && chunkBegin < dataEnd; c++) {
+            const char* chunkEnd = dataEnd;
+            if (c + 1 < chunkCount) {
+                chunkEnd = data + file.GetSize() * (c + 1) / chunkCount;
+                if (chunkEnd < chunkBegin) {
+                    chunkEnd = chunkBegin;
+                }
+                const char* lineBreak = static_cast<const char*>(memchr(chunkEnd, '\n', dataEnd - chunkEnd));
+                chunkEnd = lineBreak ? lineBreak + 1 : dataEnd;
+            }
+            chunks.push_back(ObjChunk());
+            chunks.back().begin = chunkBegin;
+            chunks.back().end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
+
+        // parse every chunk on its own thread, the calling thread takes the first one
+        std::vector<std::thread> workers;
+        for (size_t c = 1; c < chunks.size(); c++) {
+            workers.push_back(std::thread(ParseChunk, &chunks[c]));
+        }
+        if (!chunks.empty()) {
+            ParseChunk(&chunks[0]);
+        }
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].join();
+        }
+
+        // concatenate the attributes and remember where each chunk starts
+        size_t vSize = 0, vnSize = 0, vtSize = 0;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            chunks[c].vOffset = vSize / 3;
+            chunks[c].vnOffset = vnSize / 3;
+            chunks[c].vtOffset = vtSize / 2;
+            vSize += chunks[c].v.size();
+            vnSize += chunks[c].vn.size();
+            vtSize += chunks[c].vt.size();
+        }
+        attrib->vertices.reserve(vSize);
+        attrib->normals.reserve(vnSize);
+        attrib->texcoords.reserve(vtSize);
+        for (size_t c = 0; c < chunks.size(); c++) {
+            attrib->vertices.insert(attrib->vertices.end(), chunks[c].v.begin(), chunks[c].v.end());
+            attrib->normals.insert(attrib->normals.end(), chunks[c].vn.begin(), chunks[c].vn.end());
+            attrib->texcoords.insert(attrib->texcoords.end(), chunks[c].vt.begin(), chunks[c].vt.end());
+        }
+
+        // replay the records in file order to rebuild the shapes the way tinyobj does
+        std::string basePath = mtl_basepath ? mtl_basepath : "";
+        tinyobj::MaterialFileReader readMatFn(basePath);
+        std::map<std::string, int> material_map;
+        int material = -1;
+        std::string name;
+        tinyobj::shape_t shape;
+        std::vector<ObjFaceRange> faceGroup;
+
+        for (size_t c = 0; c < chunks.size(); c++) {
+            const ObjChunk& chunk = chunks[c];
+            size_t face = 0;
+            size_t corner = 0;
+
+            for (size_t r = 0; r < chunk.records.size(); r++) {
+                const ObjRecord& record = chunk.records[r];
+                AddFaces(&faceGroup, chunk, face, record.faceCount, &corner);
+                face = record.faceCount;
+
+                if (record.kind == ObjRecord::USEMTL) {
+                    int newMaterialId = -1;
+                    std::map<std::string, int>::const_iterator found = material_map.find(record.name);
+                    if (found != material_map.end()) {
+                        newMaterialId = found->second;
+                    }
+                    if (newMaterialId != material) {
+                        ExportFaceGroup(&shape, faceGroup, material, name, triangulate);
+                        faceGroup.clear();
+                        material = newMaterialId;
+                    }
+                } else if (record.kind == ObjRecord::MTLLIB) {
+                    std::string err_mtl;
+                    bool ok = readMatFn(record.name, materials, &material_map, &err_mtl);
+                    if (err) {
+                        (*err) += err_mtl;
+                    }
+                    if (!ok) {
+                        return false;
+                    }
+                } else {
+                    // 'g' and 'o' flush the current shape and start a new one
+                    if (ExportFaceGroup(&shape, faceGroup, material, name, triangulate)) {
+                        shapes->push_back(shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    faceGroup.clear();
+                    name = record.name;
+                }
+            }
+            AddFaces(&faceGroup, chunk, face, chunk.faceSizes.size(), &corner);
+        }
+
+        bool ret = ExportFaceGroup(&shape, faceGroup, material, name, triangulate);
+        if (ret || shape.mesh.indices.size()) {
+            shapes->push_back(shape);
+        }
+
+        return true;
+    }
+}
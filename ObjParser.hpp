@@ -0,0 +1,21 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Drop-in replacement for tinyobj::LoadObj that maps the file and parses newline aligned chunks
+    // of it on all cores (threadCount = 0). A merge pass resolves relative indices and rebuilds the
+    // shapes in file order, so the result matches what tinyobj produces.
+    // Supports v/vn/vt/f/usemtl/mtllib/o/g records; subdivision tags ('t') are ignored.
+    bool LoadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+                         std::vector<tinyobj::material_t>* materials, std::string* err,
+                         const char* filename, const char* mtl_basepath = NULL,
+                         bool triangulate = true, unsigned threadCount = 0);
+}
+
+#endif /* ObjParser_hpp */
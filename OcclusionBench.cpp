@@ -0,0 +1,192 @@
+// Software occlusion culling against frustum culling alone, from a grid of viewpoints over an OBJ scene.
+// Shapes are merged per material and cell with Model3D's static batching grouping, so occluders
+// and tested boxes come out close to the app's. Repeated props that the app draws instanced are merged
+// with the rest of their cell here.
+// Usage: OcclusionBench [file.obj] [eye height] [grid side] [batch cell size, 0 keeps every shape]
+
+#include "ObjParser.hpp"
+#include "Frustum.hpp"
+#include "OcclusionRasterizer.hpp"
+#include "StaticBatch.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchShape {
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    size_t triangleCount;
+};
+
+// Positions of one static batch, three per triangle
+struct BenchBatch {
+    std::vector<glm::vec3> positions;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, const char* argv[]) {
+    std::string fileName = argc > 1 ? argv[1] : "../models/others/Map_v1.obj";
+    float eyeHeight = argc > 2 ? (float)atof(argv[2]) : 1.7f;
+    int gridSide = argc > 3 ? atoi(argv[3]) : 6;
+    // main.cpp's settings for the map
+    float batchCellSize = argc > 4 ? (float)atof(argv[4]) : 25.0f;
+    const size_t occluderMaxTriangles = 4096;
+    const float occluderMinSize = 4.0f;
+    std::string basePath = fileName.substr(0, fileName.find_last_of('/') + 1);
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+    if (!gps::LoadObjParallel(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true)) {
+        std::cerr << err << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<BenchBatch> shapePositions(shapes.size());
+    std::vector<gps::BatchShape> batchShapes(shapes.size());
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const std::vector<tinyobj::index_t>& indices = shapes[s].mesh.indices;
+        BenchBatch& shape = shapePositions[s];
+        shape.boundsMin = glm::vec3(INFINITY);
+        shape.boundsMax = glm::vec3(-INFINITY);
+        for (size_t i = 0; i < indices.size(); i++) {
+            const float* vertex = &attrib.vertices[3 * indices[i].vertex_index];
+            glm::vec3 position(vertex[0], vertex[1], vertex[2]);
+            shape.boundsMin = glm::min(shape.boundsMin, position);
+            shape.boundsMax = glm::max(shape.boundsMax, position);
+            shape.positions.push_back(position);
+        }
+        batchShapes[s].materialId = shapes[s].mesh.material_ids.empty() ? -1 : shapes[s].mesh.material_ids[0];
+        batchShapes[s].boundsMin = shape.boundsMin;
+        batchShapes[s].boundsMax = shape.boundsMax;
+        batchShapes[s].mergeable = !indices.empty();
+    }
+
+    // the same grouping Model3D::MergeStaticBatches uses
+    std::vector<size_t> batchOf;
+    gps::GroupStaticBatches(batchShapes, batchCellSize, batchOf);
+    std::vector<size_t> slot(shapes.size());
+    std::vector<BenchBatch> batches;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        BenchBatch& shape = shapePositions[s];
+        if (shape.positions.empty()) {
+            continue;
+        }
+        if (batchOf[s] == s) {
+            slot[s] = batches.size();
+            batches.push_back(std::move(shape));
+            continue;
+        }
+        BenchBatch& batch = batches[slot[batchOf[s]]];
+        batch.positions.insert(batch.positions.end(), shape.positions.begin(), shape.positions.end());
+        batch.boundsMin = glm::min(batch.boundsMin, shape.boundsMin);
+        batch.boundsMax = glm::max(batch.boundsMax, shape.boundsMax);
+    }
+
+    std::vector<BenchShape> benchShapes;
+    std::vector<gps::OccluderMesh> occluders;
+    glm::vec3 sceneMin(INFINITY);
+    glm::vec3 sceneMax(-INFINITY);
+    size_t occluderTriangles = 0;
+    for (size_t b = 0; b < batches.size(); b++) {
+        const BenchBatch& batch = batches[b];
+        BenchShape shape;
+        shape.boundsMin = batch.boundsMin;
+        shape.boundsMax = batch.boundsMax;
+        shape.triangleCount = batch.positions.size() / 3;
+        benchShapes.push_back(shape);
+        sceneMin = glm::min(sceneMin, shape.boundsMin);
+        sceneMax = glm::max(sceneMax, shape.boundsMax);
+
+        std::vector<uint32_t> sequence(batch.positions.size());
+        for (size_t i = 0; i < sequence.size(); i++) {
+            sequence[i] = i;
+        }
+        gps::OccluderMesh occluder;
+        if (gps::MakeOccluder(batch.positions.data(), sizeof(glm::vec3), batch.positions.size(), sequence.data(),
+                              sequence.size(), occluderMaxTriangles, occluderMinSize, occluder)) {
+            occluderTriangles += occluder.indices.size() / 3;
+            occluders.push_back(std::move(occluder));
+        }
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1920.0f / 1080.0f, 0.1f, 1000.0f);
+    gps::OcclusionRasterizer rasterizer;
+    size_t views = 0;
+    size_t frustumShapes = 0, frustumTriangles = 0;
+    size_t occlusionShapes = 0, occlusionTriangles = 0;
+    double frustumTime = 0.0, renderTime = 0.0, testTime = 0.0;
+
+    // eye height above the lowest point, every grid position looks in 8 directions
+    for (int gz = 0; gz < gridSide; gz++) {
+        for (int gx = 0; gx < gridSide; gx++) {
+            glm::vec3 eye(sceneMin.x + (sceneMax.x - sceneMin.x) * (gx + 0.5f) / gridSide, sceneMin.y + eyeHeight,
+                          sceneMin.z + (sceneMax.z - sceneMin.z) * (gz + 0.5f) / gridSide);
+            for (int direction = 0; direction < 8; direction++) {
+                float yaw = direction * 3.14159265f / 4.0f;
+                glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), 0.0f, std::sin(yaw)),
+                                             glm::vec3(0.0f, 1.0f, 0.0f));
+                gps::Frustum frustum;
+                frustum.Extract(projection * view);
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::vector<size_t> inFrustum;
+                for (size_t s = 0; s < benchShapes.size(); s++) {
+                    if (frustum.IsVisible(benchShapes[s].boundsMin, benchShapes[s].boundsMax)) {
+                        inFrustum.push_back(s);
+                    }
+                }
+                frustumTime += millisecondsSince(start);
+
+                start = std::chrono::steady_clock::now();
+                rasterizer.Begin(view, projection);
+                for (size_t o = 0; o < occluders.size(); o++) {
+                    rasterizer.AddOccluder(glm::mat4(1.0f), occluders[o]);
+                }
+                rasterizer.Render();
+                renderTime += millisecondsSince(start);
+
+                start = std::chrono::steady_clock::now();
+                glm::mat4 viewProjection = projection * view;
+                for (size_t i = 0; i < inFrustum.size(); i++) {
+                    const BenchShape& shape = benchShapes[inFrustum[i]];
+                    frustumShapes++;
+                    frustumTriangles += shape.triangleCount;
+                    if (rasterizer.IsVisible(viewProjection, shape.boundsMin, shape.boundsMax)) {
+                        occlusionShapes++;
+                        occlusionTriangles += shape.triangleCount;
+                    }
+                }
+                testTime += millisecondsSince(start);
+                views++;
+            }
+        }
+    }
+
+    std::cout << "File           : " << fileName << std::endl;
+    std::cout << "Batches        : " << benchShapes.size() << " from " << shapes.size() << " shapes, " << occluders.size() << " occluders with "
+              << occluderTriangles << " triangles" << std::endl;
+    std::cout << "Views          : " << views << std::endl;
+    std::cout << "frustum only   : " << (double)frustumShapes / views << " shapes, "
+              << (double)frustumTriangles / views << " triangles per view, " << frustumTime / views << " ms" << std::endl;
+    std::cout << "with occlusion : " << (double)occlusionShapes / views << " shapes, "
+              << (double)occlusionTriangles / views << " triangles per view, "
+              << renderTime / views << " ms rasterizing + " << testTime / views << " ms testing" << std::endl;
+    if (frustumTriangles > 0) {
+        std::cout << "triangles kept : " << 100.0 * occlusionTriangles / frustumTriangles << "%" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,261 @@
+#include "OcclusionCuller.hpp"
+#include "GLState.hpp"
+#include "SceneBVH.hpp"
+
+namespace gps {
+
+    constexpr uint64_t BOX_MATRIX_UNIFORM = HashName("boxMatrix");
+
+    // Corners of the unit cube, bit 0 for x, 1 for y, 2 for z
+    static const GLfloat CUBE_CORNERS[8 * 3] = {
+        0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,
+        0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1
+    };
+
+    // Counter-clockwise seen from outside, so back-face culling keeps the near side
+    static const GLubyte CUBE_INDICES[36] = {
+        0, 4, 6,  0, 6, 2,   1, 3, 7,  1, 7, 5,
+        0, 1, 5,  0, 5, 4,   2, 6, 7,  2, 7, 3,
+        0, 2, 3,  0, 3, 1,   4, 5, 7,  4, 7, 6
+    };
+
+    static bool Contains(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& point) {
+        return point.x >= boundsMin.x && point.y >= boundsMin.y && point.z >= boundsMin.z &&
+               point.x <= boundsMax.x && point.y <= boundsMax.y && point.z <= boundsMax.z;
+    }
+
+    OcclusionCuller::OcclusionCuller() : vertexArray(0), vertexBuffer(0), indexBuffer(0), target(GL_ANY_SAMPLES_PASSED),
+                                         viewProjection(1.0f), cameraPosition(0.0f), nearMargin(0.0f), frame(0),
+                                         visibleInterval(8), conditional(0) {
+    }
+
+    OcclusionCuller::~OcclusionCuller() {
+        for (size_t f = 0; f < inFlight.size(); f++) {
+            for (size_t i = 0; i < inFlight[f].size(); i++) {
+                freeQueries.push_back(inFlight[f][i].query);
+            }
+        }
+        for (size_t i = 0; i < issued.size(); i++) {
+            freeQueries.push_back(issued[i].query);
+        }
+        if (!freeQueries.empty()) {
+            glDeleteQueries(freeQueries.size(), freeQueries.data());
+        }
+        GLState::Get().ForgetVertexArray(vertexArray);
+        glDeleteVertexArrays(1, &vertexArray);
+        glDeleteBuffers(1, &vertexBuffer);
+        glDeleteBuffers(1, &indexBuffer);
+    }
+
+    bool OcclusionCuller::IsConservative() {
+        return GLEW_VERSION_4_3 || GLEW_ARB_ES3_compatibility;
+    }
+
+    void OcclusionCuller::Init() {
+        target = IsConservative() ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE : GL_ANY_SAMPLES_PASSED;
+
+        GLState& state = GLState::Get();
+        glGenVertexArrays(1, &vertexArray);
+        glGenBuffers(1, &vertexBuffer);
+        glGenBuffers(1, &indexBuffer);
+        state.BindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(CUBE_CORNERS), CUBE_CORNERS, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(CUBE_INDICES), CUBE_INDICES, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        state.BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void OcclusionCuller::Begin(const glm::mat4& view, const glm::mat4& projection) {
+        // last frame's queries join the ones still waiting
+        for (size_t i = 0; i < issued.size(); i++) {
+            nodes[issued[i].node].query = 0;
+        }
+        if (!issued.empty()) {
+            inFlight.push_back(std::vector<BoxQuery>());
+            inFlight.back().swap(issued);
+        }
+        CollectResults();
+
+        frame++;
+        conditional = 0;
+        viewProjection = projection * view;
+        // the inverse of a rigid view matrix moves the origin back to the camera
+        cameraPosition = -(glm::transpose(glm::mat3(view)) * glm::vec3(view[3]));
+        // the near distance of a perspective projection, with room for the corners of the near plane
+        nearMargin = 2.0f * projection[3][2] / (projection[2][2] - 1.0f);
+    }
+
+    // Queries finish in the order they were issued, so waiting frames are taken strictly oldest first
+    void OcclusionCuller::CollectResults() {
+        while (!inFlight.empty()) {
+            std::vector<BoxQuery>& queries = inFlight.front();
+            GLuint available = GL_TRUE;
+            for (size_t i = queries.size(); i-- > 0 && available;) {
+                glGetQueryObjectuiv(queries[i].query, GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (!available) {
+                return;
+            }
+            for (size_t i = 0; i < queries.size(); i++) {
+                GLuint passed = 0;
+                glGetQueryObjectuiv(queries[i].query, GL_QUERY_RESULT, &passed);
+                Node& node = nodes[queries[i].node];
+                // a node that shows up again is not queried before its interval is over
+                if (passed && !node.visible) {
+                    node.nextTest = frame + visibleInterval;
+                }
+                node.visible = passed != 0;
+                freeQueries.push_back(queries[i].query);
+            }
+            inFlight.pop_front();
+        }
+    }
+
+    uint32_t OcclusionCuller::AddNode() {
+        uint32_t index;
+        if (freeNodes.empty()) {
+            index = nodes.size();
+            nodes.push_back(Node());
+        } else {
+            index = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        Node& node = nodes[index];
+        node.live = true;
+        node.visible = true;
+        node.nextTest = frame + index % visibleInterval;
+        node.query = 0;
+        return index;
+    }
+
+    // Results still on their way for the node are harmless to whoever gets it next - they only decide
+    // whether its draw is conditional
+    void OcclusionCuller::ReleaseNode(uint32_t node) {
+        if (node < nodes.size() && nodes[node].live) {
+            nodes[node].live = false;
+            freeNodes.push_back(node);
+        }
+    }
+
+    bool OcclusionCuller::Test(uint32_t index, const glm::mat4& model, const glm::vec3& boundsMin,
+                               const glm::vec3& boundsMax) {
+        Node& node = nodes[index];
+
+        // the box would be clipped by the near plane and report nothing
+        glm::vec3 worldMin, worldMax;
+        TransformBounds(boundsMin, boundsMax, model, worldMin, worldMax);
+        if (Contains(worldMin - nearMargin, worldMax + nearMargin, cameraPosition)) {
+            node.visible = true;
+            return true;
+        }
+        // too many results outstanding, drawing everything is the safe answer
+        if (node.query == 0 && inFlight.size() >= MAX_FRAMES_IN_FLIGHT) {
+            return true;
+        }
+        if (node.visible && frame < node.nextTest) {
+            return true;
+        }
+
+        if (node.query == 0) {
+            BoxQuery query;
+            query.node = index;
+            if (freeQueries.empty()) {
+                glGenQueries(1, &query.query);
+            } else {
+                query.query = freeQueries.back();
+                freeQueries.pop_back();
+            }
+            glm::vec3 size = boundsMax - boundsMin;
+            glm::mat4 box(1.0f);
+            box[0][0] = size.x;
+            box[1][1] = size.y;
+            box[2][2] = size.z;
+            box[3] = glm::vec4(boundsMin, 1.0f);
+            query.box = viewProjection * model * box;
+            issued.push_back(query);
+            node.query = query.query;
+        }
+        if (node.visible) {
+            node.nextTest = frame + visibleInterval;
+            return true;
+        }
+        conditional++;
+        return false;
+    }
+
+    void OcclusionCuller::DrawQueriesPacket(const gps::DrawPacket& packet) {
+        static_cast<const OcclusionCuller*>(packet.object)->IssueQueries(*packet.shader);
+    }
+
+    // Sorts before every other draw of the pass, so the opaque depth is complete and nothing conditional has
+    // been drawn yet
+    void OcclusionCuller::Submit(gps::RenderQueue& queue, const gps::Shader& shader) {
+        if (issued.empty()) {
+            return;
+        }
+        gps::DrawPacket packet;
+        packet.key = gps::RenderQueue::MakeKey(gps::PASS_OCCLUSION, 0, 0, 0.0f);
+        packet.draw = DrawQueriesPacket;
+        packet.shader = &shader;
+        packet.object = this;
+        packet.item = 0;
+        packet.drawIndex = 0;
+        queue.Submit(packet);
+    }
+
+    // Depth tested only, boxes write neither colour nor depth
+    void OcclusionCuller::IssueQueries(const gps::Shader& shader) const {
+        GLState& state = GLState::Get();
+        shader.useShaderProgram();
+        state.BindVertexArray(vertexArray);
+        state.DepthMask(false);
+        // a box face lying on the surface it bounds still counts
+        state.DepthFunc(GL_LEQUAL);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+        GLint location = shader.GetUniformLocation(BOX_MATRIX_UNIFORM);
+        for (size_t i = 0; i < issued.size(); i++) {
+            glUniformMatrix4fv(location, 1, GL_FALSE, &issued[i].box[0][0]);
+            glBeginQuery(target, issued[i].query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            glEndQuery(target);
+        }
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        state.DepthFunc(GL_LESS);
+        state.DepthMask(true);
+    }
+
+    // GL_QUERY_WAIT holds the GPU until the box is done, not the CPU
+    void OcclusionCuller::BeginConditional(uint32_t node) const {
+        if (nodes[node].query) {
+            glBeginConditionalRender(nodes[node].query, GL_QUERY_WAIT);
+        }
+    }
+
+    void OcclusionCuller::EndConditional(uint32_t node) const {
+        if (nodes[node].query) {
+            glEndConditionalRender();
+        }
+    }
+
+    void OcclusionCuller::SetVisibleInterval(uint32_t frames) {
+        visibleInterval = frames > 0 ? frames : 1;
+    }
+
+    size_t OcclusionCuller::GetQueryCount() const {
+        return issued.size();
+    }
+
+    size_t OcclusionCuller::GetConditionalCount() const {
+        return conditional;
+    }
+
+    size_t OcclusionCuller::GetFramesInFlight() const {
+        return inFlight.size();
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+#include "RenderQueue.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace gps {
+
+    // Hardware occlusion queries on bounding boxes with temporal coherence, after CHC++.
+    // A node keeps the visibility of its last finished query. Nodes visible then are drawn as usual and
+    // queried again every few frames. Nodes hidden then are queried every frame right after the opaque
+    // pass and drawn under conditional rendering on that query, so whatever comes into view still shows up.
+    // Results are read only once GL reports them available - the CPU never waits on the GPU.
+    // GL thread only.
+    class OcclusionCuller
+    {
+    public:
+        // frames of queries waiting for their results before no new ones are issued
+        static const size_t MAX_FRAMES_IN_FLIGHT = 4;
+
+        OcclusionCuller();
+        ~OcclusionCuller();
+
+        // Builds the box geometry and picks the query target - needs the GL context
+        void Init();
+
+        // Takes in the results that have arrived since the last frame, then starts a new one.
+        // Boxes are tested against projection * view.
+        void Begin(const glm::mat4& view, const glm::mat4& projection);
+
+        // A new node starts out visible
+        uint32_t AddNode();
+        void ReleaseNode(uint32_t node);
+
+        // True when the node is drawn as usual this frame. False when it was hidden at its last test - its
+        // draw has to come in PASS_OCCLUSION or later, between BeginConditional and EndConditional.
+        bool Test(uint32_t node, const glm::mat4& model, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        // Queues the frame's box queries at the start of PASS_OCCLUSION, once every node has been tested
+        void Submit(gps::RenderQueue& queue, const gps::Shader& shader);
+
+        // The draws in between only reach the framebuffer if the node's box query of this frame passed
+        void BeginConditional(uint32_t node) const;
+        void EndConditional(uint32_t node) const;
+
+        // Visible nodes are queried again after this many frames, staggered so they do not all come due at once
+        void SetVisibleInterval(uint32_t frames);
+
+        // Queries issued and nodes drawn conditionally in the current frame
+        size_t GetQueryCount() const;
+        size_t GetConditionalCount() const;
+        // Frames whose results have not all arrived yet
+        size_t GetFramesInFlight() const;
+
+        // GL_ANY_SAMPLES_PASSED_CONSERVATIVE is used where available - GL 4.3 or ARB_ES3_compatibility
+        static bool IsConservative();
+
+    private:
+        struct Node {
+            bool live;
+            bool visible;
+            // frame the node is queried again while visible
+            uint32_t nextTest;
+            // query of the current frame, 0 when it is not tested
+            GLuint query;
+        };
+
+        struct BoxQuery {
+            uint32_t node;
+            GLuint query;
+            // unit cube to clip space
+            glm::mat4 box;
+        };
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> freeNodes;
+        std::vector<GLuint> freeQueries;
+        // queries of the current frame, then those of earlier frames still waiting, oldest first
+        std::vector<BoxQuery> issued;
+        std::deque<std::vector<BoxQuery> > inFlight;
+
+        GLuint vertexArray;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        GLenum target;
+
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        // boxes this close to the camera may be cut by the near plane and are drawn without a query
+        float nearMargin;
+        uint32_t frame;
+        uint32_t visibleInterval;
+        size_t conditional;
+
+        // Applies the results of the oldest frames whose queries have all finished
+        void CollectResults();
+        void IssueQueries(const gps::Shader& shader) const;
+        static void DrawQueriesPacket(const gps::DrawPacket& packet);
+
+        OcclusionCuller(const OcclusionCuller&);
+        OcclusionCuller& operator=(const OcclusionCuller&);
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
@@ -0,0 +1,353 @@
+#include "OcclusionRasterizer.hpp"
+#include "Hash.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_RASTERIZER_SSE 1
+#endif
+
+namespace gps {
+
+    static const uint32_t NO_VERTEX = 0xFFFFFFFFu;
+
+    bool MakeOccluder(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices,
+                      size_t indexCount, size_t maxTriangles, float minSize, OccluderMesh& occluder) {
+        if (indexCount < 3 || indexCount / 3 > maxTriangles) {
+            return false;
+        }
+        const char* bytes = static_cast<const char*>(positions);
+        glm::vec3 boundsMin(INFINITY);
+        glm::vec3 boundsMax(-INFINITY);
+        for (size_t i = 0; i < vertexCount; i++) {
+            const glm::vec3& position = *reinterpret_cast<const glm::vec3*>(bytes + i * stride);
+            boundsMin = glm::min(boundsMin, position);
+            boundsMax = glm::max(boundsMax, position);
+        }
+        glm::vec3 size = boundsMax - boundsMin;
+        if (std::max(size.x, std::max(size.y, size.z)) < minSize) {
+            return false;
+        }
+
+        occluder.positions.clear();
+        occluder.indices.clear();
+        std::vector<uint32_t> remap(vertexCount, NO_VERTEX);
+        // a hash collision only costs a vertex that could have been shared
+        std::unordered_map<uint64_t, uint32_t> welded;
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            uint32_t triangle[3];
+            for (int corner = 0; corner < 3; corner++) {
+                uint32_t vertex = indices[i + corner];
+                if (vertex >= vertexCount) {
+                    return false;
+                }
+                if (remap[vertex] == NO_VERTEX) {
+                    const glm::vec3& position = *reinterpret_cast<const glm::vec3*>(bytes + vertex * stride);
+                    uint64_t hash = HashBytes(&position, sizeof(position));
+                    std::unordered_map<uint64_t, uint32_t>::iterator found = welded.find(hash);
+                    if (found != welded.end() && occluder.positions[found->second].x == position.x &&
+                        occluder.positions[found->second].y == position.y &&
+                        occluder.positions[found->second].z == position.z) {
+                        remap[vertex] = found->second;
+                    } else {
+                        remap[vertex] = occluder.positions.size();
+                        welded[hash] = remap[vertex];
+                        occluder.positions.push_back(position);
+                    }
+                }
+                triangle[corner] = remap[vertex];
+            }
+            // welding can collapse a triangle
+            if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0]) {
+                continue;
+            }
+            occluder.indices.insert(occluder.indices.end(), triangle, triangle + 3);
+        }
+        return !occluder.indices.empty();
+    }
+
+    OcclusionRasterizer::OcclusionRasterizer(unsigned threadCount)
+        : threadCount(threadCount), viewProjection(1.0f), nearW(0.0f), rendered(false), activeChunks(0),
+          triangleCount(0), tested(0), occluded(0), renderMs(0.0) {
+    }
+
+    // The near distance is read from a perspective projection
+    void OcclusionRasterizer::Begin(const glm::mat4& view, const glm::mat4& projection) {
+        viewProjection = projection * view;
+        nearW = projection[3][2] / (projection[2][2] - 1.0f);
+        depth.assign(WIDTH * HEIGHT, 0.0f);
+        occluders.clear();
+        rendered = false;
+        activeChunks = 0;
+        triangleCount = 0;
+        tested = 0;
+        occluded = 0;
+        renderMs = 0.0;
+    }
+
+    void OcclusionRasterizer::AddOccluder(const glm::mat4& model, const OccluderMesh& mesh) {
+        Occluder occluder;
+        occluder.modelViewProjection = viewProjection * model;
+        occluder.mesh = &mesh;
+        occluders.push_back(occluder);
+    }
+
+    // Setup and binning per group of occluders, then each tile on its own - no two workers write the same pixel
+    void OcclusionRasterizer::Render() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        rendered = true;
+        if (occluders.empty()) {
+            return;
+        }
+        if (!pool) {
+            pool.reset(new gps::ThreadPool(threadCount));
+        }
+
+        activeChunks = std::min(occluders.size(), (size_t)pool->GetThreadCount() * 2);
+        if (chunks.size() < activeChunks) {
+            chunks.resize(activeChunks);
+        }
+        pool->ParallelFor(activeChunks, [this](size_t chunk) {
+            SetupChunk(chunk, occluders.size() * chunk / activeChunks, occluders.size() * (chunk + 1) / activeChunks);
+        });
+        pool->ParallelFor(TILES_X * TILES_Y, [this](size_t tile) {
+            RasterizeTile(tile);
+        });
+
+        for (size_t c = 0; c < activeChunks; c++) {
+            triangleCount += chunks[c].triangles.size();
+        }
+        renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void OcclusionRasterizer::SetupChunk(size_t chunkIndex, size_t firstOccluder, size_t endOccluder) {
+        Chunk& chunk = chunks[chunkIndex];
+        chunk.triangles.clear();
+        for (int tile = 0; tile < TILES_X * TILES_Y; tile++) {
+            chunk.bins[tile].clear();
+        }
+
+        for (size_t o = firstOccluder; o < endOccluder; o++) {
+            const OccluderMesh& mesh = *occluders[o].mesh;
+            const glm::mat4& matrix = occluders[o].modelViewProjection;
+            chunk.clip.resize(mesh.positions.size());
+            for (size_t i = 0; i < mesh.positions.size(); i++) {
+                chunk.clip[i] = matrix * glm::vec4(mesh.positions[i], 1.0f);
+            }
+
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                float x[3], y[3], z[3];
+                bool clipped = false;
+                for (int corner = 0; corner < 3; corner++) {
+                    const glm::vec4& clip = chunk.clip[mesh.indices[i + corner]];
+                    // GL clips this part away, it hides nothing
+                    if (!(clip.w >= nearW)) {
+                        clipped = true;
+                        break;
+                    }
+                    z[corner] = 1.0f / clip.w;
+                    x[corner] = (clip.x * z[corner] * 0.5f + 0.5f) * WIDTH;
+                    y[corner] = (clip.y * z[corner] * 0.5f + 0.5f) * HEIGHT;
+                }
+                if (clipped) {
+                    continue;
+                }
+                // counter-clockwise front faces, y points up like in NDC
+                float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+                if (!(area > 0.0f)) {
+                    continue;
+                }
+
+                // pixels whose centres lie in the triangle's box
+                float minX = std::min(x[0], std::min(x[1], x[2])) - 0.5f;
+                float maxX = std::max(x[0], std::max(x[1], x[2])) - 0.5f;
+                float minY = std::min(y[0], std::min(y[1], y[2])) - 0.5f;
+                float maxY = std::max(y[0], std::max(y[1], y[2])) - 0.5f;
+                ScreenTriangle triangle;
+                triangle.minX = (int)std::ceil(std::max(minX, 0.0f));
+                triangle.maxX = (int)std::floor(std::min(maxX, (float)(WIDTH - 1)));
+                triangle.minY = (int)std::ceil(std::max(minY, 0.0f));
+                triangle.maxY = (int)std::floor(std::min(maxY, (float)(HEIGHT - 1)));
+                if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+                    continue;
+                }
+
+                // edge e runs from corner e to the next one, its function weighs the opposite corner
+                for (int e = 0; e < 3; e++) {
+                    int next = (e + 1) % 3;
+                    triangle.edgeA[e] = y[e] - y[next];
+                    triangle.edgeB[e] = x[next] - x[e];
+                    triangle.edgeC[e] = x[e] * y[next] - x[next] * y[e];
+                }
+                float inverseArea = 1.0f / area;
+                triangle.depthA = (triangle.edgeA[1] * z[0] + triangle.edgeA[2] * z[1] + triangle.edgeA[0] * z[2]) * inverseArea;
+                triangle.depthB = (triangle.edgeB[1] * z[0] + triangle.edgeB[2] * z[1] + triangle.edgeB[0] * z[2]) * inverseArea;
+                triangle.depthC = (triangle.edgeC[1] * z[0] + triangle.edgeC[2] * z[1] + triangle.edgeC[0] * z[2]) * inverseArea;
+
+                uint32_t index = chunk.triangles.size();
+                chunk.triangles.push_back(triangle);
+                for (int tileY = triangle.minY / TILE_SIZE; tileY <= triangle.maxY / TILE_SIZE; tileY++) {
+                    for (int tileX = triangle.minX / TILE_SIZE; tileX <= triangle.maxX / TILE_SIZE; tileX++) {
+                        chunk.bins[tileY * TILES_X + tileX].push_back(index);
+                    }
+                }
+            }
+        }
+    }
+
+    // Chunks are walked in order, so the result does not depend on which worker finished first
+    void OcclusionRasterizer::RasterizeTile(size_t tile) {
+        int tileX = tile % TILES_X;
+        int tileY = tile / TILES_X;
+        for (size_t c = 0; c < activeChunks; c++) {
+            const Chunk& chunk = chunks[c];
+            const std::vector<uint32_t>& bin = chunk.bins[tile];
+            for (size_t i = 0; i < bin.size(); i++) {
+                DrawTriangle(chunk.triangles[bin[i]], tileX, tileY);
+            }
+        }
+    }
+
+    // Keeps the closest depth, tiles are a multiple of 4 wide so the groups of 4 never leave the tile
+    void OcclusionRasterizer::DrawTriangle(const ScreenTriangle& triangle, int tileX, int tileY) {
+        int startX = std::max(triangle.minX, tileX * TILE_SIZE) & ~3;
+        int endX = std::min(triangle.maxX, tileX * TILE_SIZE + TILE_SIZE - 1);
+        int startY = std::max(triangle.minY, tileY * TILE_SIZE);
+        int endY = std::min(triangle.maxY, tileY * TILE_SIZE + TILE_SIZE - 1);
+
+        for (int y = startY; y <= endY; y++) {
+            float centreY = y + 0.5f;
+            float row0 = triangle.edgeB[0] * centreY + triangle.edgeC[0];
+            float row1 = triangle.edgeB[1] * centreY + triangle.edgeC[1];
+            float row2 = triangle.edgeB[2] * centreY + triangle.edgeC[2];
+            float rowDepth = triangle.depthB * centreY + triangle.depthC;
+            float* pixels = &depth[y * WIDTH];
+#ifdef GPS_RASTERIZER_SSE
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 four = _mm_set1_ps(4.0f);
+            const __m128 a0 = _mm_set1_ps(triangle.edgeA[0]);
+            const __m128 a1 = _mm_set1_ps(triangle.edgeA[1]);
+            const __m128 a2 = _mm_set1_ps(triangle.edgeA[2]);
+            const __m128 depthA = _mm_set1_ps(triangle.depthA);
+            const __m128 r0 = _mm_set1_ps(row0);
+            const __m128 r1 = _mm_set1_ps(row1);
+            const __m128 r2 = _mm_set1_ps(row2);
+            const __m128 rz = _mm_set1_ps(rowDepth);
+            __m128 centreX = _mm_add_ps(_mm_set1_ps((float)startX), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            for (int x = startX; x <= endX; x += 4) {
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centreX), r0), zero);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centreX), r1), zero));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centreX), r2), zero));
+                if (_mm_movemask_ps(inside)) {
+                    __m128 z = _mm_add_ps(_mm_mul_ps(depthA, centreX), rz);
+                    __m128 stored = _mm_loadu_ps(pixels + x);
+                    __m128 closest = _mm_max_ps(stored, z);
+                    _mm_storeu_ps(pixels + x, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, stored)));
+                }
+                centreX = _mm_add_ps(centreX, four);
+            }
+#else
+            for (int x = startX; x <= endX; x++) {
+                float centreX = x + 0.5f;
+                if (triangle.edgeA[0] * centreX + row0 >= 0.0f && triangle.edgeA[1] * centreX + row1 >= 0.0f &&
+                    triangle.edgeA[2] * centreX + row2 >= 0.0f) {
+                    pixels[x] = std::max(pixels[x], triangle.depthA * centreX + rowDepth);
+                }
+            }
+#endif
+        }
+    }
+
+    bool OcclusionRasterizer::IsVisible(const glm::mat4& modelViewProjection, const glm::vec3& boundsMin,
+                                        const glm::vec3& boundsMax) {
+        tested++;
+        if (!rendered) {
+            return true;
+        }
+
+        float minX = INFINITY, maxX = -INFINITY;
+        float minY = INFINITY, maxY = -INFINITY;
+        float closest = 0.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec4 position((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y,
+                               (corner & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+            glm::vec4 clip = modelViewProjection * position;
+            // reaches past the near plane, the box is around the camera
+            if (!(clip.w >= nearW)) {
+                return true;
+            }
+            float z = 1.0f / clip.w;
+            float x = (clip.x * z * 0.5f + 0.5f) * WIDTH;
+            float y = (clip.y * z * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            closest = std::max(closest, z);
+        }
+
+        // every pixel the box's screen rectangle touches
+        int startX = (int)std::floor(std::max(minX, 0.0f));
+        int endX = (int)std::floor(std::min(maxX, (float)(WIDTH - 1)));
+        int startY = (int)std::floor(std::max(minY, 0.0f));
+        int endY = (int)std::floor(std::min(maxY, (float)(HEIGHT - 1)));
+        // off screen, that is for the frustum test to decide
+        if (startX > endX || startY > endY) {
+            return true;
+        }
+
+        // visible as soon as one pixel holds nothing closer than the box's nearest corner
+        for (int y = startY; y <= endY; y++) {
+            const float* pixels = &depth[y * WIDTH];
+#ifdef GPS_RASTERIZER_SSE
+            const __m128 box = _mm_set1_ps(closest);
+            // widened to groups of 4, the extra pixels can only make it visible
+            for (int x = startX & ~3; x <= endX; x += 4) {
+                if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(pixels + x), box))) {
+                    return true;
+                }
+            }
+#else
+            for (int x = startX; x <= endX; x++) {
+                if (pixels[x] <= closest) {
+                    return true;
+                }
+            }
+#endif
+        }
+        occluded++;
+        return false;
+    }
+
+    const glm::mat4& OcclusionRasterizer::GetViewProjection() const {
+        return viewProjection;
+    }
+
+    size_t OcclusionRasterizer::GetOccluderCount() const {
+        return occluders.size();
+    }
+
+    size_t OcclusionRasterizer::GetTriangleCount() const {
+        return triangleCount;
+    }
+
+    size_t OcclusionRasterizer::GetTestedCount() const {
+        return tested;
+    }
+
+    size_t OcclusionRasterizer::GetOccludedCount() const {
+        return occluded;
+    }
+
+    double OcclusionRasterizer::GetRenderMs() const {
+        return renderMs;
+    }
+
+    const std::vector<float>& OcclusionRasterizer::GetDepth() const {
+        return depth;
+    }
+}
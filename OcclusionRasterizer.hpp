@@ -0,0 +1,118 @@
+#ifndef OcclusionRasterizer_hpp
+#define OcclusionRasterizer_hpp
+
+#include "glm/glm.hpp"
+
+#include "ThreadPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+    // Positions and triangles of a mesh kept on the CPU to hide others, in the mesh's object space
+    struct OccluderMesh {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        // where copies of an instanced mesh go relative to the model - empty when drawn once, as it is
+        std::vector<glm::mat4> placements;
+    };
+
+    // Fills occluder when the mesh is worth drawing into the depth buffer - at most maxTriangles triangles
+    // and a box at least minSize wide along some axis. Vertices are welded on position, since normals and
+    // texture coordinates do not matter here. positions is read every stride bytes.
+    bool MakeOccluder(const void* positions, size_t stride, size_t vertexCount, const uint32_t* indices,
+                      size_t indexCount, size_t maxTriangles, float minSize, OccluderMesh& occluder);
+
+    // Occlusion culling on the CPU, with no GPU round trip. Occluders are rasterized into a small depth
+    // buffer each frame - split into tiles that the workers fill in parallel, 4 pixels at a time with SSE -
+    // and mesh boxes are tested against it before they are submitted.
+    // Depth is stored as 1 / w, larger is closer and 0 is empty. Pixels are covered at their centres, so
+    // occluder edges are accurate to a buffer pixel. Triangles crossing the near plane are left out, as are
+    // back faces - a wall seen from behind is culled by GL as well.
+    class OcclusionRasterizer
+    {
+    public:
+        static const int WIDTH = 320;
+        static const int HEIGHT = 192;
+        static const int TILE_SIZE = 32;
+        static const int TILES_X = WIDTH / TILE_SIZE;
+        static const int TILES_Y = HEIGHT / TILE_SIZE;
+
+        // 0 threads = one per hardware thread, started on the first Render
+        explicit OcclusionRasterizer(unsigned threadCount = 0);
+
+        // Empties the buffer and the occluder list - until Render everything counts as visible
+        void Begin(const glm::mat4& view, const glm::mat4& projection);
+
+        // The mesh is only read in Render, it has to stay where it is until then
+        void AddOccluder(const glm::mat4& model, const OccluderMesh& mesh);
+
+        // Draws every occluder added since Begin, returns once the whole buffer is done
+        void Render();
+
+        // False when the box is behind the occluders at every pixel it covers.
+        // modelViewProjection takes the box's space to clip space.
+        bool IsVisible(const glm::mat4& modelViewProjection, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        const glm::mat4& GetViewProjection() const;
+
+        // Counters of the current frame
+        size_t GetOccluderCount() const;
+        size_t GetTriangleCount() const;
+        size_t GetTestedCount() const;
+        size_t GetOccludedCount() const;
+        double GetRenderMs() const;
+
+        const std::vector<float>& GetDepth() const;
+
+    private:
+        // Edge functions A x + B y + C are positive inside, depth is interpolated the same way
+        struct ScreenTriangle {
+            float edgeA[3], edgeB[3], edgeC[3];
+            float depthA, depthB, depthC;
+            // inclusive pixel bounds, inside the buffer
+            int minX, minY, maxX, maxY;
+        };
+
+        struct Occluder {
+            glm::mat4 modelViewProjection;
+            const OccluderMesh* mesh;
+        };
+
+        // Triangles set up by one worker and the tiles each of them touches
+        struct Chunk {
+            std::vector<glm::vec4> clip;
+            std::vector<ScreenTriangle> triangles;
+            std::vector<uint32_t> bins[TILES_X * TILES_Y];
+        };
+
+        unsigned threadCount;
+        std::unique_ptr<gps::ThreadPool> pool;
+
+        glm::mat4 viewProjection;
+        float nearW;
+        bool rendered;
+        std::vector<float> depth;
+        std::vector<Occluder> occluders;
+        std::vector<Chunk> chunks;
+        // chunks filled this frame
+        size_t activeChunks;
+
+        size_t triangleCount;
+        size_t tested;
+        size_t occluded;
+        double renderMs;
+
+        void SetupChunk(size_t chunk, size_t firstOccluder, size_t endOccluder);
+        void RasterizeTile(size_t tile);
+        void DrawTriangle(const ScreenTriangle& triangle, int tileX, int tileY);
+
+        OcclusionRasterizer(const OcclusionRasterizer&);
+        OcclusionRasterizer& operator=(const OcclusionRasterizer&);
+    };
+}
+
+#endif /* OcclusionRasterizer_hpp */
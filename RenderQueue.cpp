@@ -0,0 +1,123 @@
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    static const int PASS_SHIFT = 62;
+    static const uint64_t PROGRAM_MASK = 0xFF;
+    static const uint64_t MATERIAL_MASK = 0x3FFFFF;
+
+    // Non-negative floats order like their bit patterns
+    static uint32_t DepthBits(float depth) {
+        if (!(depth > 0.0f)) {
+            return 0;
+        }
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        return bits;
+    }
+
+    RenderQueue::RenderQueue() : view(1.0f), viewProjection(1.0f), tested(0), culled(0) {
+    }
+
+    void RenderQueue::Begin(const glm::mat4& view, const glm::mat4& projection) {
+        this->view = view;
+        viewProjection = projection * view;
+        tested = 0;
+        culled = 0;
+        packets.clear();
+    }
+
+    const glm::mat4& RenderQueue::GetViewProjection() const {
+        return viewProjection;
+    }
+
+    void RenderQueue::CountCulled(size_t tested, size_t culled) {
+        this->tested += tested;
+        this->culled += culled;
+    }
+
+    size_t RenderQueue::GetTestedCount() const {
+        return tested;
+    }
+
+    size_t RenderQueue::GetCulledCount() const {
+        return culled;
+    }
+
+    float RenderQueue::ViewDepth(const glm::vec3& worldPosition) const {
+        return -(view * glm::vec4(worldPosition, 1.0f)).z;
+    }
+
+    uint64_t RenderQueue::MakeKey(RenderPass pass, GLuint program, GLuint material, float depth) {
+        uint64_t key = (uint64_t)pass << PASS_SHIFT;
+        uint64_t state = ((program & PROGRAM_MASK) << 22) | (material & MATERIAL_MASK);
+        uint64_t depthBits = DepthBits(depth);
+        if (pass == PASS_BLENDED) {
+            return key | ((uint64_t)(~depthBits & 0xFFFFFFFFu) << 30) | state;
+        }
+        return key | (state << 32) | depthBits;
+    }
+
+    void RenderQueue::Submit(const DrawPacket& packet) {
+        packets.push_back(packet);
+    }
+
+    size_t RenderQueue::GetPacketCount() const {
+        return packets.size();
+    }
+
+    // LSD radix sort, a byte per pass - bytes every key shares are skipped
+    void RenderQueue::Sort() {
+        order.resize(packets.size());
+        scratch.resize(packets.size());
+        for (size_t i = 0; i < packets.size(); i++) {
+            order[i] = std::make_pair(packets[i].key, (uint32_t)i);
+        }
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            size_t counts[256] = {0};
+            for (size_t i = 0; i < order.size(); i++) {
+                counts[(order[i].first >> shift) & 0xFF]++;
+            }
+            if (order.empty() || counts[(order[0].first >> shift) & 0xFF] == order.size()) {
+                continue;
+            }
+            size_t offset = 0;
+            for (int b = 0; b < 256; b++) {
+                size_t count = counts[b];
+                counts[b] = offset;
+                offset += count;
+            }
+            for (size_t i = 0; i < order.size(); i++) {
+                scratch[counts[(order[i].first >> shift) & 0xFF]++] = order[i];
+            }
+            order.swap(scratch);
+        }
+    }
+
+    // Blended geometry is tested against the depth buffer but does not write it
+    void RenderQueue::BeginPass(RenderPass pass) {
+        GLState& state = GLState::Get();
+        state.Blend(pass == PASS_BLENDED);
+        state.DepthMask(pass != PASS_BLENDED);
+    }
+
+    void RenderQueue::Execute() {
+        Sort();
+        BeginPass(PASS_OPAQUE);
+        uint64_t pass = PASS_OPAQUE;
+        for (size_t i = 0; i < order.size(); i++) {
+            const DrawPacket& packet = packets[order[i].second];
+            if (packet.key >> PASS_SHIFT != pass) {
+                pass = packet.key >> PASS_SHIFT;
+                BeginPass((RenderPass)pass);
+            }
+            packet.draw(packet);
+        }
+        // the next frame clears depth, which needs writes enabled
+        BeginPass(PASS_OPAQUE);
+    }
+}
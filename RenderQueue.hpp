@@ -0,0 +1,84 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Passes run in this order - the sky after the opaques so their depth rejects most of it.
+    // The occlusion pass draws what was hidden last frame, once the opaque depth is there to test it against.
+    enum RenderPass {
+        PASS_OPAQUE = 0,
+        PASS_OCCLUSION = 1,
+        PASS_SKY = 2,
+        PASS_BLENDED = 3
+    };
+
+    struct DrawPacket;
+    typedef void (*DrawFunction)(const DrawPacket& packet);
+
+    // One draw, with what its system needs to issue it. The packet is drawn when its key comes up.
+    struct DrawPacket {
+        uint64_t key;
+        DrawFunction draw;
+        const gps::Shader* shader;
+        void* object;
+        size_t item;
+        // DrawDataRing slot written at submission
+        GLuint drawIndex;
+    };
+
+    // Collects the frame's draws and issues them ordered by a packed 64 bit key:
+    //   opaque, occlusion, sky: pass (2) | program (8) | material (22) | depth front to back (32)
+    //   blended:                pass (2) | depth back to front (32) | program (8) | material (22)
+    // so opaque draws group by state and then hit early-Z, while blended ones are composited in order.
+    class RenderQueue
+    {
+    public:
+        RenderQueue();
+
+        // Clears last frame's packets and counters. Depths are measured along the view direction of this
+        // camera, systems cull against projection * view.
+        void Begin(const glm::mat4& view, const glm::mat4& projection);
+
+        const glm::mat4& GetViewProjection() const;
+
+        // Draws the systems tested against the frustum this frame and how many of them were left out
+        void CountCulled(size_t tested, size_t culled);
+        size_t GetTestedCount() const;
+        size_t GetCulledCount() const;
+
+        // Distance of a world space point in front of the camera
+        float ViewDepth(const glm::vec3& worldPosition) const;
+
+        static uint64_t MakeKey(RenderPass pass, GLuint program, GLuint material, float depth);
+
+        void Submit(const DrawPacket& packet);
+
+        // Sorts and draws everything submitted since Begin
+        void Execute();
+
+        size_t GetPacketCount() const;
+
+    private:
+        glm::mat4 view;
+        glm::mat4 viewProjection;
+        size_t tested;
+        size_t culled;
+        std::vector<DrawPacket> packets;
+        // key and packet index, sorted in place of the packets
+        std::vector<std::pair<uint64_t, uint32_t> > order;
+        std::vector<std::pair<uint64_t, uint32_t> > scratch;
+
+        void Sort();
+        static void BeginPass(RenderPass pass);
+    };
+}
+
+#endif /* RenderQueue_hpp */
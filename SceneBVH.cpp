@@ -0,0 +1,455 @@
+#include "SceneBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GPS_BVH_SSE 1
+#endif
+
+namespace gps {
+
+    static const int SAH_BINS = 16;
+
+    void TransformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& matrix,
+                         glm::vec3& outMin, glm::vec3& outMax) {
+        glm::vec3 corners[2] = {boundsMin, boundsMax};
+        for (int c = 0; c < 8; c++) {
+            glm::vec3 corner(corners[c & 1].x, corners[(c >> 1) & 1].y, corners[(c >> 2) & 1].z);
+            glm::vec3 placed = glm::vec3(matrix * glm::vec4(corner, 1.0f));
+            outMin = c == 0 ? placed : glm::min(outMin, placed);
+            outMax = c == 0 ? placed : glm::max(outMax, placed);
+        }
+    }
+
+    static float SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+        glm::vec3 size = boundsMax - boundsMin;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    SceneBVH::SceneBVH() {
+    }
+
+    void SceneBVH::Clear() {
+        items.clear();
+        itemOrder.clear();
+        nodes.clear();
+        nodeParent.clear();
+        nodeSlot.clear();
+        itemNode.clear();
+        itemSlot.clear();
+    }
+
+    size_t SceneBVH::GetItemCount() const {
+        return items.size();
+    }
+
+    size_t SceneBVH::GetNodeCount() const {
+        return nodes.size();
+    }
+
+    const BVHItem& SceneBVH::GetItem(uint32_t item) const {
+        return items[item];
+    }
+
+    void SceneBVH::Build(const std::vector<BVHItem>& items) {
+        Clear();
+        if (items.empty()) {
+            return;
+        }
+        this->items = items;
+        itemOrder.resize(items.size());
+        itemNode.resize(items.size());
+        itemSlot.resize(items.size());
+        std::vector<glm::vec3> centroids(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            itemOrder[i] = i;
+            centroids[i] = (items[i].boundsMin + items[i].boundsMax) * 0.5f;
+        }
+
+        // a binary tree first, its levels are then folded into 4 wide nodes
+        std::vector<BuildNode> buildNodes;
+        buildNodes.reserve(2 * items.size() / LEAF_SIZE + 1);
+        uint32_t root = BuildBinary(buildNodes, centroids, 0, items.size());
+        nodes.reserve(buildNodes.size() / 3 + 1);
+        Collapse(buildNodes, root, EMPTY, 0);
+    }
+
+    uint32_t SceneBVH::BuildBinary(std::vector<BuildNode>& buildNodes, const std::vector<glm::vec3>& centroids,
+                                   uint32_t first, uint32_t count) {
+        BuildNode node;
+        node.first = first;
+        node.count = count;
+        node.left = node.right = EMPTY;
+        node.boundsMin = items[itemOrder[first]].boundsMin;
+        node.boundsMax = items[itemOrder[first]].boundsMax;
+        glm::vec3 centroidMin = centroids[itemOrder[first]];
+        glm::vec3 centroidMax = centroidMin;
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            node.boundsMin = glm::min(node.boundsMin, items[itemOrder[i]].boundsMin);
+            node.boundsMax = glm::max(node.boundsMax, items[itemOrder[i]].boundsMax);
+            centroidMin = glm::min(centroidMin, centroids[itemOrder[i]]);
+            centroidMax = glm::max(centroidMax, centroids[itemOrder[i]]);
+        }
+        uint32_t index = buildNodes.size();
+        buildNodes.push_back(node);
+        if (count <= LEAF_SIZE) {
+            return index;
+        }
+
+        // split the centroids' widest axis where the children's area times item count is smallest
+        glm::vec3 extent = centroidMax - centroidMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t* begin = &itemOrder[first];
+        uint32_t* end = begin + count;
+        uint32_t* middle = begin + count / 2;
+        if (extent[axis] > 0.0f) {
+            float scale = SAH_BINS / extent[axis];
+            uint32_t binCount[SAH_BINS] = {0};
+            glm::vec3 binMin[SAH_BINS];
+            glm::vec3 binMax[SAH_BINS];
+            for (uint32_t* it = begin; it != end; ++it) {
+                int bin = std::min(SAH_BINS - 1, (int)((centroids[*it][axis] - centroidMin[axis]) * scale));
+                binMin[bin] = binCount[bin] ? glm::min(binMin[bin], items[*it].boundsMin) : items[*it].boundsMin;
+                binMax[bin] = binCount[bin] ? glm::max(binMax[bin], items[*it].boundsMax) : items[*it].boundsMax;
+                binCount[bin]++;
+            }
+
+            // areas of everything right of each split plane, swept from the right
+            float rightCost[SAH_BINS];
+            uint32_t rightCount = 0;
+            glm::vec3 sweepMin, sweepMax;
+            for (int b = SAH_BINS - 1; b > 0; b--) {
+                if (binCount[b]) {
+                    sweepMin = rightCount ? glm::min(sweepMin, binMin[b]) : binMin[b];
+                    sweepMax = rightCount ? glm::max(sweepMax, binMax[b]) : binMax[b];
+                    rightCount += binCount[b];
+                }
+                rightCost[b] = rightCount ? SurfaceArea(sweepMin, sweepMax) * rightCount : 0.0f;
+            }
+            int bestSplit = 0;
+            float bestCost = INFINITY;
+            uint32_t leftCount = 0;
+            for (int b = 0; b < SAH_BINS - 1; b++) {
+                if (binCount[b]) {
+                    sweepMin = leftCount ? glm::min(sweepMin, binMin[b]) : binMin[b];
+                    sweepMax = leftCount ? glm::max(sweepMax, binMax[b]) : binMax[b];
+                    leftCount += binCount[b];
+                }
+                float cost = leftCount ? SurfaceArea(sweepMin, sweepMax) * leftCount + rightCost[b + 1] : INFINITY;
+                if (leftCount < count && cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = b + 1;
+                }
+            }
+            if (bestSplit > 0) {
+                middle = std::partition(begin, end, [&](uint32_t item) {
+                    return std::min(SAH_BINS - 1, (int)((centroids[item][axis] - centroidMin[axis]) * scale)) < bestSplit;
+                });
+            }
+        }
+        // all centroids in one spot, or a split that left one side empty - halve by position instead
+        if (middle == begin || middle == end) {
+            middle = begin + count / 2;
+            std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+        }
+
+        uint32_t leftCountItems = middle - begin;
+        uint32_t left = BuildBinary(buildNodes, centroids, first, leftCountItems);
+        uint32_t right = BuildBinary(buildNodes, centroids, first + leftCountItems, count - leftCountItems);
+        buildNodes[index].left = left;
+        buildNodes[index].right = right;
+        return index;
+    }
+
+    void SceneBVH::SetSlot(Node& node, int slot, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+        node.minX[slot] = boundsMin.x;
+        node.minY[slot] = boundsMin.y;
+        node.minZ[slot] = boundsMin.z;
+        node.maxX[slot] = boundsMax.x;
+        node.maxY[slot] = boundsMax.y;
+        node.maxZ[slot] = boundsMax.z;
+    }
+
+    // Pulls the binary node's grandchildren up until it has 4 children, opening the largest first
+    uint32_t SceneBVH::Collapse(const std::vector<BuildNode>& buildNodes, uint32_t buildNode, uint32_t parent, uint8_t slot) {
+        uint32_t children[4];
+        int childCount = 0;
+        if (buildNodes[buildNode].left == EMPTY) {
+            children[childCount++] = buildNode;
+        } else {
+            children[childCount++] = buildNodes[buildNode].left;
+            children[childCount++] = buildNodes[buildNode].right;
+        }
+        while (childCount < 4) {
+            int largest = -1;
+            float largestArea = -1.0f;
+            for (int c = 0; c < childCount; c++) {
+                const BuildNode& child = buildNodes[children[c]];
+                float area = SurfaceArea(child.boundsMin, child.boundsMax);
+                if (child.left != EMPTY && area > largestArea) {
+                    largest = c;
+                    largestArea = area;
+                }
+            }
+            if (largest < 0) {
+                break;
+            }
+            const BuildNode& opened = buildNodes[children[largest]];
+            children[largest] = opened.left;
+            children[childCount++] = opened.right;
+        }
+
+        uint32_t index = nodes.size();
+        nodes.push_back(Node());
+        nodeParent.push_back(parent);
+        nodeSlot.push_back(slot);
+        // empty slots hold an inverted box that no query accepts
+        for (int s = 0; s < 4; s++) {
+            SetSlot(nodes[index], s, glm::vec3(INFINITY), glm::vec3(-INFINITY));
+            nodes[index].child[s] = EMPTY;
+            nodes[index].count[s] = 0;
+        }
+
+        for (int s = 0; s < childCount; s++) {
+            const BuildNode& child = buildNodes[children[s]];
+            SetSlot(nodes[index], s, child.boundsMin, child.boundsMax);
+            if (child.left == EMPTY) {
+                nodes[index].child[s] = LEAF | child.first;
+                nodes[index].count[s] = child.count;
+                for (uint32_t i = child.first; i < child.first + child.count; i++) {
+                    itemNode[itemOrder[i]] = index;
+                    itemSlot[itemOrder[i]] = s;
+                }
+            } else {
+                // nodes may reallocate while the subtree is added
+                uint32_t childIndex = Collapse(buildNodes, children[s], index, s);
+                nodes[index].child[s] = childIndex;
+            }
+        }
+        return index;
+    }
+
+    void SceneBVH::LeafBounds(const Node& node, int slot, glm::vec3& boundsMin, glm::vec3& boundsMax) const {
+        uint32_t first = node.child[slot] & ~LEAF;
+        boundsMin = items[itemOrder[first]].boundsMin;
+        boundsMax = items[itemOrder[first]].boundsMax;
+        for (uint32_t i = first + 1; i < first + node.count[slot]; i++) {
+            boundsMin = glm::min(boundsMin, items[itemOrder[i]].boundsMin);
+            boundsMax = glm::max(boundsMax, items[itemOrder[i]].boundsMax);
+        }
+    }
+
+    void SceneBVH::Refit(uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+        if (item >= items.size()) {
+            return;
+        }
+        items[item].boundsMin = boundsMin;
+        items[item].boundsMax = boundsMax;
+
+        uint32_t node = itemNode[item];
+        glm::vec3 slotMin, slotMax;
+        LeafBounds(nodes[node], itemSlot[item], slotMin, slotMax);
+        SetSlot(nodes[node], itemSlot[item], slotMin, slotMax);
+
+        // up to the root, or to the first ancestor whose box stays the same
+        while (nodeParent[node] != EMPTY) {
+            const Node& current = nodes[node];
+            glm::vec3 unionMin(current.minX[0], current.minY[0], current.minZ[0]);
+            glm::vec3 unionMax(current.maxX[0], current.maxY[0], current.maxZ[0]);
+            for (int s = 1; s < 4; s++) {
+                if (current.child[s] != EMPTY) {
+                    unionMin = glm::min(unionMin, glm::vec3(current.minX[s], current.minY[s], current.minZ[s]));
+                    unionMax = glm::max(unionMax, glm::vec3(current.maxX[s], current.maxY[s], current.maxZ[s]));
+                }
+            }
+            Node& parent = nodes[nodeParent[node]];
+            int slot = nodeSlot[node];
+            if (parent.minX[slot] == unionMin.x && parent.minY[slot] == unionMin.y && parent.minZ[slot] == unionMin.z &&
+                parent.maxX[slot] == unionMax.x && parent.maxY[slot] == unionMax.y && parent.maxZ[slot] == unionMax.z) {
+                break;
+            }
+            SetSlot(parent, slot, unionMin, unionMax);
+            node = nodeParent[node];
+        }
+    }
+
+    // Bit per child whose box is not fully outside one of the frustum planes
+    static int OverlapFrustum(const float* minX, const float* minY, const float* minZ, const float* maxX,
+                              const float* maxY, const float* maxZ, const Frustum& frustum) {
+#ifdef GPS_BVH_SSE
+        __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+        for (int p = 0; p < 6; p++) {
+            const glm::vec4& plane = frustum.GetPlane(p);
+            __m128 x = _mm_loadu_ps(plane.x > 0.0f ? maxX : minX);
+            __m128 y = _mm_loadu_ps(plane.y > 0.0f ? maxY : minY);
+            __m128 z = _mm_loadu_ps(plane.z > 0.0f ? maxZ : minZ);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z), _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+        return _mm_movemask_ps(inside);
+#else
+        int mask = 0;
+        for (int s = 0; s < 4; s++) {
+            mask |= frustum.IsVisible(glm::vec3(minX[s], minY[s], minZ[s]), glm::vec3(maxX[s], maxY[s], maxZ[s])) << s;
+        }
+        return mask;
+#endif
+    }
+
+    void SceneBVH::QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& result) const {
+        if (nodes.empty()) {
+            return;
+        }
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            int mask = OverlapFrustum(node.minX, node.minY, node.minZ, node.maxX, node.maxY, node.maxZ, frustum);
+            for (int s = 0; s < 4; s++) {
+                if (!((mask >> s) & 1) || node.child[s] == EMPTY) {
+                    continue;
+                }
+                if (!(node.child[s] & LEAF)) {
+                    stack.push_back(node.child[s]);
+                    continue;
+                }
+                uint32_t first = node.child[s] & ~LEAF;
+                for (uint32_t i = first; i < first + node.count[s]; i++) {
+                    const BVHItem& item = items[itemOrder[i]];
+                    if (frustum.IsVisible(item.boundsMin, item.boundsMax)) {
+                        result.push_back(itemOrder[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Slab test, the entry distance when the ray hits the box before maxDistance
+    static bool RayBox(const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance,
+                       const glm::vec3& boundsMin, const glm::vec3& boundsMax, float& entry) {
+        float near = 0.0f;
+        float far = maxDistance;
+        for (int a = 0; a < 3; a++) {
+            float t1 = (boundsMin[a] - origin[a]) * inverseDirection[a];
+            float t2 = (boundsMax[a] - origin[a]) * inverseDirection[a];
+            near = std::max(near, std::min(t1, t2));
+            far = std::min(far, std::max(t1, t2));
+        }
+        entry = near;
+        return near <= far;
+    }
+
+    bool SceneBVH::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                           uint32_t& hitItem, float& distance) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float best = maxDistance;
+        bool hit = false;
+
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            int mask = 0;
+#ifdef GPS_BVH_SSE
+            __m128 near = _mm_setzero_ps();
+            __m128 far = _mm_set1_ps(best);
+            const float* mins[3] = {node.minX, node.minY, node.minZ};
+            const float* maxs[3] = {node.maxX, node.maxY, node.maxZ};
+            for (int a = 0; a < 3; a++) {
+                __m128 o = _mm_set1_ps(origin[a]);
+                __m128 inverse = _mm_set1_ps(inverseDirection[a]);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(mins[a]), o), inverse);
+                __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxs[a]), o), inverse);
+                near = _mm_max_ps(near, _mm_min_ps(t1, t2));
+                far = _mm_min_ps(far, _mm_max_ps(t1, t2));
+            }
+            mask = _mm_movemask_ps(_mm_cmple_ps(near, far));
+#else
+            for (int s = 0; s < 4; s++) {
+                float entry;
+                mask |= RayBox(origin, inverseDirection, best, glm::vec3(node.minX[s], node.minY[s], node.minZ[s]),
+                               glm::vec3(node.maxX[s], node.maxY[s], node.maxZ[s]), entry) << s;
+            }
+#endif
+            for (int s = 0; s < 4; s++) {
+                if (!((mask >> s) & 1) || node.child[s] == EMPTY) {
+                    continue;
+                }
+                if (!(node.child[s] & LEAF)) {
+                    stack.push_back(node.child[s]);
+                    continue;
+                }
+                uint32_t first = node.child[s] & ~LEAF;
+                for (uint32_t i = first; i < first + node.count[s]; i++) {
+                    const BVHItem& item = items[itemOrder[i]];
+                    float entry;
+                    if (RayBox(origin, inverseDirection, best, item.boundsMin, item.boundsMax, entry)) {
+                        best = entry;
+                        hitItem = itemOrder[i];
+                        hit = true;
+                    }
+                }
+            }
+        }
+        distance = best;
+        return hit;
+    }
+
+    void SceneBVH::QuerySphere(const glm::vec3& centre, float radius, std::vector<uint32_t>& result) const {
+        if (nodes.empty()) {
+            return;
+        }
+        float radiusSquared = radius * radius;
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            int mask = 0;
+#ifdef GPS_BVH_SSE
+            // squared distance from the centre to the closest point of each box
+            __m128 distanceSquared = _mm_setzero_ps();
+            const float* mins[3] = {node.minX, node.minY, node.minZ};
+            const float* maxs[3] = {node.maxX, node.maxY, node.maxZ};
+            for (int a = 0; a < 3; a++) {
+                __m128 c = _mm_set1_ps(centre[a]);
+                __m128 below = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(mins[a]), c), _mm_setzero_ps());
+                __m128 above = _mm_max_ps(_mm_sub_ps(c, _mm_loadu_ps(maxs[a])), _mm_setzero_ps());
+                __m128 offset = _mm_add_ps(below, above);
+                distanceSquared = _mm_add_ps(distanceSquared, _mm_mul_ps(offset, offset));
+            }
+            mask = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_set1_ps(radiusSquared)));
+#else
+            for (int s = 0; s < 4; s++) {
+                glm::vec3 closest = glm::max(glm::vec3(node.minX[s], node.minY[s], node.minZ[s]),
+                                             glm::min(centre, glm::vec3(node.maxX[s], node.maxY[s], node.maxZ[s])));
+                mask |= (glm::dot(closest - centre, closest - centre) <= radiusSquared) << s;
+            }
+#endif
+            for (int s = 0; s < 4; s++) {
+                if (!((mask >> s) & 1) || node.child[s] == EMPTY) {
+                    continue;
+                }
+                if (!(node.child[s] & LEAF)) {
+                    stack.push_back(node.child[s]);
+                    continue;
+                }
+                uint32_t first = node.child[s] & ~LEAF;
+                for (uint32_t i = first; i < first + node.count[s]; i++) {
+                    const BVHItem& item = items[itemOrder[i]];
+                    glm::vec3 closest = glm::max(item.boundsMin, glm::min(centre, item.boundsMax));
+                    if (glm::dot(closest - centre, closest - centre) <= radiusSquared) {
+                        result.push_back(itemOrder[i]);
+                    }
+                }
+            }
+        }
+    }
+}
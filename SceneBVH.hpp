@@ -0,0 +1,95 @@
+#ifndef SceneBVH_hpp
+#define SceneBVH_hpp
+
+#include "glm/glm.hpp"
+
+#include "Frustum.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // World space box of one object in the scene - a mesh, or one instance of it
+    struct BVHItem {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+    };
+
+    // Box around all 8 corners of a box once matrix is applied to them
+    void TransformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& matrix,
+                         glm::vec3& outMin, glm::vec3& outMax);
+
+    // Bounding volume hierarchy over the scene's objects, built with the surface area heuristic and
+    // stored as a flat array of 4 wide nodes whose child boxes are tested together with SSE.
+    // Items are identified by their index in the array given to Build.
+    class SceneBVH
+    {
+    public:
+        // most items a leaf holds
+        static const uint32_t LEAF_SIZE = 4;
+
+        SceneBVH();
+
+        void Build(const std::vector<BVHItem>& items);
+        void Clear();
+
+        // Moves one item and grows or shrinks the boxes above it - the tree keeps its shape, so
+        // rebuild once objects have moved far
+        void Refit(uint32_t item, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        // Appends the items whose boxes are at least partly inside the frustum
+        void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& items) const;
+        // Nearest item box hit along the ray within maxDistance - direction need not be normalized,
+        // distance is in units of its length
+        bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance,
+                     uint32_t& item, float& distance) const;
+        // Appends the items whose boxes touch the sphere
+        void QuerySphere(const glm::vec3& centre, float radius, std::vector<uint32_t>& items) const;
+
+        size_t GetItemCount() const;
+        size_t GetNodeCount() const;
+        const BVHItem& GetItem(uint32_t item) const;
+
+    private:
+        // Four children in two cache lines, their boxes one array per component
+        struct Node {
+            float minX[4], minY[4], minZ[4];
+            float maxX[4], maxY[4], maxZ[4];
+            // inner node index, or with LEAF set the first of count entries in itemOrder, or EMPTY
+            uint32_t child[4];
+            uint32_t count[4];
+        };
+        static const uint32_t LEAF = 0x80000000u;
+        static const uint32_t EMPTY = 0xFFFFFFFFu;
+
+        // Binary SAH tree, only kept while building
+        struct BuildNode {
+            glm::vec3 boundsMin;
+            glm::vec3 boundsMax;
+            uint32_t left;
+            uint32_t right;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        std::vector<BVHItem> items;
+        std::vector<uint32_t> itemOrder;
+        std::vector<Node> nodes;
+        // parent node and slot of every node, for refitting upwards
+        std::vector<uint32_t> nodeParent;
+        std::vector<uint8_t> nodeSlot;
+        // node and slot of the leaf holding every item
+        std::vector<uint32_t> itemNode;
+        std::vector<uint8_t> itemSlot;
+
+        uint32_t BuildBinary(std::vector<BuildNode>& buildNodes, const std::vector<glm::vec3>& centroids,
+                             uint32_t first, uint32_t count);
+        uint32_t Collapse(const std::vector<BuildNode>& buildNodes, uint32_t buildNode, uint32_t parent, uint8_t slot);
+        void SetSlot(Node& node, int slot, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+        void LeafBounds(const Node& node, int slot, glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+    };
+}
+
+#endif /* SceneBVH_hpp */
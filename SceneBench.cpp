@@ -0,0 +1,104 @@
+// SceneBVH queries against testing every box, over a field of instanced props like the teapot field.
+// Usage: SceneBench [instances] [views]
+
+#include "SceneBVH.hpp"
+#include "Frustum.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, const char* argv[]) {
+    size_t instanceCount = argc > 1 ? (size_t)atol(argv[1]) : 100000;
+    int viewCount = argc > 2 ? atoi(argv[2]) : 64;
+
+    // props 0.5 to 2 units wide on a square field with as much room around each as the teapot field
+    std::mt19937 random(1);
+    float side = std::sqrt((float)instanceCount) * 4.0f;
+    std::uniform_real_distribution<float> position(-side * 0.5f, side * 0.5f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+    std::vector<gps::BVHItem> items(instanceCount);
+    for (size_t i = 0; i < instanceCount; i++) {
+        glm::vec3 centre(position(random), 0.0f, position(random));
+        glm::vec3 halfSize(size(random) * 0.5f);
+        items[i].boundsMin = centre - halfSize;
+        items[i].boundsMax = centre + halfSize;
+    }
+
+    gps::SceneBVH bvh;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bvh.Build(items);
+    double buildTime = millisecondsSince(start);
+
+    // a thousand props moved a little, as a frame of moving objects would
+    std::uniform_int_distribution<size_t> pick(0, instanceCount - 1);
+    std::uniform_real_distribution<float> nudge(-1.0f, 1.0f);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++) {
+        size_t item = pick(random);
+        glm::vec3 offset(nudge(random), 0.0f, nudge(random));
+        items[item].boundsMin += offset;
+        items[item].boundsMax += offset;
+        bvh.Refit(item, items[item].boundsMin, items[item].boundsMax);
+    }
+    double refitTime = millisecondsSince(start);
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1920.0f / 1080.0f, 0.1f, 1000.0f);
+    size_t linearVisible = 0, bvhVisible = 0, rayHits = 0, sphereItems = 0;
+    double linearTime = 0.0, bvhTime = 0.0, rayTime = 0.0, sphereTime = 0.0;
+    std::vector<uint32_t> found;
+    for (int v = 0; v < viewCount; v++) {
+        glm::vec3 eye(position(random), 1.7f, position(random));
+        float yaw = v * 2.0f * 3.14159265f / viewCount;
+        glm::vec3 direction(std::cos(yaw), -0.05f, std::sin(yaw));
+        gps::Frustum frustum;
+        frustum.Extract(projection * glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f)));
+
+        // what every model's own frustum loop amounts to
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < instanceCount; i++) {
+            linearVisible += frustum.IsVisible(items[i].boundsMin, items[i].boundsMax);
+        }
+        linearTime += millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        found.clear();
+        bvh.QueryFrustum(frustum, found);
+        bvhTime += millisecondsSince(start);
+        bvhVisible += found.size();
+
+        uint32_t item;
+        float distance;
+        start = std::chrono::steady_clock::now();
+        rayHits += bvh.Raycast(eye, direction, 1000.0f, item, distance);
+        rayTime += millisecondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        found.clear();
+        bvh.QuerySphere(eye, 10.0f, found);
+        sphereTime += millisecondsSince(start);
+        sphereItems += found.size();
+    }
+
+    std::cout << "Instances      : " << instanceCount << ", " << bvh.GetNodeCount() << " nodes" << std::endl;
+    std::cout << "build          : " << buildTime << " ms" << std::endl;
+    std::cout << "refit          : " << refitTime / 1000.0 << " ms per moved item" << std::endl;
+    std::cout << "Views          : " << viewCount << std::endl;
+    std::cout << "every box      : " << (double)linearVisible / viewCount << " visible, " << linearTime / viewCount
+              << " ms per view" << std::endl;
+    std::cout << "BVH frustum    : " << (double)bvhVisible / viewCount << " visible, " << bvhTime / viewCount
+              << " ms per view" << std::endl;
+    std::cout << "BVH raycast    : " << rayHits << " hits, " << rayTime * 1000.0 / viewCount << " us per ray" << std::endl;
+    std::cout << "BVH sphere     : " << (double)sphereItems / viewCount << " items within 10, "
+              << sphereTime * 1000.0 / viewCount << " us per query" << std::endl;
+    return EXIT_SUCCESS;
+}
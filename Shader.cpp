@@ -1,4 +1,7 @@
 #include "Shader.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
 
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName)
@@ -80,11 +83,140 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+        reflectProgram();
+    }
+
+    void Shader::loadComputeShader(std::string computeShaderFileName)
+    {
+        //read, parse and compile the compute shader
+        std::string c = readShaderFile(computeShaderFileName);
+        const GLchar* computeShaderString = c.c_str();
+        GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(computeShader, 1, &computeShaderString, NULL);
+        glCompileShader(computeShader);
+        //check compilation status
+        shaderCompileLog(computeShader);
+
+        //attach and link the shader program
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, computeShader);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(computeShader);
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+        reflectProgram();
+    }
+
+    void Shader::useShaderProgram() const
+    {
+        GLState::Get().UseProgram(this->shaderProgram);
+    }
+
+    void Shader::addUniform(const std::string& name, GLint location, GLenum type, GLint size, GLint blockIndex)
+    {
+        UniformInfo uniform;
+        uniform.nameHash = HashName(name.c_str());
+        uniform.name = name;
+        uniform.location = location;
+        uniform.type = type;
+        uniform.size = size;
+        uniform.blockIndex = blockIndex;
+        this->uniforms.push_back(uniform);
+
+        // arrays are reported as "name[0]" - also answer to the plain name
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+            uniform.name = name.substr(0, name.size() - 3);
+            uniform.nameHash = HashName(uniform.name.c_str());
+            this->uniforms.push_back(uniform);
+        }
+    }
+
+    void Shader::reflectProgram()
+    {
+        this->uniforms.clear();
+        this->uniformBlocks.clear();
+
+        GLint count = 0;
+        GLint maxLength = 0;
+        if (GLEW_ARB_program_interface_query) {
+            glGetProgramInterfaceiv(this->shaderProgram, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+            glGetProgramInterfaceiv(this->shaderProgram, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxLength);
+            std::vector<GLchar> name(maxLength + 1);
+            const GLenum properties[4] = {GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE, GL_BLOCK_INDEX};
+            for (GLint i = 0; i < count; i++) {
+                GLint values[4];
+                glGetProgramResourceName(this->shaderProgram, GL_UNIFORM, i, name.size(), NULL, &name[0]);
+                glGetProgramResourceiv(this->shaderProgram, GL_UNIFORM, i, 4, properties, 4, NULL, values);
+                addUniform(&name[0], values[0], values[1], values[2], values[3]);
+            }
+        } else {
+            // GL 4.1 - names from glGetActiveUniform, locations and blocks looked up once here
+            glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+            std::vector<GLchar> name(maxLength + 1);
+            for (GLint i = 0; i < count; i++) {
+                GLint size;
+                GLenum type;
+                GLint blockIndex;
+                GLuint index = i;
+                glGetActiveUniform(this->shaderProgram, index, name.size(), NULL, &size, &type, &name[0]);
+                glGetActiveUniformsiv(this->shaderProgram, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+                addUniform(&name[0], glGetUniformLocation(this->shaderProgram, &name[0]), type, size, blockIndex);
+            }
+        }
+
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+        std::vector<GLchar> blockName(maxLength + 1);
+        for (GLint i = 0; i < count; i++) {
+            UniformBlockInfo block;
+            glGetActiveUniformBlockName(this->shaderProgram, i, blockName.size(), NULL, &blockName[0]);
+            glGetActiveUniformBlockiv(this->shaderProgram, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+            block.name = &blockName[0];
+            block.nameHash = HashName(block.name.c_str());
+            block.index = i;
+            this->uniformBlocks.push_back(block);
+        }
+
+        std::sort(this->uniforms.begin(), this->uniforms.end(),
+                  [](const UniformInfo& a, const UniformInfo& b) { return a.nameHash < b.nameHash; });
+        std::sort(this->uniformBlocks.begin(), this->uniformBlocks.end(),
+                  [](const UniformBlockInfo& a, const UniformBlockInfo& b) { return a.nameHash < b.nameHash; });
+        for (size_t i = 1; i < this->uniforms.size(); i++) {
+            if (this->uniforms[i].nameHash == this->uniforms[i - 1].nameHash) {
+                std::cout << "Uniform name hash collision: " << this->uniforms[i - 1].name << " / " << this->uniforms[i].name << std::endl;
+            }
+        }
+    }
+
+    GLint Shader::GetUniformLocation(uint64_t nameHash) const
+    {
+        std::vector<UniformInfo>::const_iterator found = std::lower_bound(this->uniforms.begin(), this->uniforms.end(), nameHash,
+            [](const UniformInfo& uniform, uint64_t hash) { return uniform.nameHash < hash; });
+        if (found == this->uniforms.end() || found->nameHash != nameHash) {
+            return -1;
+        }
+        return found->location;
+    }
+
+    GLuint Shader::GetUniformBlockIndex(uint64_t nameHash) const
+    {
+        std::vector<UniformBlockInfo>::const_iterator found = std::lower_bound(this->uniformBlocks.begin(), this->uniformBlocks.end(), nameHash,
+            [](const UniformBlockInfo& block, uint64_t hash) { return block.nameHash < hash; });
+        if (found == this->uniformBlocks.end() || found->nameHash != nameHash) {
+            return GL_INVALID_INDEX;
+        }
+        return found->index;
+    }
+
+    const std::vector<UniformInfo>& Shader::GetUniforms() const
+    {
+        return this->uniforms;
     }
 
-    void Shader::useShaderProgram()
+    const std::vector<UniformBlockInfo>& Shader::GetUniformBlocks() const
     {
-        glUseProgram(this->shaderProgram);
+        return this->uniformBlocks;
     }
 
 }
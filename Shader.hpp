@@ -8,20 +8,61 @@
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include "Hash.hpp"
 
 namespace gps {
 
+// Active uniform found when the program was linked
+struct UniformInfo
+{
+    uint64_t nameHash;
+    std::string name;
+    GLint location;
+    GLenum type;
+    GLint size;
+    // -1 outside of uniform blocks
+    GLint blockIndex;
+};
+
+struct UniformBlockInfo
+{
+    uint64_t nameHash;
+    std::string name;
+    GLuint index;
+    GLint dataSize;
+};
+
 class Shader
 {
 public:
     GLuint shaderProgram;
     void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
-    void useShaderProgram();
+    // A program made of a single compute shader - GL 4.3
+    void loadComputeShader(std::string computeShaderFileName);
+    void useShaderProgram() const;
+
+    // Location of an active uniform by gps::HashName of its name, -1 when the program does not use it.
+    // Resolved from the table built at link time, no GL query.
+    GLint GetUniformLocation(uint64_t nameHash) const;
+    // GL_INVALID_INDEX when the program has no such block
+    GLuint GetUniformBlockIndex(uint64_t nameHash) const;
+
+    const std::vector<UniformInfo>& GetUniforms() const;
+    const std::vector<UniformBlockInfo>& GetUniformBlocks() const;
 
 private:
+    // sorted by name hash
+    std::vector<UniformInfo> uniforms;
+    std::vector<UniformBlockInfo> uniformBlocks;
+
     std::string readShaderFile(std::string fileName);
     void shaderCompileLog(GLuint shaderId);
     void shaderLinkLog(GLuint shaderProgramId);
+    // Builds the uniform and block tables of the linked program
+    void reflectProgram();
+    void addUniform(const std::string& name, GLint location, GLenum type, GLint size, GLint blockIndex);
 };
 
 }
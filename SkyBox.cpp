@@ -7,71 +7,192 @@
 //
 
 #include "SkyBox.hpp"
+#include "Image.hpp"
+#include "TextureStreamer.hpp"
+#include "GLTaskQueue.hpp"
+#include "GLState.hpp"
+#include "ThreadPool.hpp"
+
+#include <memory>
 
 namespace gps {
 
+    constexpr uint64_t SKYBOX_UNIFORM = HashName("skybox");
+
     SkyBox::SkyBox() {
 
     }
 
+    SkyBox::~SkyBox() {
+        gps::AssetRegistry::Get().ReleaseCubemap(cubemapHandle);
+    }
+
     void SkyBox::Load(std::vector<const GLchar *> cubeMapFaces) {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
+        gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+        std::vector<std::string> faces(cubeMapFaces.begin(), cubeMapFaces.end());
+
+        registry.ReleaseCubemap(cubemapHandle);
+        cubemapHandle = registry.AcquireCubemap(faces);
+        if (!cubemapHandle.IsValid()) {
+            cubemapHandle = registry.AddCubemap(faces, LoadSkyBoxTextures(cubeMapFaces));
+        }
+        cubemapTexture = registry.GetCubemap(cubemapHandle);
         InitSkyBox();
     }
 
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix) {
+    void SkyBox::AttachSampler(const gps::Shader& shader) {
         shader.useShaderProgram();
+        glUniform1i(shader.GetUniformLocation(SKYBOX_UNIFORM), SKYBOX_UNIT);
+    }
 
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE,
-                           glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE,
-                           glm::value_ptr(projectionMatrix));
+    // The view and projection come from the FrameData block
+    void SkyBox::Draw(const gps::Shader& shader) {
+        gps::GLState& state = gps::GLState::Get();
+        shader.useShaderProgram();
 
-        glDepthFunc(GL_LEQUAL);
+        state.DepthFunc(GL_LEQUAL);
 
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.BindVertexArray(skyboxVAO);
+        state.BindTexture(SKYBOX_UNIT, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
 
-        glDepthFunc(GL_LESS);
+        state.DepthFunc(GL_LESS);
+    }
+
+    static void DrawSkyBoxPacket(const gps::DrawPacket& packet) {
+        static_cast<SkyBox*>(packet.object)->Draw(*packet.shader);
     }
 
+    // Drawn after the opaque geometry, whose depth hides most of it
+    void SkyBox::Submit(gps::RenderQueue& queue, const gps::Shader& shader) {
+        gps::DrawPacket packet;
+        packet.key = gps::RenderQueue::MakeKey(gps::PASS_SKY, shader.shaderProgram, cubemapTexture, 0.0f);
+        packet.draw = DrawSkyBoxPacket;
+        packet.shader = &shader;
+        packet.object = this;
+        packet.item = 0;
+        packet.drawIndex = 0;
+        queue.Submit(packet);
+    }
+
+    // Decoded faces, either all block compressed or all raw RGB
+    struct SkyBox::DecodedFaces {
+        std::vector<std::unique_ptr<gps::CompressedTexture> > compressed;
+        std::vector<std::unique_ptr<gps::Image> > images;
+        bool useCompressed;
+    };
+
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar *> skyBoxFaces) {
-        GLuint textureID;
-        glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
+        GLuint textureID = CreateCubemap();
 
-        int width, height, n;
-        unsigned char *image;
-        int force_channels = 3;
+        DecodedFaces decoded;
+        std::vector<std::string> faces(skyBoxFaces.begin(), skyBoxFaces.end());
+        if (!DecodeFaces(faces, gps::CompressedTexture::IsSupported(), decoded)) {
+            gps::GLState::Get().ForgetTexture(textureID);
+            glDeleteTextures(1, &textureID);
+            return false;
+        }
+        QueueFaces(textureID, decoded);
 
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for (GLuint i = 0; i < skyBoxFaces.size(); i++) {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
-            }
-            glTexImage2D(
-                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                    GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-            );
+        return textureID;
+    }
+
+    void SkyBox::LoadAsync(std::vector<const GLchar *> cubeMapFaces) {
+        gps::AssetRegistry& registry = gps::AssetRegistry::Get();
+        std::vector<std::string> faces(cubeMapFaces.begin(), cubeMapFaces.end());
+
+        registry.ReleaseCubemap(cubemapHandle);
+        cubemapHandle = registry.AcquireCubemap(faces);
+        if (cubemapHandle.IsValid()) {
+            cubemapTexture = registry.GetCubemap(cubemapHandle);
+            InitSkyBox();
+            return;
+        }
+
+        GLuint textureID = CreateCubemap();
+        gps::CubemapHandle handle = registry.AddCubemap(faces, textureID);
+        cubemapHandle = handle;
+        cubemapTexture = textureID;
+        InitSkyBox();
+
+        bool compress = gps::CompressedTexture::IsSupported();
+        gps::GLTaskQueue::GetShared().Retain();
+        gps::ThreadPool::GetShared().Enqueue([faces, textureID, handle, compress]() {
+            std::shared_ptr<DecodedFaces> decoded(new DecodedFaces());
+            bool loaded = DecodeFaces(faces, compress, *decoded);
+
+            gps::GLTaskQueue& queue = gps::GLTaskQueue::GetShared();
+            queue.Post([textureID, handle, decoded, loaded]() {
+                // keeps the placeholder when a face is missing or the skybox is gone
+                if (loaded && gps::AssetRegistry::Get().GetCubemap(handle) == textureID) {
+                    QueueFaces(textureID, *decoded);
+                }
+            });
+            queue.Release();
+        });
+    }
+
+    // Cube map with the skybox sampler settings and 1x1 placeholder faces
+    GLuint SkyBox::CreateCubemap() {
+        static const unsigned char placeholder[3] = {128, 128, 128};
+
+        GLuint textureID;
+        glGenTextures(1, &textureID);
+        gps::GLState::Get().BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+        for (GLuint i = 0; i < 6; i++) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, placeholder);
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
         return textureID;
     }
 
+    // Touches no GL state, so it can run on any thread
+    bool SkyBox::DecodeFaces(const std::vector<std::string>& skyBoxFaces, bool compress, DecodedFaces& decoded) {
+        int force_channels = 3;
+
+        // all faces must share one format, otherwise the cube map is incomplete
+        decoded.compressed.resize(skyBoxFaces.size());
+        decoded.useCompressed = compress;
+        for (GLuint i = 0; i < skyBoxFaces.size() && decoded.useCompressed; i++) {
+            decoded.compressed[i].reset(new gps::CompressedTexture());
+            decoded.useCompressed = decoded.compressed[i]->Load(skyBoxFaces[i], false, false, false) &&
+                                    decoded.compressed[i]->GetFormat() == decoded.compressed[0]->GetFormat();
+        }
+        if (decoded.useCompressed) {
+            return true;
+        }
+
+        decoded.compressed.clear();
+        decoded.images.resize(skyBoxFaces.size());
+        for (GLuint i = 0; i < skyBoxFaces.size(); i++) {
+            decoded.images[i].reset(new gps::Image());
+            if (!decoded.images[i]->Load(skyBoxFaces[i], force_channels, false)) {
+                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i].c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The faces reach the GPU over the next frames
+    void SkyBox::QueueFaces(GLuint textureID, DecodedFaces& decoded) {
+        gps::TextureStreamer& streamer = gps::TextureStreamer::GetShared();
+        if (decoded.useCompressed) {
+            for (GLuint i = 0; i < decoded.compressed.size(); i++) {
+                streamer.QueueCompressed(textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, std::move(decoded.compressed[i]), false);
+            }
+            return;
+        }
+        for (GLuint i = 0; i < decoded.images.size(); i++) {
+            streamer.QueueImage(textureID, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, std::move(decoded.images[i]), GL_RGB, false);
+        }
+    }
+
     void SkyBox::InitSkyBox() {
         GLfloat skyboxVertices[] = {
                 -1.0f, 1.0f, -1.0f,
@@ -120,14 +241,15 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
 
-        glBindVertexArray(skyboxVAO);
+        gps::GLState& state = gps::GLState::Get();
+        state.BindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid *) 0);
 
-        glBindVertexArray(0);
+        state.BindVertexArray(0);
     }
 
     GLuint SkyBox::GetTextureId() {
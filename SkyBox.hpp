@@ -11,24 +11,43 @@
 
 #include <stdio.h>
 #include "Shader.hpp"
+#include "AssetRegistry.hpp"
+#include "CompressedTexture.hpp"
+#include "RenderQueue.hpp"
 #include <vector>
 #include "stb_image.h"
 #include "glm/glm.hpp"
 #include "glm/gtc/type_ptr.hpp"
 
 namespace gps {
+
+    // unit the cube map is bound to, the sampler points there from AttachSampler on
+    const GLuint SKYBOX_UNIT = 0;
+
     class SkyBox
     {
     public:
         SkyBox();
+        ~SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // Returns at once with grey placeholder faces, the images are decoded on the thread pool
+        void LoadAsync(std::vector<const GLchar*> cubeMapFaces);
+        void Draw(const gps::Shader& shader);
+        // Points the program's skybox sampler at SKYBOX_UNIT - once after linking
+        static void AttachSampler(const gps::Shader& shader);
+        // Queued between the opaque and the blended geometry, the shader must outlive the frame
+        void Submit(gps::RenderQueue& queue, const gps::Shader& shader);
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
+        gps::CubemapHandle cubemapHandle;
+        struct DecodedFaces;
         GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        static GLuint CreateCubemap();
+        static bool DecodeFaces(const std::vector<std::string>& skyBoxFaces, bool compress, DecodedFaces& decoded);
+        static void QueueFaces(GLuint textureID, DecodedFaces& decoded);
         void InitSkyBox();
     };
 }
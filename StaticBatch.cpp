@@ -0,0 +1,29 @@
+#include "StaticBatch.hpp"
+
+#include <cmath>
+#include <map>
+#include <tuple>
+
+namespace gps {
+
+    void GroupStaticBatches(const std::vector<BatchShape>& shapes, float cellSize, std::vector<size_t>& batchOf) {
+        typedef std::tuple<int, long long, long long, long long> BatchKey;
+        std::map<BatchKey, size_t> batchIndex;
+        batchOf.resize(shapes.size());
+
+        for (size_t s = 0; s < shapes.size(); s++) {
+            const BatchShape& shape = shapes[s];
+            batchOf[s] = s;
+            if (!shape.mergeable || cellSize <= 0.0f) {
+                continue;
+            }
+            glm::vec3 centre = (shape.boundsMin + shape.boundsMax) * 0.5f;
+            BatchKey key(shape.materialId, (long long)std::floor(centre.x / cellSize),
+                         (long long)std::floor(centre.y / cellSize), (long long)std::floor(centre.z / cellSize));
+            // the first shape of a cell starts its batch, the others join it
+            std::pair<std::map<BatchKey, size_t>::iterator, bool> inserted = batchIndex.insert(std::make_pair(key, s));
+            batchOf[s] = inserted.first->second;
+        }
+    }
+
+}
@@ -0,0 +1,27 @@
+#ifndef StaticBatch_hpp
+#define StaticBatch_hpp
+
+#include "glm/glm.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // One shape as static batching sees it
+    struct BatchShape {
+        int materialId;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        // false keeps the shape in a batch of its own, as for instanced shapes
+        bool mergeable;
+    };
+
+    // Picks the batch of every shape: shapes of one material whose bounds centres fall in the same
+    // cellSize sized cell share one. batchOf[s] is the first shape of the batch s joins - s itself when it
+    // starts one. A cellSize of 0 or less keeps every shape on its own.
+    void GroupStaticBatches(const std::vector<BatchShape>& shapes, float cellSize, std::vector<size_t>& batchOf);
+
+}
+
+#endif /* StaticBatch_hpp */
@@ -0,0 +1,345 @@
+#include "TextureStreamer.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+    // One copy into the ring, or straight from client memory when it is larger than a segment
+    struct TextureStreamer::Upload {
+        Job* job;
+        int level;
+        int firstRow;
+        int rowCount;
+        size_t offset;
+        size_t size;
+        const void* clientData;
+    };
+
+    static GLenum BindTarget(GLenum target) {
+        if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z) {
+            return GL_TEXTURE_CUBE_MAP;
+        }
+        return target;
+    }
+
+    static GLenum PixelFormat(int channels) {
+        switch (channels) {
+            case 1: return GL_RED;
+            case 2: return GL_RG;
+            case 3: return GL_RGB;
+            default: return GL_RGBA;
+        }
+    }
+
+    static size_t AlignUp(size_t offset) {
+        return (offset + 15) & ~(size_t)15;
+    }
+
+    TextureStreamer::TextureStreamer() : frameBudget(8 << 20), ringBuffer(0), persistent(false),
+                                         persistentData(NULL), segment(0), streamedBytes(0), streamedFrames(0) {
+        for (int i = 0; i < RING_SEGMENTS; i++) {
+            fences[i] = NULL;
+        }
+    }
+
+    TextureStreamer::~TextureStreamer() {
+        if (!ringBuffer) {
+            return;
+        }
+        for (int i = 0; i < RING_SEGMENTS; i++) {
+            if (fences[i]) {
+                glDeleteSync(fences[i]);
+            }
+        }
+        if (persistent) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &ringBuffer);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            glDeleteBuffers(1, &jobs[i].staging);
+        }
+    }
+
+    TextureStreamer& TextureStreamer::GetShared() {
+        // never destroyed - the GL context is gone by the time statics are torn down
+        static TextureStreamer* streamer = new TextureStreamer();
+        return *streamer;
+    }
+
+    void TextureStreamer::SetFrameBudget(size_t bytes) {
+        if (!ringBuffer) {
+            frameBudget = std::max(AlignUp(bytes), (size_t)16);
+        }
+    }
+
+    void TextureStreamer::InitRing() {
+        size_t size = frameBudget * RING_SEGMENTS;
+        glGenBuffers(1, &ringBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+
+        // mapped once for the whole run where buffer storage is available, GL 4.1 maps per frame
+        persistent = GLEW_ARB_buffer_storage;
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+            persistentData = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+            persistent = persistentData != NULL;
+            if (!persistent) {
+                // immutable storage cannot be respecified
+                glDeleteBuffers(1, &ringBuffer);
+                glGenBuffers(1, &ringBuffer);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+            }
+        }
+        if (!persistent) {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // Waits until the GPU is done reading the segment from RING_SEGMENTS frames ago
+    unsigned char* TextureStreamer::BeginSegment() {
+        if (fences[segment]) {
+            while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+            }
+            glDeleteSync(fences[segment]);
+            fences[segment] = NULL;
+        }
+
+        size_t offset = segment * frameBudget;
+        if (persistent) {
+            return persistentData + offset;
+        }
+        return static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, frameBudget,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    }
+
+    void TextureStreamer::QueueImage(GLuint texture, GLenum target, std::unique_ptr<Image> image,
+                                     GLenum internalFormat, bool generateMipmaps) {
+        // the texture is left alone, respecifying it now would drop the placeholder
+        Job job;
+        glGenBuffers(1, &job.staging);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, job.staging);
+        glBufferData(GL_COPY_WRITE_BUFFER, (size_t)image->GetWidth() * image->GetHeight() * image->GetChannels(),
+                     NULL, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        job.texture = texture;
+        job.target = target;
+        job.image = std::move(image);
+        job.internalFormat = internalFormat;
+        job.generateMipmaps = generateMipmaps;
+        job.next = 0;
+        jobs.push_back(std::move(job));
+    }
+
+    void TextureStreamer::QueueCompressed(GLuint texture, GLenum target, std::unique_ptr<CompressedTexture> chain,
+                                          bool srgb) {
+        // the level range only moves as levels arrive, see IssueUpload
+        int lastLevel = chain->GetLevelCount() - 1;
+        Job job;
+        job.texture = texture;
+        job.target = target;
+        job.staging = 0;
+        job.internalFormat = chain->GetInternalFormat(srgb);
+        job.compressed = std::move(chain);
+        job.generateMipmaps = false;
+        job.next = lastLevel;
+        jobs.push_back(std::move(job));
+    }
+
+    bool TextureStreamer::PlanJob(Job& job, unsigned char* segmentData, size_t& used, std::vector<Upload>& uploads) {
+        Upload upload;
+        upload.job = &job;
+        upload.clientData = NULL;
+
+        if (job.compressed) {
+            for (; job.next >= 0; job.next--) {
+                CompressedLevel level = job.compressed->GetLevel(job.next);
+                upload.level = job.next;
+                upload.size = level.size;
+                if (level.size > frameBudget) {
+                    upload.clientData = level.data;
+                    uploads.push_back(upload);
+                    continue;
+                }
+                upload.offset = AlignUp(used);
+                if (upload.offset + level.size > frameBudget) {
+                    return false;
+                }
+                memcpy(segmentData + upload.offset, level.data, level.size);
+                uploads.push_back(upload);
+                used = upload.offset + level.size;
+            }
+            return true;
+        }
+
+        const Image& image = *job.image;
+        size_t rowSize = (size_t)image.GetWidth() * image.GetChannels();
+        upload.level = 0;
+        if (rowSize > frameBudget) {
+            upload.firstRow = job.next;
+            upload.rowCount = image.GetHeight() - job.next;
+            upload.size = upload.rowCount * rowSize;
+            upload.clientData = image.GetPixels() + job.next * rowSize;
+            uploads.push_back(upload);
+            job.next = image.GetHeight();
+            return true;
+        }
+        while (job.next < image.GetHeight()) {
+            upload.offset = AlignUp(used);
+            size_t fits = upload.offset < frameBudget ? (frameBudget - upload.offset) / rowSize : 0;
+            int rows = std::min((size_t)(image.GetHeight() - job.next), fits);
+            if (rows == 0) {
+                return false;
+            }
+            upload.firstRow = job.next;
+            upload.rowCount = rows;
+            upload.size = rows * rowSize;
+            memcpy(segmentData + upload.offset, image.GetPixels() + job.next * rowSize, upload.size);
+            uploads.push_back(upload);
+            used = upload.offset + upload.size;
+            job.next += rows;
+        }
+        return true;
+    }
+
+    void TextureStreamer::IssueUpload(const Upload& upload) {
+        const Job& job = *upload.job;
+        GLenum bindTarget = BindTarget(job.target);
+        // the data pointer is an offset into the bound unpack buffer, or client memory without one
+        const void* data = reinterpret_cast<const void*>(upload.offset);
+        if (upload.clientData) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            data = upload.clientData;
+        }
+
+        GLState::Get().BindTexture(bindTarget, job.texture);
+        if (job.compressed) {
+            CompressedLevel level = job.compressed->GetLevel(upload.level);
+            glCompressedTexImage2D(job.target, upload.level, job.internalFormat, level.width, level.height, 0,
+                                   level.size, data);
+            // the range only ever covers uploaded levels - the placeholder at level 0 is sampled until the
+            // smallest one is in, then each larger level as it lands
+            if (job.target == GL_TEXTURE_2D) {
+                if (upload.level == job.compressed->GetLevelCount() - 1) {
+                    glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, upload.level);
+                }
+                glTexParameteri(job.target, GL_TEXTURE_BASE_LEVEL, upload.level);
+            }
+        } else {
+            size_t rowSize = (size_t)job.image->GetWidth() * job.image->GetChannels();
+            glBindBuffer(GL_COPY_WRITE_BUFFER, job.staging);
+            if (upload.clientData) {
+                glBufferSubData(GL_COPY_WRITE_BUFFER, upload.firstRow * rowSize, upload.size, upload.clientData);
+            } else {
+                glCopyBufferSubData(GL_PIXEL_UNPACK_BUFFER, GL_COPY_WRITE_BUFFER, upload.offset,
+                                    upload.firstRow * rowSize, upload.size);
+            }
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        if (upload.clientData) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+        }
+    }
+
+    // An image replaces the placeholder in one copy from its staging buffer, on the GPU
+    void TextureStreamer::FinishJob(Job& job) {
+        if (job.image) {
+            GLenum bindTarget = BindTarget(job.target);
+            GLState::Get().BindTexture(bindTarget, job.texture);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.staging);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(job.target, 0, job.internalFormat, job.image->GetWidth(), job.image->GetHeight(), 0,
+                         PixelFormat(job.image->GetChannels()), GL_UNSIGNED_BYTE, NULL);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &job.staging);
+            job.staging = 0;
+            if (job.generateMipmaps) {
+                glGenerateMipmap(bindTarget);
+                glTexParameteri(bindTarget, GL_TEXTURE_MAX_LEVEL, 1000);
+            }
+        }
+        job.image.reset();
+        job.compressed.reset();
+    }
+
+    void TextureStreamer::Update() {
+        if (jobs.empty()) {
+            return;
+        }
+        if (!ringBuffer) {
+            InitRing();
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+        unsigned char* segmentData = BeginSegment();
+        if (!segmentData) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+
+        // copy first, then issue - a buffer mapped without persistence cannot feed uploads
+        std::vector<Upload> uploads;
+        size_t used = 0;
+        size_t finished = 0;
+        while (finished < jobs.size() && PlanJob(jobs[finished], segmentData, used, uploads)) {
+            finished++;
+        }
+        if (!persistent) {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < uploads.size(); i++) {
+            IssueUpload(uploads[i]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        for (size_t i = 0; i < finished; i++) {
+            FinishJob(jobs.front());
+            jobs.pop_front();
+        }
+
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RING_SEGMENTS;
+        streamedBytes += used;
+        streamedFrames++;
+
+        if (jobs.empty()) {
+            std::cout << "# streamed     : " << streamedBytes / 1024 << " KB of textures over "
+                      << streamedFrames << " frames" << std::endl;
+            streamedBytes = 0;
+            streamedFrames = 0;
+        }
+    }
+
+    void TextureStreamer::Cancel(GLuint texture) {
+        for (std::deque<Job>::iterator job = jobs.begin(); job != jobs.end(); ) {
+            if (job->texture == texture) {
+                glDeleteBuffers(1, &job->staging);
+                job = jobs.erase(job);
+            } else {
+                ++job;
+            }
+        }
+    }
+
+    void TextureStreamer::Flush() {
+        while (!jobs.empty()) {
+            Update();
+        }
+    }
+
+    bool TextureStreamer::IsIdle() const {
+        return jobs.empty();
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include "Image.hpp"
+#include "CompressedTexture.hpp"
+
+#include <GL/glew.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace gps {
+
+    // Copies texture data to the GPU a few megabytes per frame through a ring of pixel buffer
+    // segments, so loading never blocks rendering. Each segment is fenced after its uploads and
+    // only rewritten once the GPU has consumed it. A texture keeps what it had - a placeholder -
+    // until data it can sample has arrived. All calls must come from the GL thread.
+    class TextureStreamer
+    {
+    public:
+        static const int RING_SEGMENTS = 3;
+
+        TextureStreamer();
+        ~TextureStreamer();
+
+        // Bytes copied per frame, also the size of one ring segment. Set before the first upload.
+        void SetFrameBudget(size_t bytes);
+
+        // Queues the image for an existing texture object (GL_TEXTURE_2D or a cube map face).
+        // Rows gather in a GPU side staging buffer over the next frames, the texture is only
+        // respecified from it once the last one is in.
+        void QueueImage(GLuint texture, GLenum target, std::unique_ptr<Image> image,
+                        GLenum internalFormat, bool generateMipmaps);
+
+        // Queues a block compressed mip chain, smallest level first, so the texture sharpens as it streams
+        void QueueCompressed(GLuint texture, GLenum target, std::unique_ptr<CompressedTexture> chain,
+                             bool srgb);
+
+        // Drops queued data of a texture that is about to be deleted
+        void Cancel(GLuint texture);
+
+        // Uploads up to the frame budget - call once per frame, after rendering
+        void Update();
+
+        // Uploads everything that is still queued, blocking
+        void Flush();
+
+        bool IsIdle() const;
+
+        static TextureStreamer& GetShared();
+
+    private:
+        struct Upload;
+
+        struct Job {
+            GLuint texture;
+            GLenum target;
+            std::unique_ptr<Image> image;
+            std::unique_ptr<CompressedTexture> compressed;
+            GLenum internalFormat;
+            bool generateMipmaps;
+            // rows of an image collected until it is complete
+            GLuint staging;
+            // next row of an image, or the next level of a compressed chain counting down
+            int next;
+        };
+
+        std::deque<Job> jobs;
+        size_t frameBudget;
+
+        GLuint ringBuffer;
+        bool persistent;
+        unsigned char* persistentData;
+        GLsync fences[RING_SEGMENTS];
+        int segment;
+
+        size_t streamedBytes;
+        size_t streamedFrames;
+
+        void InitRing();
+        unsigned char* BeginSegment();
+        // Copies as much of the job as fits into the segment - true once all of it is planned
+        bool PlanJob(Job& job, unsigned char* segmentData, size_t& used, std::vector<Upload>& uploads);
+        void IssueUpload(const Upload& upload);
+        void FinishJob(Job& job);
+
+        TextureStreamer(const TextureStreamer&);
+        TextureStreamer& operator=(const TextureStreamer&);
+    };
+}
+
+#endif /* TextureStreamer_hpp */
@@ -0,0 +1,95 @@
+#include "ThreadPool.hpp"
+
+namespace gps {
+
+    // pool whose worker is running on this thread, if any
+    static thread_local ThreadPool* workerPool = nullptr;
+
+    ThreadPool::ThreadPool(unsigned threadCount) : stopping(false) {
+        if (threadCount == 0) {
+            threadCount = std::thread::hardware_concurrency();
+        }
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        for (unsigned i = 0; i < threadCount; i++) {
+            workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    void ThreadPool::Enqueue(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+        }
+        taskAvailable.notify_one();
+    }
+
+    void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+        if (workerPool == this) {
+            for (size_t i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+
+        std::mutex doneMutex;
+        std::condition_variable done;
+        size_t remaining = count;
+
+        for (size_t i = 0; i < count; i++) {
+            Enqueue([&, i]() {
+                task(i);
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (--remaining == 0) {
+                    done.notify_all();
+                }
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        while (remaining > 0) {
+            done.wait(lock);
+        }
+    }
+
+    unsigned ThreadPool::GetThreadCount() const {
+        return workers.size();
+    }
+
+    ThreadPool& ThreadPool::GetShared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::WorkerLoop() {
+        workerPool = this;
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopping && tasks.empty()) {
+                    taskAvailable.wait(lock);
+                }
+                if (tasks.empty()) {
+                    return;
+                }
+                task = tasks.front();
+                tasks.pop_front();
+            }
+
+            task();
+        }
+    }
+}
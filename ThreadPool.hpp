@@ -0,0 +1,46 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Fixed set of worker threads running queued tasks in FIFO order
+    class ThreadPool
+    {
+    public:
+        // 0 threads = one per hardware thread
+        explicit ThreadPool(unsigned threadCount = 0);
+        ~ThreadPool();
+
+        void Enqueue(std::function<void()> task);
+
+        // Runs task(0) .. task(count - 1) on the workers and blocks until all of them have finished.
+        // Called from one of this pool's own tasks it runs them inline, waiting there could take every worker.
+        void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+        unsigned GetThreadCount() const;
+
+        // Pool shared by the loaders, created on first use
+        static ThreadPool& GetShared();
+
+    private:
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()> > tasks;
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        bool stopping;
+
+        void WorkerLoop();
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+    };
+}
+
+#endif /* ThreadPool_hpp */
@@ -7,9 +7,9 @@ namespace gps {
             throw std::runtime_error("Could not start GLFW3!");
         }
 
-        //window hints
+        //window hints - 4.3 for compute shaders where the driver has it, 4.1 (all macOS offers) otherwise
         glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -20,6 +20,10 @@ namespace gps {
         glfwWindowHint(GLFW_SAMPLES, 4);
 
         this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        if (!this->window) {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+            this->window = glfwCreateWindow(width, height, title, NULL, NULL);
+        }
         if (!this->window) {
             throw std::runtime_error("Could not create GLFW3 window!");
         }
@@ -13,8 +13,22 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "TextureStreamer.hpp"
+#include "GLTaskQueue.hpp"
+#include "GLState.hpp"
+#include "FrameData.hpp"
+#include "DrawDataRing.hpp"
+#include "MaterialTable.hpp"
+#include "RenderQueue.hpp"
+#include "SceneBVH.hpp"
+#include "OcclusionCuller.hpp"
+#include "OcclusionRasterizer.hpp"
+#include "GpuCuller.hpp"
+
+#include <chrono>
+#include <cstdio>
 #include <iostream>
+#include <unistd.h>
 
 #define WIDTH 1920
 #define HEIGHT 1080
@@ -32,14 +46,6 @@ glm::vec3 lightDir;
 glm::vec3 lightColor;
 //fog
 float fogDensity = 0.02f;
-// shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
-GLint fogDensityLoc;
 
 // camera
 gps::Camera myCamera(
@@ -58,11 +64,23 @@ bool firstMouse = true;
 
 GLboolean pressedKeys[1024];
 
+// box queries deciding which map meshes are hidden behind others - declared before the models testing with it
+gps::OcclusionCuller occlusionCuller;
+gps::Shader occlusionBoxShader;
+// the same on the CPU - big, simple map meshes drawn into a small depth buffer, boxes tested against it
+gps::OcclusionRasterizer occlusionRasterizer;
+// map batch commands culled again by a compute pass, against the frustum and last frame's depth pyramid
+gps::GpuCuller gpuCuller;
+
 // models
 gps::Model3D map;
 gps::Shader mapShader;
 
 gps::Model3D teapot;
+// a square of instanced teapots around the map, side x side of them (0 for none)
+gps::Model3D teapotField;
+int teapotFieldSide = 0;
+float teapotFieldSpacing = 4.0f;
 GLfloat anglePitch;
 GLfloat angleYaw;
 glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
@@ -75,6 +93,58 @@ gps::Shader myBasicShader;
 gps::SkyBox skyBox;
 gps::Shader skyBoxShader;
 
+// view, projection, light and fog for every shader
+gps::FrameData frameData;
+// per-draw transforms, fetched by the shaders instead of set as uniforms
+gps::DrawDataRing& drawData = gps::DrawDataRing::GetShared();
+GLuint maxDrawsPerFrame = 4096;
+// slots of draws written once, like the map's batch when it is culled on the GPU
+GLuint maxStaticDraws = 4096;
+// map, teapot and teapot field meshes for frustum, ray and sphere queries - built once loading is done,
+// the teapot's boxes are refit when it moves. Its frustum query culls all three models each frame.
+gps::SceneBVH sceneBVH;
+size_t mapItemCount = 0;
+size_t teapotFirstItem = 0;
+size_t teapotItemCount = 0;
+size_t teapotFieldFirstItem = 0;
+size_t teapotFieldItemCount = 0;
+glm::mat4 teapotBVHModel;
+// items the frame's query found, and a flag per item the models read
+std::vector<uint32_t> sceneVisibleItems;
+std::vector<uint8_t> sceneVisible;
+glm::mat4 mapModel = glm::translate(glm::mat4(1.0f), glm::vec3(-15.0f, -1.0f, 8.0f));
+glm::mat4 teapotFieldModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+// the frame's draws, sorted by pass, program, material and depth before they are issued
+gps::RenderQueue renderQueue;
+
+// loading - first frame right away, models and textures arrive while rendering
+bool asyncLoading = true;
+// GL work handed over by the loader threads, per frame
+double loadBudgetMs = 4.0;
+// the map is only drawn, it needs no CPU copy of its geometry
+bool keepMeshGeometry = false;
+// map props baked in several times are stored once and drawn instanced
+bool detectInstances = true;
+// map shapes sharing a material are merged into one mesh per cell of this size (0 keeps every shape)
+float staticBatchCellSize = 25.0f;
+// map meshes hidden at their last box query are only drawn if this frame's query passes
+bool occlusionCulling = true;
+// map meshes hidden behind the rasterized occluders are not submitted at all - O turns it on, P off
+bool softwareOcclusion = false;
+// map meshes kept on the CPU as occluders - at most this many triangles, at least this wide
+size_t occluderMaxTriangles = 4096;
+float occluderMinSize = 4.0f;
+// the map's batch is culled on the GPU where compute shaders are available (GL 4.3)
+bool gpuCulling = true;
+// whole models in one multi-draw per texture set, once they are loaded
+bool batchedDrawing = true;
+// batched models sample their textures from arrays once everything is loaded
+bool materialArrays = true;
+// prints the issued/skipped GL state calls of one frame every few seconds
+bool reportStateCalls = true;
+double stateReportIntervalMs = 5000.0;
+std::chrono::steady_clock::time_point startTime;
+
 GLenum glCheckError_(const char *file, int line) {
     GLenum errorCode;
     while ((errorCode = glGetError()) != GL_NO_ERROR) {
@@ -112,15 +182,9 @@ GLenum glCheckError_(const char *file, int line) {
 void windowResizeCallback(GLFWwindow *window, int width, int height) {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
     myWindow.setWindowDimensions(WindowDimensions{width, height});
-    myBasicShader.useShaderProgram();
 
+    // reaches the shaders with the next frame's FrameData
     projection = glm::perspective(glm::radians(45.0f), (float) width / (float) height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "projection"), 1, GL_FALSE,
-                       glm::value_ptr(projection));
-
-    skyBoxShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(skyBoxShader.shaderProgram, "projection"), 1, GL_FALSE,
-                       glm::value_ptr(projection));
 
     glViewport(0, 0, width, height);
 }
@@ -218,10 +282,6 @@ void processMovement() {
 
     //update view matrix
     view = myCamera.getViewMatrix();
-    myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    // compute normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
 
     //object movement
     //teapot - rotate
@@ -256,34 +316,34 @@ void processMovement() {
     model = glm::scale(model, scale);
     model = glm::translate(model, movement);
     // update normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
+    normalMatrix = glm::mat3(glm::inverseTranspose(model));
 
     //others
     if (pressedKeys[GLFW_KEY_R]) {//reset
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gps::GLState::Get().PolygonMode(GL_FILL);
         glShadeModel(GL_SMOOTH);
         glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     }
     if (pressedKeys[GLFW_KEY_T]) {//wireframe
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gps::GLState::Get().PolygonMode(GL_LINE);
     }
     if (pressedKeys[GLFW_KEY_Y]) {//point
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+        gps::GLState::Get().PolygonMode(GL_POINT);
     }
     if (pressedKeys[GLFW_KEY_U]) {//unlock mouse
         glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
     if (pressedKeys[GLFW_KEY_F]) {//fog off
         fogDensity = 0.0f;
-        myBasicShader.useShaderProgram();
-        fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-        glUniform1fv(fogDensityLoc, 1, &fogDensity);
     }
     if (pressedKeys[GLFW_KEY_G]) {//fog on
         fogDensity = 0.02f;
-        myBasicShader.useShaderProgram();
-        fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-        glUniform1fv(fogDensityLoc, 1, &fogDensity);
+    }
+    if (pressedKeys[GLFW_KEY_O]) {//software occlusion culling on
+        softwareOcclusion = true;
+    }
+    if (pressedKeys[GLFW_KEY_P]) {//software occlusion culling off
+        softwareOcclusion = false;
     }
 }
 
@@ -302,10 +362,11 @@ void initOpenGLState() {
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
     glEnable(GL_DEPTH_TEST); // enable depth-testing
-    glDepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
+    gps::GLState::Get().DepthFunc(GL_LESS); // depth-testing interprets a smaller value as "closer"
     glEnable(GL_CULL_FACE); // cull face
     glCullFace(GL_BACK); // cull back face
     glFrontFace(GL_CCW); // GL_CCW for counter clock-wise
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // enabled by the render queue for the blended pass
     glfwSetInputMode(myWindow.getWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 }
@@ -318,18 +379,72 @@ void initSkyBox() {
     faces.push_back("../skybox/bottom.jpg");
     faces.push_back("../skybox/front.jpg");
     faces.push_back("../skybox/back.jpg");
-    skyBox.Load(faces);
+    if (asyncLoading) {
+        skyBox.LoadAsync(faces);
+    } else {
+        skyBox.Load(faces);
+    }
+}
+
+// The teapot's meshes once more, drawn side x side times by a single instanced draw per mesh
+void initTeapotField() {
+    if (teapotFieldSide <= 0) {
+        return;
+    }
+    std::vector<glm::mat4> transforms;
+    float offset = (teapotFieldSide - 1) * teapotFieldSpacing * 0.5f;
+    for (int z = 0; z < teapotFieldSide; z++) {
+        for (int x = 0; x < teapotFieldSide; x++) {
+            glm::vec3 position(x * teapotFieldSpacing - offset, 0.0f, z * teapotFieldSpacing - offset);
+            transforms.push_back(glm::rotate(glm::translate(glm::mat4(1.0f), position),
+                                             glm::radians((float)((x * 37 + z * 101) % 360)), glm::vec3(0, 1, 0)));
+        }
+    }
+    teapotField.SetInstances(transforms);
+    if (asyncLoading) {
+        teapotField.LoadModelAsync("../models/teapot/teapot20segUT.obj");
+    } else {
+        teapotField.LoadModel("../models/teapot/teapot20segUT.obj");
+    }
 }
 
 void initModels() {
-    map.LoadModel("../models/others/Map_v1.obj");
-    teapot.LoadModel("../models/teapot/teapot20segUT.obj");
+    // texture files copied under another name are uploaded once
+    gps::AssetRegistry::Get().SetContentDedupe(true);
+    map.SetKeepGeometry(keepMeshGeometry);
+    teapot.SetKeepGeometry(keepMeshGeometry);
+    map.SetInstanceDetection(detectInstances);
+    map.SetStaticBatching(staticBatchCellSize);
+    map.SetBatched(batchedDrawing);
+    teapot.SetBatched(batchedDrawing);
+    map.SetMaterialArrays(materialArrays);
+    if (occlusionCulling) {
+        map.SetOcclusionCuller(&occlusionCuller);
+    }
+    map.SetOccluders(occluderMaxTriangles, occluderMinSize);
+    map.SetOcclusionRasterizer(&occlusionRasterizer);
+    if (gpuCulling) {
+        map.SetGpuCuller(&gpuCuller);
+    }
+    teapot.SetMaterialArrays(materialArrays);
+    if (asyncLoading) {
+        map.LoadModelAsync("../models/others/Map_v1.obj");
+        teapot.LoadModelAsync("../models/teapot/teapot20segUT.obj");
+    } else {
+        map.LoadModel("../models/others/Map_v1.obj");
+        teapot.LoadModel("../models/teapot/teapot20segUT.obj");
+    }
+    initTeapotField();
 }
 
 
 void initShaders() {
     myBasicShader.loadShader("../shaders/basic.vert", "../shaders/basic.frag");
     skyBoxShader.loadShader("../shaders/skyboxShader.vert", "../shaders/skyboxShader.frag");
+    occlusionBoxShader.loadShader("../shaders/occlusionBox.vert", "../shaders/occlusionBox.frag");
+    if (gpuCulling) {
+        gpuCuller.Init("../shaders/cullBatch.comp", "../shaders/hiZPyramid.comp");
+    }
 }
 
 void initUniforms() {
@@ -337,17 +452,12 @@ void initUniforms() {
 
     // create model matrix for teapot
     model = glm::mat4(1.0f);
-    modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-
 
     // get view matrix for current camera
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     // compute normal matrix for teapot
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
+    normalMatrix = glm::mat3(glm::inverseTranspose(model));
 
 
     // create projection matrix
@@ -355,61 +465,146 @@ void initUniforms() {
                                   (float) myWindow.getWindowDimensions().width /
                                   (float) myWindow.getWindowDimensions().height,
                                   0.1f, 1000.0f);
-    // send projection matrix to shader
-    projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE,
-                       glm::value_ptr(projection));
 
     //set the light direction (direction towards the light)
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    // send light dir to shader
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(lightDir));
 
     //set light color
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-    lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-    // send light color to shader
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
-    //fog
-    fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-    glUniform1fv(fogDensityLoc, 1, &fogDensity);
+    // camera, light and fog reach both shaders through one uniform buffer
+    frameData.Init();
+    gps::FrameData::Attach(myBasicShader);
+    gps::FrameData::Attach(skyBoxShader);
 
-    //skybox
-    skyBoxShader.useShaderProgram();
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(skyBoxShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(skyBoxShader.shaderProgram, "projection"), 1, GL_FALSE,
-                       glm::value_ptr(projection));
+    occlusionCuller.Init();
+
+    // samplers keep pointing at the same units, they are set once
+    gps::Mesh::AttachSamplers(myBasicShader);
+    gps::SkyBox::AttachSampler(skyBoxShader);
+    myBasicShader.useShaderProgram();
+    drawData.Init(maxDrawsPerFrame, maxStaticDraws);
+    glUniform1i(myBasicShader.GetUniformLocation(gps::HashName("drawData")), gps::DRAW_DATA_UNIT);
+    // draws without instance data read the instance matrix attributes' current value
+    gps::Mesh::SetIdentityInstance();
+    // every declared sampler is set, Build uses no more of them than the fragment stage has units for
+    GLint arrayUnits[gps::MAX_MATERIAL_ARRAYS];
+    for (int i = 0; i < gps::MAX_MATERIAL_ARRAYS; i++) {
+        arrayUnits[i] = gps::MATERIAL_ARRAY_UNIT + i;
+    }
+    glUniform1iv(myBasicShader.GetUniformLocation(gps::HashName("materialArrays")), gps::MAX_MATERIAL_ARRAYS, arrayUnits);
 }
 
-void renderTeapot(gps::Shader shader) {
-    // select active shader program
-//    shader.useShaderProgram();
-    shader.useShaderProgram();
-    //send teapot model matrix data to shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+// One upload per frame, however many programs read it
+void updateFrameData() {
+    gps::FrameUniforms uniforms;
+    uniforms.view = view;
+    uniforms.projection = projection;
+    uniforms.lightDir = glm::vec4(lightDir, 0.0f);
+    uniforms.lightColor = glm::vec4(lightColor, 1.0f);
+    uniforms.fogDensity = fogDensity;
+    frameData.Update(uniforms);
+}
+
+void renderTeapot(const gps::Shader &shader) {
+    // queue teapot, its model and normal matrix go to the ring
+    teapot.Submit(renderQueue, shader, model, normalMatrix);
+}
 
-    //send teapot normal matrix data to shader
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+void updateSceneBVH();
 
-    // draw teapot
-    teapot.Draw(shader);
+// One BVH query for the whole scene instead of a frustum test per model and mesh, once the tree is built
+void cullScene() {
+    if (sceneBVH.GetItemCount() == 0) {
+        return;
+    }
+    updateSceneBVH();
+    gps::Frustum frustum;
+    frustum.Extract(projection * view);
+    sceneVisibleItems.clear();
+    sceneBVH.QueryFrustum(frustum, sceneVisibleItems);
+    sceneVisible.assign(sceneBVH.GetItemCount(), 0);
+    for (size_t i = 0; i < sceneVisibleItems.size(); i++) {
+        sceneVisible[sceneVisibleItems[i]] = 1;
+    }
+    map.SetSceneVisibility(&sceneVisible[0], mapItemCount);
+    teapot.SetSceneVisibility(&sceneVisible[teapotFirstItem], teapotItemCount);
+    teapotField.SetSceneVisibility(&sceneVisible[teapotFieldFirstItem], teapotFieldItemCount);
 }
 
 void renderScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    updateFrameData();
     //render the scene
-    glm::mat4 mapModel = glm::translate(glm::mat4(1.0f),glm::vec3(-15.0f,-1.0f,8.0f));
-    myBasicShader.useShaderProgram();
-    GLint mapModelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-    glUniformMatrix4fv(mapModelLoc, 1, GL_FALSE, glm::value_ptr(mapModel));
-
-    map.Draw(myBasicShader);
+    drawData.BeginFrame();
+    renderQueue.Begin(view, projection);
+    occlusionCuller.Begin(view, projection);
+    gpuCuller.Begin(view, projection);
+    // left empty and unrendered when off, every box passes then
+    occlusionRasterizer.Begin(view, projection);
+    cullScene();
+    if (softwareOcclusion) {
+        map.AddOccluders(occlusionRasterizer, mapModel);
+        occlusionRasterizer.Render();
+    }
+    map.Submit(renderQueue, myBasicShader, mapModel, glm::mat3(glm::inverseTranspose(mapModel)));
     // render the teapot
     renderTeapot(myBasicShader);
-    skyBox.Draw(skyBoxShader, view, projection);
+    if (teapotField.GetInstanceCount() > 0) {
+        teapotField.Submit(renderQueue, myBasicShader, teapotFieldModel,
+                           glm::mat3(glm::inverseTranspose(teapotFieldModel)));
+    }
+    skyBox.Submit(renderQueue, skyBoxShader);
+    // after every model, their meshes pick the boxes to query
+    occlusionCuller.Submit(renderQueue, occlusionBoxShader);
+    drawData.Flush();
+    renderQueue.Execute();
+    // the pyramid the next frame's cull pass tests against
+    gpuCuller.EndFrame(myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
+    drawData.EndFrame();
+}
+
+void buildSceneBVH() {
+    std::vector<gps::BVHItem> items;
+    mapItemCount = map.AppendBounds(mapModel, items);
+    teapotFirstItem = items.size();
+    teapotItemCount = teapot.AppendBounds(model, items);
+    teapotBVHModel = model;
+    teapotFieldFirstItem = items.size();
+    teapotFieldItemCount = teapotField.AppendBounds(teapotFieldModel, items);
+    sceneBVH.Build(items);
+    std::cout << "Scene BVH           : " << sceneBVH.GetItemCount() << " items, " << sceneBVH.GetNodeCount()
+              << " nodes" << std::endl;
+}
+
+// Only the teapot moves, its boxes are refit in place
+void updateSceneBVH() {
+    if (sceneBVH.GetItemCount() == 0 || model == teapotBVHModel) {
+        return;
+    }
+    std::vector<gps::BVHItem> items;
+    teapot.AppendBounds(model, items);
+    for (size_t i = 0; i < items.size() && i < teapotItemCount; i++) {
+        sceneBVH.Refit(teapotFirstItem + i, items[i].boundsMin, items[i].boundsMax);
+    }
+    teapotBVHModel = model;
+}
+
+void reportSceneQueries() {
+    if (sceneBVH.GetItemCount() == 0) {
+        return;
+    }
+    // the frame's culling query already found the ones in view
+    std::cout << "# scene BVH    : " << sceneVisibleItems.size() << " of " << sceneBVH.GetItemCount() << " items in view";
+    uint32_t picked;
+    float distance;
+    if (sceneBVH.Raycast(myCamera.getPosition(), myCamera.getFrontDirection(), 1000.0f, picked, distance)) {
+        std::cout << ", looking at item " << picked << " " << distance << " away";
+    }
+    std::vector<uint32_t> nearby;
+    sceneBVH.QuerySphere(myCamera.getPosition(), 10.0f, nearby);
+    std::cout << ", " << nearby.size() << " within 10 units";
+    std::cout << std::endl;
 }
 
 void cleanup() {
@@ -424,7 +619,27 @@ void processDelta() {
     lastFrame = newFrame;
 }
 
+// Resident set size from /proc/self/statm, 0 where it is not available
+size_t residentSetKB() {
+    long pages = 0;
+    long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) {
+        return 0;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double millisecondsSinceStart() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+}
+
 int main(int argc, const char *argv[]) {
+    startTime = std::chrono::steady_clock::now();
     try {
         initOpenGLWindow();
     } catch (const std::exception &e) {
@@ -438,14 +653,64 @@ int main(int argc, const char *argv[]) {
     initUniforms();
     setWindowCallbacks();
     glCheckError();
+    bool firstFrame = true;
+    bool fullyLoaded = false;
+    bool materialArraysChecked = false;
+    double lastStateReport = 0.0;
+    size_t framesSinceReport = 0;
     // application loop
     while (!glfwWindowShouldClose(myWindow.getWindow())) {
         processDelta();
         processMovement();
         renderScene();
+        // meshes and textures keep arriving while the scene is already drawn
+        gps::GLTaskQueue::GetShared().RunPending(loadBudgetMs);
+        gps::TextureStreamer::GetShared().Update();
         glfwPollEvents();
         glfwSwapBuffers(myWindow.getWindow());
         glCheckError();
+        gps::GLState::Get().EndFrame();
+
+        if (firstFrame) {
+            std::cout << "Time to first frame : " << millisecondsSinceStart() << " ms" << std::endl;
+            firstFrame = false;
+        }
+        if (!fullyLoaded && gps::GLTaskQueue::GetShared().IsIdle() && gps::TextureStreamer::GetShared().IsIdle()) {
+            std::cout << "Fully loaded        : " << millisecondsSinceStart() << " ms, resident set "
+                      << residentSetKB() / 1024 << " MB" << std::endl;
+            fullyLoaded = true;
+            buildSceneBVH();
+        }
+        // the map's textures fit the arrays the shader has, it should draw without per-mesh binds
+        if (materialArrays && !materialArraysChecked && map.TriedMaterialArrays()) {
+            if (!map.UsesMaterialArrays()) {
+                fprintf(stderr, "WARNING: the map did not fit in texture arrays, it binds its textures per mesh\n");
+            }
+            materialArraysChecked = true;
+        }
+        framesSinceReport++;
+        if (reportStateCalls && millisecondsSinceStart() - lastStateReport >= stateReportIntervalMs) {
+            gps::GLState::Get().PrintLastFrame(std::cout);
+            std::cout << "# culled draws : " << renderQueue.GetCulledCount() << " of "
+                      << renderQueue.GetTestedCount() << " meshes" << std::endl;
+            std::cout << "# occlusion    : " << occlusionCuller.GetQueryCount() << " box queries, "
+                      << occlusionCuller.GetConditionalCount() << " meshes drawn conditionally, "
+                      << occlusionCuller.GetFramesInFlight() << " frames of results pending" << std::endl;
+            std::cout << "# software occl: " << (softwareOcclusion ? "on, " : "off, ")
+                      << occlusionRasterizer.GetOccluderCount() << " occluders, "
+                      << occlusionRasterizer.GetTriangleCount() << " triangles in " << occlusionRasterizer.GetRenderMs()
+                      << " ms, " << occlusionRasterizer.GetOccludedCount() << " of "
+                      << occlusionRasterizer.GetTestedCount() << " meshes hidden" << std::endl;
+            std::cout << "# gpu culling  : " << (gpuCuller.IsReady() ? "on, " : "off, ")
+                      << gpuCuller.GetTestedCount() << " batch commands tested" << std::endl;
+            reportSceneQueries();
+            // compare with software occlusion on and off
+            double now = millisecondsSinceStart();
+            std::cout << "# frame time   : " << (now - lastStateReport) / framesSinceReport << " ms average over "
+                      << framesSinceReport << " frames" << std::endl;
+            framesSinceReport = 0;
+            lastStateReport = now;
+        }
     }
     cleanup();
     return EXIT_SUCCESS;
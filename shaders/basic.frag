@@ -1,24 +1,28 @@
 #version 410 core
 
-in vec3 fPosition;
-in vec3 fNormal;
+// eye space, the per-draw matrices are applied in the vertex shader
+in vec4 fPosEye;
+in vec3 fNormalEye;
 in vec2 fTexCoords;
+// diffuse array, diffuse layer, specular array, specular layer
+flat in vec4 fMaterial;
 
 out vec4 fColor;
 
-//matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat3 normalMatrix;
-
-//lighting
-uniform vec3 lightDir;
-uniform vec3 lightColor;
-
-// textures
+//camera, lighting and fog, shared with every program
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightDir;
+    vec4 lightColor;
+    float fogDensity;
+};
+
+// textures - bound per mesh, or packed into arrays and picked by fMaterial
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform float fogDensity;
+uniform sampler2DArray materialArrays[12];
 
 //components
 vec3 ambient;
@@ -27,8 +31,28 @@ vec3 diffuse;
 vec3 specular;
 float specularStrength = 0.5f;
 
-vec4 fPosEye;
 
+// array -1 samples the bound texture, -2 means the mesh has none. The same for the whole draw.
+vec4 sampleMaterial(float array, float layer, sampler2D boundTexture)
+{
+    vec3 coords = vec3(fTexCoords, layer);
+    switch (int(array)) {
+        case -1: return texture(boundTexture, fTexCoords);
+        case 0: return texture(materialArrays[0], coords);
+        case 1: return texture(materialArrays[1], coords);
+        case 2: return texture(materialArrays[2], coords);
+        case 3: return texture(materialArrays[3], coords);
+        case 4: return texture(materialArrays[4], coords);
+        case 5: return texture(materialArrays[5], coords);
+        case 6: return texture(materialArrays[6], coords);
+        case 7: return texture(materialArrays[7], coords);
+        case 8: return texture(materialArrays[8], coords);
+        case 9: return texture(materialArrays[9], coords);
+        case 10: return texture(materialArrays[10], coords);
+        case 11: return texture(materialArrays[11], coords);
+        default: return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+}
 
 float computeFog()
 {
@@ -40,26 +64,24 @@ float computeFog()
 
 void computeDirLight()
 {
-    //compute eye space coordinates
-    fPosEye = view * model * vec4(fPosition, 1.0f);
-    vec3 normalEye = normalize(normalMatrix * fNormal);
+    vec3 normalEye = normalize(fNormalEye);
 
     //normalize light direction
-    vec3 lightDirN = vec3(normalize(view * vec4(lightDir, 0.0f)));
+    vec3 lightDirN = vec3(normalize(view * vec4(lightDir.xyz, 0.0f)));
 
     //compute view direction (in eye coordinates, the viewer is situated at the origin
     vec3 viewDir = normalize(- fPosEye.xyz);
 
     //compute ambient light
-    ambient = ambientStrength * lightColor;
+    ambient = ambientStrength * lightColor.rgb;
 
     //compute diffuse light
-    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor.rgb;
 
     //compute specular light
     vec3 reflectDir = reflect(-lightDirN, normalEye);
     float specCoeff = pow(max(dot(viewDir, reflectDir), 0.0f), 32);
-    specular = specularStrength * specCoeff * lightColor;
+    specular = specularStrength * specCoeff * lightColor.rgb;
 }
 
 void main() 
@@ -67,10 +89,13 @@ void main()
     computeDirLight();
 
     //compute final vertex color
-    vec3 color = min((ambient + diffuse) * texture(diffuseTexture, fTexCoords).rgb + specular * texture(specularTexture, fTexCoords).rgb, 1.0f);
+    vec4 diffuseColor = sampleMaterial(fMaterial.x, fMaterial.y, diffuseTexture);
+    vec3 specularColor = sampleMaterial(fMaterial.z, fMaterial.w, specularTexture).rgb;
+    vec3 color = min((ambient + diffuse) * diffuseColor.rgb + specular * specularColor, 1.0f);
 
     float fogFactor = computeFog();
     vec4 fogColor = vec4(0.4f, 0.4f, 0.4f, 1.0f);
-    vec4 colour = vec4(color.x, color.y, color.z, 1.0f);
-    fColor = fogColor * (1.0f - fogFactor) + colour * fogFactor;
+    // opaque textures have alpha 1, only the blended pass has blending on
+    vec4 colour = vec4(color.x, color.y, color.z, diffuseColor.a);
+    fColor = vec4(mix(fogColor.rgb, colour.rgb, fogFactor), colour.a);
 }
@@ -3,19 +3,47 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+// slot of this draw in drawData, one value for the whole draw
+layout(location=3) in uint vDrawIndex;
+// per-instance transform, applied before the draw's model matrix - identity outside instanced draws
+layout(location=4) in mat4 vInstance;
 
-out vec3 fPosition;
-out vec3 fNormal;
+out vec4 fPosEye;
+out vec3 fNormalEye;
 out vec2 fTexCoords;
+flat out vec4 fMaterial;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-draw data, 8 texels a draw: model matrix, normal matrix columns, material
+uniform samplerBuffer drawData;
+
+// shared with every program, written once per frame
+layout(std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec4 lightDir;
+    vec4 lightColor;
+    float fogDensity;
+};
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fPosition = vPosition;
-	fNormal = vNormal;
+	int base = int(vDrawIndex) * 8;
+	mat4 model = mat4(texelFetch(drawData, base), texelFetch(drawData, base + 1),
+	                  texelFetch(drawData, base + 2), texelFetch(drawData, base + 3));
+	// world space, so a draw's data does not change with the camera - the view is a rigid lookAt
+	mat3 normalMatrix = mat3(view) * mat3(texelFetch(drawData, base + 4).xyz, texelFetch(drawData, base + 5).xyz,
+	                                      texelFetch(drawData, base + 6).xyz);
+
+	// normals take the inverse transpose of the instance matrix - its cofactor matrix is that up to
+	// the determinant, whose size the fragment shader normalizes away
+	mat3 instance = mat3(vInstance);
+	mat3 cofactor = mat3(cross(instance[1], instance[2]), cross(instance[2], instance[0]), cross(instance[0], instance[1]));
+	cofactor *= sign(dot(instance[0], cofactor[0]));
+
+	fPosEye = view * model * vInstance * vec4(vPosition, 1.0f);
+	gl_Position = projection * fPosEye;
+	fNormalEye = normalMatrix * cofactor * vNormal;
 	fTexCoords = vTexCoords;
+	fMaterial = texelFetch(drawData, base + 7);
 }
@@ -0,0 +1,9 @@
+#version 410 core
+
+out vec4 fColor;
+
+// colour writes are off while the boxes are drawn, only the depth test counts
+void main()
+{
+    fColor = vec4(1.0);
+}
@@ -0,0 +1,11 @@
+#version 410 core
+
+layout(location=0) in vec3 vPosition;
+
+// unit cube to clip space, the box of one occlusion query
+uniform mat4 boxMatrix;
+
+void main()
+{
+    gl_Position = boxMatrix * vec4(vPosition, 1.0);
+}
@@ -23,6 +23,8 @@
  */
 
 //
+// local         : Tokenize the whole .obj buffer in place and parse numbers with
+//                 an exact fast path (no per-line std::string, no atoi).
 // version 1.0.2 : Improve parsing speed by about a factor of 2 for large files(#105)
 // version 1.0.1 : Fixes a shape is lost if obj ends with a 'usemtl'(#104)
 // version 1.0.0 : Change data structure. Change license from BSD to MIT.
@@ -232,6 +234,11 @@ namespace tinyobj {
     void LoadMtl(std::map<std::string, int> *material_map,
                  std::vector<material_t> *materials, std::istream *inStream);
     
+    /// Parses the floating point number in [s, s_end) used by the .obj reader.
+    /// Returns false when the text is not a number; the result is correctly
+    /// rounded to double.
+    bool tryParseDouble(const char *s, const char *s_end, double *result);
+    
 }  // namespace tinyobj
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
@@ -273,6 +280,39 @@ namespace tinyobj {
         std::vector<float> vt;
     };
     
+    // Faces waiting to be exported, stored flat to avoid one allocation per face
+    struct face_group {
+        std::vector<vertex_index> vertices;
+        std::vector<unsigned int> num_verts;
+        
+        bool empty() const { return num_verts.empty(); }
+        void clear() {
+            vertices.clear();
+            num_verts.clear();
+        }
+    };
+    
+    // Reads the rest of the stream into one buffer
+    static void readStream(std::istream *inStream, std::string *buf) {
+        std::streampos start = inStream->tellg();
+        inStream->seekg(0, std::ios::end);
+        std::streampos end = inStream->tellg();
+        if (start != std::streampos(-1) && end != std::streampos(-1) && end >= start) {
+            inStream->seekg(start);
+            buf->resize(static_cast<size_t>(end - start));
+            if (!buf->empty()) {
+                inStream->read(&(*buf)[0], static_cast<std::streamsize>(buf->size()));
+                buf->resize(static_cast<size_t>(inStream->gcount()));
+            }
+        } else {
+            // not seekable
+            inStream->clear();
+            std::stringstream ss;
+            ss << inStream->rdbuf();
+            *buf = ss.str();
+        }
+    }
+    
     // See
     // http://stackoverflow.com/questions/6089231/getting-std-ifstream-to-handle-lf-cr-and-crlf
     static std::istream &safeGetline(std::istream &is, std::string &t) {
@@ -317,19 +357,53 @@ namespace tinyobj {
         return n + idx;  // negative value = relative
     }
     
+    // Lines are parsed in place inside the whole file buffer, so every scan
+    // below also has to stop at '\n'.
     static inline std::string parseString(const char **token) {
         std::string s;
         (*token) += strspn((*token), " \t");
-        size_t e = strcspn((*token), " \t\r");
+        size_t e = strcspn((*token), " \t\r\n");
         s = std::string((*token), &(*token)[e]);
         (*token) += e;
         return s;
     }
     
+    // Inlined strspn(token, " \t") / strcspn(token, " \t\r\n") for the hot paths
+    static inline const char *skipSpace(const char *token) {
+        while (IS_SPACE(*token)) token++;
+        return token;
+    }
+    
+    static inline const char *skipToken(const char *token) {
+        while (!IS_SPACE(*token) && !IS_NEW_LINE(*token)) token++;
+        return token;
+    }
+    
+    // Inlined strcspn(token, "/ \t\r\n")
+    static inline const char *skipIndex(const char *token) {
+        while (*token != '/' && !IS_SPACE(*token) && !IS_NEW_LINE(*token)) token++;
+        return token;
+    }
+    
+    // atoi without locale handling or leading whitespace skipping
+    static inline int fastAtoi(const char *token) {
+        bool negative = false;
+        if (*token == '+' || *token == '-') {
+            negative = (*token == '-');
+            token++;
+        }
+        int i = 0;
+        while (IS_DIGIT(*token)) {
+            i = i * 10 + (*token - '0');
+            token++;
+        }
+        return negative ? -i : i;
+    }
+    
     static inline int parseInt(const char **token) {
         (*token) += strspn((*token), " \t");
-        int i = atoi((*token));
-        (*token) += strcspn((*token), " \t\r");
+        int i = fastAtoi((*token));
+        (*token) += strcspn((*token), " \t\r\n");
         return i;
     }
     
@@ -360,130 +434,122 @@ namespace tinyobj {
     //  - s >= s_end.
     //  - parse failure.
     //
-    static bool tryParseDouble(const char *s, const char *s_end, double *result) {
+    // The significant digits are accumulated into a 64-bit integer. When it fits
+    // in 53 bits and the decimal exponent is within +-22 both operands are exact
+    // doubles, so a single multiplication or division gives the correctly
+    // rounded result (Clinger's fast path). Everything else (more than 19
+    // digits, huge exponents) falls back to strtod, which is also correctly
+    // rounded, so both paths agree.
+    //
+    bool tryParseDouble(const char *s, const char *s_end, double *result) {
         if (s >= s_end) {
             return false;
         }
         
-        double mantissa = 0.0;
-        // This exponent is base 2 rather than 10.
-        // However the exponent we parse is supposed to be one of ten,
-        // thus we must take care to convert the exponent/and or the
-        // mantissa to a * 2^E, where a is the mantissa and E is the
-        // exponent.
-        // To get the final double we will use ldexp, it requires the
-        // exponent to be in base 2.
-        int exponent = 0;
-        
-        // NOTE: THESE MUST BE DECLARED HERE SINCE WE ARE NOT ALLOWED
-        // TO JUMP OVER DEFINITIONS.
-        char sign = '+';
-        char exp_sign = '+';
-        char const *curr = s;
+        static const double exact_pow10[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+            1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+            1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+        };
+        const int max_digits = 19;
         
-        // How many characters were read in a loop.
+        const char *curr = s;
+        bool negative = false;
+        unsigned long long mantissa = 0;
+        int digits = 0;      // significant digits held in mantissa
+        int exponent = 0;    // decimal exponent applied to mantissa
+        bool truncated = false;
         int read = 0;
-        // Tells whether a loop terminated due to reaching s_end.
-        bool end_not_reached = false;
-        
-        /*
-         BEGIN PARSING.
-         */
         
-        // Find out what sign we've got.
         if (*curr == '+' || *curr == '-') {
-            sign = *curr;
+            negative = (*curr == '-');
             curr++;
-        } else if (IS_DIGIT(*curr)) { /* Pass through. */
-        } else {
-            goto fail;
         }
         
         // Read the integer part.
-        end_not_reached = (curr != s_end);
-        while (end_not_reached && IS_DIGIT(*curr)) {
-            mantissa *= 10;
-            mantissa += static_cast<int>(*curr - 0x30);
+        while (curr != s_end && IS_DIGIT(*curr)) {
+            int d = *curr - '0';
+            if (digits < max_digits) {
+                mantissa = mantissa * 10 + static_cast<unsigned long long>(d);
+                if (mantissa != 0) digits++;
+            } else {
+                exponent++;
+                if (d != 0) truncated = true;
+            }
             curr++;
             read++;
-            end_not_reached = (curr != s_end);
         }
         
         // We must make sure we actually got something.
-        if (read == 0) goto fail;
-        // We allow numbers of form "#", "###" etc.
-        if (!end_not_reached) goto assemble;
+        if (read == 0) return false;
         
         // Read the decimal part.
-        if (*curr == '.') {
+        if (curr != s_end && *curr == '.') {
             curr++;
-            read = 1;
-            end_not_reached = (curr != s_end);
-            while (end_not_reached && IS_DIGIT(*curr)) {
-                static const double pow_lut[] = {
-                    1.0,
-                    0.1,
-                    0.01,
-                    0.001,
-                    0.0001,
-                    0.00001,
-                    0.000001,
-                    0.0000001,
-                };
-                const int lut_entries = sizeof pow_lut / sizeof pow_lut[0];
-                
-                // NOTE: Don't use powf here, it will absolutely murder precision.
-                mantissa += static_cast<int>(*curr - 0x30) *
-                (read < lut_entries ? pow_lut[read] : pow(10.0, -read));
-                read++;
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                int d = *curr - '0';
+                if (digits < max_digits) {
+                    mantissa = mantissa * 10 + static_cast<unsigned long long>(d);
+                    if (mantissa != 0) digits++;
+                    exponent--;
+                } else if (d != 0) {
+                    truncated = true;
+                }
                 curr++;
-                end_not_reached = (curr != s_end);
             }
-        } else if (*curr == 'e' || *curr == 'E') {
-        } else {
-            goto assemble;
         }
         
-        if (!end_not_reached) goto assemble;
-        
         // Read the exponent part.
-        if (*curr == 'e' || *curr == 'E') {
+        if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
             curr++;
-            // Figure out if a sign is present and if it is.
-            end_not_reached = (curr != s_end);
-            if (end_not_reached && (*curr == '+' || *curr == '-')) {
-                exp_sign = *curr;
+            bool exp_negative = false;
+            if (curr != s_end && (*curr == '+' || *curr == '-')) {
+                exp_negative = (*curr == '-');
                 curr++;
-            } else if (IS_DIGIT(*curr)) { /* Pass through. */
-            } else {
-                // Empty E is not allowed.
-                goto fail;
             }
             
+            int exp_value = 0;
             read = 0;
-            end_not_reached = (curr != s_end);
-            while (end_not_reached && IS_DIGIT(*curr)) {
-                exponent *= 10;
-                exponent += static_cast<int>(*curr - 0x30);
+            while (curr != s_end && IS_DIGIT(*curr)) {
+                if (exp_value < 100000) {
+                    exp_value = exp_value * 10 + (*curr - '0');
+                }
                 curr++;
                 read++;
-                end_not_reached = (curr != s_end);
             }
-            exponent *= (exp_sign == '+' ? 1 : -1);
-            if (read == 0) goto fail;
+            // Empty E is not allowed.
+            if (read == 0) return false;
+            exponent += exp_negative ? -exp_value : exp_value;
+        }
+        
+        if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 &&
+            exponent <= 22) {
+            double value = static_cast<double>(mantissa);
+            if (exponent < 0) {
+                value /= exact_pow10[-exponent];
+            } else {
+                value *= exact_pow10[exponent];
+            }
+            *result = negative ? -value : value;
+            return true;
         }
         
-    assemble:
-        *result = (sign == '+' ? 1 : -1) *
-        (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+        // Slow path: hand the validated text to the C library.
+        char buf[64];
+        size_t len = static_cast<size_t>(curr - s);
+        if (len < sizeof(buf)) {
+            memcpy(buf, s, len);
+            buf[len] = '\0';
+            *result = strtod(buf, NULL);
+        } else {
+            *result = strtod(std::string(s, curr).c_str(), NULL);
+        }
         return true;
-    fail:
-        return false;
     }
     
     static inline float parseFloat(const char **token, double default_value = 0.0) {
-        (*token) += strspn((*token), " \t");
-        const char *end = (*token) + strcspn((*token), " \t\r");
+        (*token) = skipSpace(*token);
+        const char *end = skipToken(*token);
         double val = default_value;
         tryParseDouble((*token), end, &val);
         float f = static_cast<float>(val);
@@ -515,21 +581,21 @@ namespace tinyobj {
         tag_sizes ts;
         
         ts.num_ints = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r");
+        (*token) += strcspn((*token), "/ \t\r\n");
         if ((*token)[0] != '/') {
             return ts;
         }
         (*token)++;
         
         ts.num_floats = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r");
+        (*token) += strcspn((*token), "/ \t\r\n");
         if ((*token)[0] != '/') {
             return ts;
         }
         (*token)++;
         
         ts.num_strings = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r") + 1;
+        (*token) += strcspn((*token), "/ \t\r\n") + 1;
         
         return ts;
     }
@@ -539,8 +605,8 @@ namespace tinyobj {
                                     int vtsize) {
         vertex_index vi(-1);
         
-        vi.v_idx = fixIndex(atoi((*token)), vsize);
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.v_idx = fixIndex(fastAtoi((*token)), vsize);
+        (*token) = skipIndex(*token);
         if ((*token)[0] != '/') {
             return vi;
         }
@@ -549,22 +615,22 @@ namespace tinyobj {
         // i//k
         if ((*token)[0] == '/') {
             (*token)++;
-            vi.vn_idx = fixIndex(atoi((*token)), vnsize);
-            (*token) += strcspn((*token), "/ \t\r");
+            vi.vn_idx = fixIndex(fastAtoi((*token)), vnsize);
+            (*token) = skipIndex(*token);
             return vi;
         }
         
         // i/j/k or i/j
-        vi.vt_idx = fixIndex(atoi((*token)), vtsize);
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.vt_idx = fixIndex(fastAtoi((*token)), vtsize);
+        (*token) = skipIndex(*token);
         if ((*token)[0] != '/') {
             return vi;
         }
         
         // i/j/k
         (*token)++;  // skip '/'
-        vi.vn_idx = fixIndex(atoi((*token)), vnsize);
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.vn_idx = fixIndex(fastAtoi((*token)), vnsize);
+        (*token) = skipIndex(*token);
         return vi;
     }
     
@@ -572,8 +638,8 @@ namespace tinyobj {
     static vertex_index parseRawTriple(const char **token) {
         vertex_index vi(static_cast<int>(0));  // 0 is an invalid index in OBJ
         
-        vi.v_idx = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.v_idx = fastAtoi((*token));
+        (*token) += strcspn((*token), "/ \t\r\n");
         if ((*token)[0] != '/') {
             return vi;
         }
@@ -582,22 +648,22 @@ namespace tinyobj {
         // i//k
         if ((*token)[0] == '/') {
             (*token)++;
-            vi.vn_idx = atoi((*token));
-            (*token) += strcspn((*token), "/ \t\r");
+            vi.vn_idx = fastAtoi((*token));
+            (*token) += strcspn((*token), "/ \t\r\n");
             return vi;
         }
         
         // i/j/k or i/j
-        vi.vt_idx = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.vt_idx = fastAtoi((*token));
+        (*token) += strcspn((*token), "/ \t\r\n");
         if ((*token)[0] != '/') {
             return vi;
         }
         
         // i/j/k
         (*token)++;  // skip '/'
-        vi.vn_idx = atoi((*token));
-        (*token) += strcspn((*token), "/ \t\r");
+        vi.vn_idx = fastAtoi((*token));
+        (*token) += strcspn((*token), "/ \t\r\n");
         return vi;
     }
     
@@ -639,7 +705,7 @@ namespace tinyobj {
     }
     
     static bool exportFaceGroupToShape(
-                                       shape_t *shape, const std::vector<std::vector<vertex_index> > &faceGroup,
+                                       shape_t *shape, const face_group &faceGroup,
                                        const std::vector<tag_t> &tags, const int material_id,
                                        const std::string &name, bool triangulate) {
         if (faceGroup.empty()) {
@@ -647,14 +713,15 @@ namespace tinyobj {
         }
         
         // Flatten vertices and indices
-        for (size_t i = 0; i < faceGroup.size(); i++) {
-            const std::vector<vertex_index> &face = faceGroup[i];
+        size_t offset = 0;
+        for (size_t i = 0; i < faceGroup.num_verts.size(); i++) {
+            const vertex_index *face = &faceGroup.vertices[offset];
+            size_t npolys = faceGroup.num_verts[i];
+            offset += npolys;
             
             vertex_index i0 = face[0];
             vertex_index i1(-1);
-            vertex_index i2 = face[1];
-            
-            size_t npolys = face.size();
+            vertex_index i2 = npolys > 1 ? face[1] : face[0];
             
             if (triangulate) {
                 // Polygon -> triangle fan conversion
@@ -1096,7 +1163,7 @@ namespace tinyobj {
         std::vector<float> vn;
         std::vector<float> vt;
         std::vector<tag_t> tags;
-        std::vector<std::vector<vertex_index> > faceGroup;
+        face_group faceGroup;
         std::string name;
         
         // material
@@ -1105,31 +1172,23 @@ namespace tinyobj {
         
         shape_t shape;
         
-        std::string linebuf;
-        while (inStream->peek() != -1) {
-            safeGetline(*inStream, linebuf);
-            
-            // Trim newline '\r\n' or '\n'
-            if (linebuf.size() > 0) {
-                if (linebuf[linebuf.size() - 1] == '\n')
-                    linebuf.erase(linebuf.size() - 1);
-            }
-            if (linebuf.size() > 0) {
-                if (linebuf[linebuf.size() - 1] == '\r')
-                    linebuf.erase(linebuf.size() - 1);
-            }
-            
-            // Skip if empty line.
-            if (linebuf.empty()) {
-                continue;
-            }
+        // Read the whole stream once and tokenize it in place.
+        std::string filebuf;
+        readStream(inStream, &filebuf);
+        const char *cursor = filebuf.c_str();
+        const char *filebuf_end = cursor + filebuf.size();
+        
+        while (cursor < filebuf_end) {
+            const char *token = cursor;
+            const char *line_end = static_cast<const char *>(
+                memchr(cursor, '\n', static_cast<size_t>(filebuf_end - cursor)));
+            cursor = line_end ? line_end + 1 : filebuf_end;
             
             // Skip leading space.
-            const char *token = linebuf.c_str();
             token += strspn(token, " \t");
             
             assert(token);
-            if (token[0] == '\0') continue;  // empty line
+            if (IS_NEW_LINE(token[0])) continue;  // empty line
             
             if (token[0] == '#') continue;  // comment line
             
@@ -1170,34 +1229,28 @@ namespace tinyobj {
                 token += 2;
                 token += strspn(token, " \t");
                 
-                std::vector<vertex_index> face;
-                face.reserve(3);
-                
+                size_t num_verts = 0;
                 while (!IS_NEW_LINE(token[0])) {
                     vertex_index vi = parseTriple(&token, static_cast<int>(v.size() / 3),
                                                   static_cast<int>(vn.size() / 3),
                                                   static_cast<int>(vt.size() / 2));
-                    face.push_back(vi);
+                    faceGroup.vertices.push_back(vi);
+                    num_verts++;
                     size_t n = strspn(token, " \t\r");
                     token += n;
                 }
                 
-                // replace with emplace_back + std::move on C++11
-                faceGroup.push_back(std::vector<vertex_index>());
-                faceGroup[faceGroup.size() - 1].swap(face);
+                if (num_verts > 0) {
+                    faceGroup.num_verts.push_back(static_cast<unsigned int>(num_verts));
+                }
                 
                 continue;
             }
             
             // use mtl
             if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
-                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
                 token += 7;
-#ifdef _MSC_VER
-                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-                sscanf(token, "%s", namebuf);
-#endif
+                std::string namebuf = parseString(&token);
                 
                 int newMaterialId = -1;
                 if (material_map.find(namebuf) != material_map.end()) {
@@ -1222,13 +1275,8 @@ namespace tinyobj {
             // load mtl
             if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
                 if (readMatFn) {
-                    char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
                     token += 7;
-#ifdef _MSC_VER
-                    sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-                    sscanf(token, "%s", namebuf);
-#endif
+                    std::string namebuf = parseString(&token);
                     
                     std::string err_mtl;
                     bool ok = (*readMatFn)(namebuf, materials, &material_map, &err_mtl);
@@ -1294,14 +1342,8 @@ namespace tinyobj {
                 shape = shape_t();
                 
                 // @todo { multiple object name? }
-                char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
                 token += 2;
-#ifdef _MSC_VER
-                sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-                sscanf(token, "%s", namebuf);
-#endif
-                name = std::string(namebuf);
+                name = parseString(&token);
                 
                 continue;
             }